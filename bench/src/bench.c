@@ -0,0 +1,541 @@
+#include "../../src/regex.h"
+#include "counters.h"
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* Measures every pattern of the matrix on every corpus with every engine path
+ * and POSIX regexec() as a baseline. A corpus is scanned line by line, the
+ * first match of every line is searched, so all engines do the same work and
+ * must agree on the number of matching lines. Results are written as CSV, or
+ * as JSON with -j, one record per pattern, corpus and engine. Where the
+ * hardware counters can be read, the scans are also reported in cycles per
+ * byte and misses per KB, which shows whether a matcher is bound by its
+ * instructions, its branches or its memory accesses. Finally, threads share
+ * one compiled regex on the log corpus; with several cpus they have to reach
+ * 60% of linear speedup, which is reported on stderr. */
+
+
+#define DEFAULT_CORPUS_SIZE (2 << 20)
+/* measurements are repeated until they took at least this long */
+#define MIN_SECONDS 0.05
+#define NR_THREADS 4
+#define NR_THREAD_SCANS 8
+
+
+typedef struct {
+    char* name;
+    char* expression;
+} bench_pattern;
+
+
+/* | binds single atoms here, so alternatives of several characters are
+ * grouped, which means the same to regcomp() */
+static bench_pattern patterns[] = {
+    {"literal", "status=404"},
+    {"literal_long", "connection reset by peer"},
+    {"class", "[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+"},
+    {"alternation", "(GET)|(POST)|(PUT)|(DELETE)"},
+    {"alternation_group", "((error)|(warning)|(fatal)): [a-z]+"},
+    {"repeat", "[a-f0-9]{8,12}"},
+    {"anchor_start", "^[0-9-]+ [0-9:]+ ERROR"},
+    {"anchor_end", "timeout$"},
+    {"html_link", "<a href=\"[^\"]*\">"},
+    {"quoted", "\"[^\"]*\""},
+    {"dot_star", "GET .*status=404"},
+    {"blowup", "[a-c]*a[a-c][a-c][a-c][a-c][a-c][a-c][a-c][a-c]z"},
+};
+
+
+/* compile settings of an engine path; posix uses regcomp() instead */
+typedef struct {
+    char* name;
+    int flags;
+    int max_states;
+    int posix;
+} bench_engine;
+
+
+static bench_engine engines[] = {
+    {"default", 0, 0, 0},
+    {"dfa", REGEX_DFA, 0, 0},
+    {"nfa", REGEX_DFA, 1, 0},
+    {"reverse", REGEX_REVERSE | REGEX_DFA, 0, 0},
+    {"posix", 0, 0, 1},
+};
+
+
+#define NR_ELEMENTS(a) (sizeof(a) / sizeof(a[0]))
+
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+// CORPORA
+
+
+static unsigned long long random_state = 88172645463325252ULL;
+
+static unsigned next_random(unsigned n) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (unsigned)(random_state % n);
+}
+
+
+static char* pick(char** words, int nr_words) {
+    return words[next_random(nr_words)];
+}
+
+
+/* access log lines with a few errors in between */
+static size_t log_line(char* line) {
+    char* methods[] = {"GET", "POST", "GET", "GET", "HEAD"};
+    char* paths[] = {"/api/users", "/index.html", "/static/app.js",
+                     "/api/orders", "/login"};
+    int status[] = {200, 200, 200, 304, 404, 500};
+
+    if (next_random(20) == 0) {
+        return sprintf(line, "2024-05-%02d 12:%02d:%02d ERROR upstream %s\n",
+                       1 + next_random(28), next_random(60), next_random(60),
+                       next_random(2) ? "timeout" : "connection reset by peer");
+    }
+    return sprintf(line,
+                   "10.%u.%u.%u - [2024-05-%02d] %s %s?id=%x status=%d %uus\n",
+                   next_random(256), next_random(256), next_random(256),
+                   1 + next_random(28), pick(methods, 5), pick(paths, 5),
+                   next_random(1 << 30), status[next_random(6)],
+                   next_random(100000));
+}
+
+
+/* markup with links, text and attributes */
+static size_t html_line(char* line) {
+    char* words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "error:"};
+
+    switch (next_random(4)) {
+    case 0:
+        return sprintf(line, "<li><a href=\"/item/%u\">%s %s</a></li>\n",
+                       next_random(10000), pick(words, 6), pick(words, 6));
+    case 1:
+        return sprintf(line, "<div class=\"%s\" id=\"x%u\">\n", pick(words, 6),
+                       next_random(1000));
+    default:
+        return sprintf(line, "<p>%s %s %s %s %s.</p>\n", pick(words, 6),
+                       pick(words, 6), pick(words, 6), pick(words, 6),
+                       pick(words, 6));
+    }
+}
+
+
+/* random bytes except line breaks and NUL, which regexec() would stop at */
+static size_t random_line(char* line) {
+    size_t length = 40 + next_random(80);
+    for (size_t i = 0; i < length; i++) {
+        line[i] = 1 + next_random(255);
+        if (line[i] == '\n') {
+            line[i] = ' ';
+        }
+    }
+    line[length] = '\n';
+    return length + 1;
+}
+
+
+/* fragments that almost match the patterns and fail late */
+static size_t near_miss_line(char* line) {
+    char* fragments[] = {"status=40", "connection reset by pee",
+                         "10.0.0.", "GE", "POS", "error: ",
+                         "deadbee", "2024-05-01 12:00:00 ERRO",
+                         "timeou", "<a href=\"/x",
+                         "abcabcabcabcabcabca"};
+    size_t length = 0;
+    for (int i = 0; i < 6; i++) {
+        length += sprintf(line + length, "%s ", pick(fragments, 11));
+    }
+    line[length - 1] = '\n';
+    return length;
+}
+
+
+typedef struct {
+    char* name;
+    size_t (*line)(char* line);
+} bench_corpus;
+
+
+static bench_corpus corpora[] = {
+    {"logs", log_line},
+    {"html", html_line},
+    {"random", random_line},
+    {"near_miss", near_miss_line},
+};
+
+
+static char* make_corpus(const bench_corpus* c, size_t size, size_t* length) {
+    char* buffer = malloc(size + 256);
+    *length = 0;
+    while (*length < size) {
+        *length += c->line(buffer + *length);
+    }
+    return buffer;
+}
+
+
+// MEASUREMENT
+
+
+/* number of lines of buffer that contain a match */
+static size_t scan_lines(const regex* r,
+                         regex_scratch* s,
+                         const char* buffer,
+                         size_t length) {
+    size_t nr_matching = 0;
+    size_t pos = 0;
+    while (pos < length) {
+        const char* newline = memchr(buffer + pos, '\n', length - pos);
+        size_t end = newline ? (size_t)(newline - buffer) : length;
+        size_t location, match_length;
+        nr_matching += regex_match_first_n(r, s, buffer + pos, end - pos,
+                                           &location, &match_length);
+        pos = end + 1;
+    }
+    return nr_matching;
+}
+
+
+/* the same with regexec(), on a copy with every line null-terminated */
+static size_t scan_lines_posix(const regex_t* re,
+                               const char* buffer,
+                               size_t length) {
+    size_t nr_matching = 0;
+    const char* line = buffer;
+    while (line < buffer + length) {
+        nr_matching += !regexec(re, line, 0, NULL, 0);
+        line += strlen(line) + 1;
+    }
+    return nr_matching;
+}
+
+
+/* the engine that actually matches r */
+static char* engine_path(const regex* r) {
+    if (r->table != NULL) {
+        return r->reverse != NULL ? "reverse" : "dfa";
+    }
+    return r->positions != NULL ? "positions" : "nfa";
+}
+
+
+typedef struct {
+    char* path;
+    double compile_us;
+    int states; /* dfa states, positions or nfa states; -1 for posix */
+    size_t memory;
+    double mb_per_s;
+    size_t nr_matching;
+    size_t nr_bytes; /* bytes scanned over all repetitions */
+    int64_t counters[NR_BENCH_COUNTERS];
+} bench_result;
+
+
+static int run_engine(const bench_engine* e,
+                      bench_counters* counters,
+                      const bench_pattern* p,
+                      const char* corpus,
+                      const char* posix_corpus,
+                      size_t length,
+                      bench_result* result) {
+    int nr_compiles = 0;
+    int nr_scans = 0;
+    double start, end;
+
+    if (e->posix) {
+        regex_t re;
+        start = now();
+        do {
+            if (nr_compiles) {
+                regfree(&re);
+            }
+            if (regcomp(&re, p->expression, REG_EXTENDED | REG_NOSUB)) {
+                return 0;
+            }
+            nr_compiles++;
+        } while (now() - start < MIN_SECONDS);
+        result->compile_us = (now() - start) * 1e6 / nr_compiles;
+
+        counters_start(counters);
+        start = now();
+        do {
+            result->nr_matching = scan_lines_posix(&re, posix_corpus, length);
+            nr_scans++;
+        } while ((end = now()) - start < MIN_SECONDS);
+        counters_stop(counters, result->counters);
+        regfree(&re);
+
+        result->path = "posix";
+        result->states = -1;
+        result->memory = 0;
+        result->mb_per_s = length * nr_scans / (end - start) / 1e6;
+        result->nr_bytes = length * nr_scans;
+        return 1;
+    }
+
+    regex* r = NULL;
+    regex_compile_stats stats;
+    regex_options options = {.flags = e->flags, .max_states = e->max_states};
+    start = now();
+    do {
+        if (!regex_compile_ex(&r, p->expression, &options)) {
+            return 0;
+        }
+        nr_compiles++;
+    } while (now() - start < MIN_SECONDS);
+    result->compile_us = (now() - start) * 1e6 / nr_compiles;
+
+    /* counting the allocations slows the compile down, so it is done once
+     * more outside of the timing */
+    options.stats = &stats;
+    regex_compile_ex(&r, p->expression, &options);
+    result->memory = stats.memory;
+
+    regex_scratch* s = new_regex_scratch(r);
+    counters_start(counters);
+    start = now();
+    do {
+        result->nr_matching = scan_lines(r, s, corpus, length);
+        nr_scans++;
+    } while ((end = now()) - start < MIN_SECONDS);
+    counters_stop(counters, result->counters);
+    delete_regex_scratch(&s);
+
+    result->path = engine_path(r);
+    result->states = r->positions != NULL ? r->positions->nr_positions
+                     : r->nfa != NULL     ? r->nfa->nr_states
+                                          : r->nr_states;
+    result->mb_per_s = length * nr_scans / (end - start) / 1e6;
+    result->nr_bytes = length * nr_scans;
+    delete_regex(&r);
+    return 1;
+}
+
+
+// THREADS
+
+
+typedef struct {
+    const regex* r;
+    const char* corpus;
+    size_t length;
+    size_t nr_matching;
+} thread_job;
+
+
+static void* scan_thread(void* arg) {
+    thread_job* job = arg;
+    regex_scratch* s = new_regex_scratch(job->r);
+    for (int i = 0; i < NR_THREAD_SCANS; i++) {
+        job->nr_matching = scan_lines(job->r, s, job->corpus, job->length);
+    }
+    delete_regex_scratch(&s);
+    return NULL;
+}
+
+
+/* runs nr_threads scanning threads on one shared regex, returns the wall
+ * time; every thread has to find the lines of the first one */
+static double run_threads(thread_job* jobs, int nr_threads, int* errors) {
+    pthread_t threads[NR_THREADS];
+    double start = now();
+    for (int i = 0; i < nr_threads; i++) {
+        pthread_create(&threads[i], NULL, scan_thread, &jobs[i]);
+    }
+    for (int i = 0; i < nr_threads; i++) {
+        pthread_join(threads[i], NULL);
+        *errors += jobs[i].nr_matching != jobs[0].nr_matching;
+    }
+    return now() - start;
+}
+
+
+/* threads sharing one regex have to scale with the cpus they can use */
+static int run_scaling(const bench_pattern* p,
+                       const char* corpus,
+                       size_t length) {
+    regex* r = NULL;
+    thread_job jobs[NR_THREADS];
+    int errors = 0;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nr_parallel = nr_cpus < NR_THREADS ? (int)nr_cpus : NR_THREADS;
+
+    if (!regex_compile(&r, p->expression)) {
+        return 0;
+    }
+    for (int i = 0; i < NR_THREADS; i++) {
+        jobs[i] = (thread_job){r, corpus, length, 0};
+    }
+    double single = run_threads(jobs, 1, &errors) * NR_THREADS;
+    double parallel = run_threads(jobs, NR_THREADS, &errors);
+    double speedup = single / parallel;
+    delete_regex(&r);
+
+    fprintf(stderr, "%d threads on %ld cpus, \"%s\": speedup %.2f%s\n",
+            NR_THREADS, nr_cpus, p->expression, speedup,
+            nr_parallel < 2 ? " (single cpu, not checked)" : "");
+    if (errors) {
+        ERROR("threads disagree on the matching lines\n");
+        return 0;
+    }
+    if (nr_parallel >= 2 && speedup < 0.6 * nr_parallel) {
+        ERROR("speedup %.2f is below 60%% of %d\n", speedup, nr_parallel);
+        return 0;
+    }
+    return 1;
+}
+
+
+/* counter i per bytes_per_unit scanned bytes, formatted for CSV or JSON;
+ * empty or null if the counter is not available */
+static char* per_bytes(const bench_result* result,
+                       bench_counter i,
+                       double bytes_per_unit,
+                       int json,
+                       char* buffer) {
+    if (result->counters[i] < 0) {
+        return json ? "null" : "";
+    }
+    sprintf(buffer, "%.3f",
+            result->counters[i] * bytes_per_unit / result->nr_bytes);
+    return buffer;
+}
+
+
+int main(int argc, char* argv[]) {
+    int json = 0;
+    size_t corpus_size = DEFAULT_CORPUS_SIZE;
+    int failures = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j")) {
+            json = 1;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            corpus_size = strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-j] [-n corpus bytes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("pattern,corpus,engine,path,compile_us,states,memory_bytes,"
+               "mb_per_s,matching_lines,cycles_per_byte,instructions_per_byte,"
+               "branch_misses_per_kb,l1d_misses_per_kb,llc_misses_per_kb\n");
+    }
+
+    bench_counters counters;
+    counters_open(&counters);
+
+    int first = 1;
+    for (size_t c = 0; c < NR_ELEMENTS(corpora); c++) {
+        size_t length;
+        char* corpus = make_corpus(&corpora[c], corpus_size, &length);
+        char* posix_corpus = malloc(length);
+        for (size_t i = 0; i < length; i++) {
+            posix_corpus[i] = corpus[i] == '\n' ? '\0' : corpus[i];
+        }
+
+        for (size_t p = 0; p < NR_ELEMENTS(patterns); p++) {
+            size_t expected = 0;
+            for (size_t e = 0; e < NR_ELEMENTS(engines); e++) {
+                bench_result result;
+                if (!run_engine(&engines[e], &counters, &patterns[p], corpus,
+                                posix_corpus, length, &result)) {
+                    ERROR("could not compile \"%s\" for %s\n",
+                          patterns[p].expression, engines[e].name);
+                    failures++;
+                    continue;
+                }
+
+                /* every engine has to find the same lines */
+                if (e == 0) {
+                    expected = result.nr_matching;
+                } else if (result.nr_matching != expected) {
+                    ERROR("%s finds %zu lines of %s for \"%s\" instead of "
+                          "%zu\n",
+                          engines[e].name, result.nr_matching,
+                          corpora[c].name, patterns[p].expression, expected);
+                    failures++;
+                }
+
+                char metrics[NR_BENCH_COUNTERS][32];
+                char* cycles = per_bytes(&result, bc_cycles, 1, json,
+                                         metrics[bc_cycles]);
+                char* instructions =
+                    per_bytes(&result, bc_instructions, 1, json,
+                              metrics[bc_instructions]);
+                char* branch_misses =
+                    per_bytes(&result, bc_branch_misses, 1024, json,
+                              metrics[bc_branch_misses]);
+                char* l1d_misses = per_bytes(&result, bc_l1d_misses, 1024,
+                                             json, metrics[bc_l1d_misses]);
+                char* llc_misses = per_bytes(&result, bc_llc_misses, 1024,
+                                             json, metrics[bc_llc_misses]);
+
+                if (json) {
+                    printf("%s  {\"pattern\": \"%s\", \"corpus\": \"%s\", "
+                           "\"engine\": \"%s\", \"path\": \"%s\", "
+                           "\"compile_us\": %.2f, \"states\": %d, "
+                           "\"memory_bytes\": %zu, \"mb_per_s\": %.2f, "
+                           "\"matching_lines\": %zu, \"cycles_per_byte\": %s, "
+                           "\"instructions_per_byte\": %s, "
+                           "\"branch_misses_per_kb\": %s, "
+                           "\"l1d_misses_per_kb\": %s, "
+                           "\"llc_misses_per_kb\": %s}",
+                           first ? "" : ",\n", patterns[p].name,
+                           corpora[c].name, engines[e].name, result.path,
+                           result.compile_us, result.states, result.memory,
+                           result.mb_per_s, result.nr_matching, cycles,
+                           instructions, branch_misses, l1d_misses,
+                           llc_misses);
+                } else {
+                    printf("%s,%s,%s,%s,%.2f,%d,%zu,%.2f,%zu,%s,%s,%s,%s,%s\n",
+                           patterns[p].name, corpora[c].name, engines[e].name,
+                           result.path, result.compile_us, result.states,
+                           result.memory, result.mb_per_s, result.nr_matching,
+                           cycles, instructions, branch_misses, l1d_misses,
+                           llc_misses);
+                }
+                fflush(stdout);
+                first = 0;
+            }
+        }
+
+        free(corpus);
+        free(posix_corpus);
+    }
+
+    counters_close(&counters);
+
+    if (json) {
+        printf("\n]\n");
+    }
+
+    size_t length;
+    char* corpus = make_corpus(&corpora[0], corpus_size, &length);
+    failures += !run_scaling(&patterns[2], corpus, length);
+    free(corpus);
+
+    return failures != 0;
+}
@@ -0,0 +1,100 @@
+#include "counters.h"
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/* every counter is opened on its own instead of as a group, so one the cpu
+ * lacks does not take the others down with it */
+static int open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+void counters_open(bench_counters* c) {
+    c->fd[bc_cycles] =
+        open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    c->fd[bc_instructions] =
+        open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    c->fd[bc_branch_misses] =
+        open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    c->fd[bc_l1d_misses] =
+        open_counter(PERF_TYPE_HW_CACHE,
+                     PERF_COUNT_HW_CACHE_L1D |
+                         (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    c->fd[bc_llc_misses] =
+        open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+}
+
+
+void counters_start(bench_counters* c) {
+    for (int i = 0; i < NR_BENCH_COUNTERS; i++) {
+        if (c->fd[i] >= 0) {
+            ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+
+void counters_stop(bench_counters* c, int64_t values[NR_BENCH_COUNTERS]) {
+    for (int i = 0; i < NR_BENCH_COUNTERS; i++) {
+        if (c->fd[i] >= 0) {
+            ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i = 0; i < NR_BENCH_COUNTERS; i++) {
+        uint64_t value;
+        values[i] = -1;
+        if (c->fd[i] >= 0 && read(c->fd[i], &value, sizeof(value)) ==
+                                 sizeof(value)) {
+            values[i] = value;
+        }
+    }
+}
+
+
+void counters_close(bench_counters* c) {
+    for (int i = 0; i < NR_BENCH_COUNTERS; i++) {
+        if (c->fd[i] >= 0) {
+            close(c->fd[i]);
+        }
+        c->fd[i] = -1;
+    }
+}
+
+#else
+
+void counters_open(bench_counters* c) {
+    for (int i = 0; i < NR_BENCH_COUNTERS; i++) {
+        c->fd[i] = -1;
+    }
+}
+
+
+void counters_start(bench_counters* c) {}
+
+
+void counters_stop(bench_counters* c, int64_t values[NR_BENCH_COUNTERS]) {
+    for (int i = 0; i < NR_BENCH_COUNTERS; i++) {
+        values[i] = -1;
+    }
+}
+
+
+void counters_close(bench_counters* c) {}
+
+#endif
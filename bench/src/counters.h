@@ -0,0 +1,32 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+
+
+/* hardware counters read around a measured region; a counter the kernel or
+ * the cpu does not provide (no perf_event_open(), a virtual machine without
+ * pmu, perf_event_paranoid too strict) is reported as -1 */
+typedef enum {
+    bc_cycles,
+    bc_instructions,
+    bc_branch_misses,
+    bc_l1d_misses,
+    bc_llc_misses,
+    NR_BENCH_COUNTERS
+} bench_counter;
+
+typedef struct {
+    int fd[NR_BENCH_COUNTERS];
+} bench_counters;
+
+
+/* opens every counter of the calling thread, user space only */
+void counters_open(bench_counters* c);
+/* resets and enables the counters */
+void counters_start(bench_counters* c);
+/* disables the counters and reads them into values */
+void counters_stop(bench_counters* c, int64_t values[NR_BENCH_COUNTERS]);
+void counters_close(bench_counters* c);
+
+#endif
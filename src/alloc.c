@@ -0,0 +1,104 @@
+#include "alloc.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/* in front of every block, padded so the block keeps the alignment of
+ * malloc() */
+typedef union {
+    size_t size;
+    max_align_t alignment;
+} block_header;
+
+
+/* every thread compiles on its own, so the counters are per thread */
+static _Thread_local alloc_stats* tracked = NULL;
+
+
+/* PRIVATE FUNCTIONS */
+
+
+static void* block_of(block_header* header, size_t size);
+static void count_allocated(size_t size);
+static void count_freed(size_t size);
+
+
+void alloc_track(alloc_stats* a) {
+    tracked = a;
+}
+
+
+void* counted_malloc(size_t size) {
+    if (size > SIZE_MAX - sizeof(block_header)) {
+        return NULL;
+    }
+    return block_of(malloc(sizeof(block_header) + size), size);
+}
+
+
+void* counted_calloc(size_t n, size_t size) {
+    if (size > 0 && n > (SIZE_MAX - sizeof(block_header)) / size) {
+        return NULL;
+    }
+    return block_of(calloc(1, sizeof(block_header) + n * size), n * size);
+}
+
+
+void* counted_realloc(void* p, size_t size) {
+    if (p == NULL) {
+        return counted_malloc(size);
+    }
+    if (size > SIZE_MAX - sizeof(block_header)) {
+        return NULL;
+    }
+    block_header* header = (block_header*)p - 1;
+    size_t old_size = header->size;
+    /* a failed realloc keeps the old block */
+    header = realloc(header, sizeof(block_header) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    count_freed(old_size);
+    return block_of(header, size);
+}
+
+
+void counted_free(void* p) {
+    if (p == NULL) {
+        return;
+    }
+    block_header* header = (block_header*)p - 1;
+    count_freed(header->size);
+    free(header);
+}
+
+
+/* the block behind header, which holds size bytes, or NULL if the allocation
+ * failed */
+static void* block_of(block_header* header, size_t size) {
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    count_allocated(size);
+    return header + 1;
+}
+
+
+static void count_allocated(size_t size) {
+    if (tracked == NULL) {
+        return;
+    }
+    tracked->nr_allocations++;
+    tracked->live += size;
+    if (tracked->live > tracked->peak) {
+        tracked->peak = tracked->live;
+    }
+}
+
+
+static void count_freed(size_t size) {
+    if (tracked != NULL) {
+        tracked->live -= size;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+
+/* Allocation accounting for regex_compile_stats. The compiler modules
+ * allocate through these functions instead of malloc() and friends: they
+ * keep the size of every block in a header in front of it, count the
+ * allocations and bytes of the calling thread while a compile with
+ * statistics runs and cost a single check otherwise. A block they return has
+ * to be resized and freed by them as well, never by realloc() or free(). */
+
+
+typedef struct {
+    size_t nr_allocations;
+    long long live; /* bytes allocated minus bytes freed since tracking began */
+    long long peak; /* the largest value of live */
+} alloc_stats;
+
+
+/* counts the allocations of the calling thread in a from now on; NULL stops */
+void alloc_track(alloc_stats* a);
+
+void* counted_malloc(size_t size);
+void* counted_calloc(size_t n, size_t size);
+void* counted_realloc(void* p, size_t size);
+void counted_free(void* p);
+
+
+#endif
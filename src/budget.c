@@ -0,0 +1,53 @@
+#include "budget.h"
+#include "helper_functions.h"
+#include <stddef.h>
+
+
+void budget_start(compile_budget* b,
+                  const regex_options* options,
+                  const alloc_stats* allocations) {
+    *b = (compile_budget){0};
+    b->allocations = allocations;
+    b->error = re_none;
+    if (options == NULL) {
+        return;
+    }
+    b->max_nfa_states = options->max_nfa_states;
+    b->max_memory = options->max_memory;
+    if (options->timeout > 0) {
+        deadline_in(&b->deadline, options->timeout);
+        b->has_deadline = 1;
+    }
+}
+
+
+int budget_check(compile_budget* b) {
+    if (b == NULL || b->error != re_none) {
+        return b == NULL;
+    }
+    if (b->max_memory > 0 && b->allocations->live > b->max_memory) {
+        b->error = re_memory;
+    } else if (b->has_deadline &&
+               ++b->nr_checks % BUDGET_CLOCK_INTERVAL == 1 &&
+               deadline_passed(&b->deadline)) {
+        b->error = re_timeout;
+    }
+    return b->error == re_none;
+}
+
+
+int budget_nfa_states(compile_budget* b, long long nr_states) {
+    if (b != NULL && b->error == re_none && b->max_nfa_states > 0 &&
+        nr_states > b->max_nfa_states) {
+        b->error = re_nfa_states;
+    }
+    return budget_check(b);
+}
+
+
+int budget_allocated(compile_budget* b, int allocated) {
+    if (b != NULL && b->error == re_none && !allocated) {
+        b->error = re_memory;
+    }
+    return allocated && budget_check(b);
+}
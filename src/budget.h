@@ -0,0 +1,48 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "alloc.h"
+#include "regex.h"
+#include <time.h>
+
+
+/* The limits of a single compile, taken from regex_options. Every loop whose
+ * length depends on the pattern rather than on its own input calls
+ * budget_check(), which compares the memory of the compile against its limit
+ * on every call and reads the clock only every BUDGET_CLOCK_INTERVAL calls.
+ * The first exceeded limit is kept in error and fails all later checks, so
+ * the compiler can unwind from wherever it noticed. */
+
+
+#define BUDGET_CLOCK_INTERVAL 256
+
+
+typedef struct {
+    int max_nfa_states;             /* 0 for no limit */
+    long long max_memory;           /* 0 for no limit */
+    const alloc_stats* allocations; /* the tracked allocations of the compile */
+    int has_deadline;
+    struct timespec deadline;
+    unsigned int nr_checks;
+    regex_error error; /* re_none until the compile fails */
+} compile_budget;
+
+
+/* sets b up for a compile with options, which may be NULL; allocations has to
+ * be tracked if there is a memory limit */
+void budget_start(compile_budget* b,
+                  const regex_options* options,
+                  const alloc_stats* allocations);
+
+/* returns 1 while no limit of b is exceeded, b may be NULL */
+int budget_check(compile_budget* b);
+
+/* returns 1 if an nfa of nr_states states is within the limit of b, fails b
+ * otherwise */
+int budget_nfa_states(compile_budget* b, long long nr_states);
+
+/* returns 1 if allocated is true and no limit of b is exceeded; a failed
+ * allocation fails b with re_memory */
+int budget_allocated(compile_budget* b, int allocated);
+
+#endif
@@ -0,0 +1,619 @@
+#include "alloc.h"
+#include "regex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The dfa finds where a match starts and ends, but not which path through the
+ * nfa led there. With REGEX_CAPTURE the group tags travel through the epsilon
+ * removal onto the transitions of the epsilon free nfa, which is kept next to
+ * the dfa. Captures are extracted by running that nfa over the matched span
+ * only: all paths are advanced in lockstep, one thread per nfa state, ordered
+ * by the priority of the transitions that created them. Every thread carries
+ * the positions of its tags, so one pass over the span is enough and nothing
+ * is ever backtracked. Where no state has two transitions on the same symbol,
+ * as for ^([A-Z]+) ([0-9]+)$, there is only ever one thread, which follows
+ * its path without any thread lists. */
+
+
+#define NO_POSITION ((size_t)-1)
+
+
+/* a list of threads, at most one per nfa state */
+typedef struct {
+    int* states;
+    size_t* tags; /* nr_tags positions per thread */
+    int size;
+} thread_list;
+
+
+// TAGGED NFA
+
+
+/* the transitions of every state on one symbol, as a flat array of
+ * (number of transitions, next_state, pre_tags, post_tags, ...) per state;
+ * symbols with identical signatures share a class */
+static int* symbol_signature(regex* r, int symbol, int* length) {
+    /* counted first, so the signature is allocated only once */
+    *length = r->nr_states;
+    for (int i = 0; i < r->nr_states; i++) {
+        for (int j = 0; j < r->states[i]->nr_transitions; j++) {
+            transition* t = r->states[i]->transitions[j];
+            if (t->status == ts_active && t->lo <= symbol && symbol <= t->hi) {
+                *length += 3;
+            }
+        }
+    }
+
+    int* signature = counted_malloc(*length * sizeof(int));
+    *length = 0;
+    for (int i = 0; i < r->nr_states; i++) {
+        int count_pos = (*length)++;
+        signature[count_pos] = 0;
+        for (int j = 0; j < r->states[i]->nr_transitions; j++) {
+            transition* t = r->states[i]->transitions[j];
+            if (t->status != ts_active || symbol < t->lo || t->hi < symbol) {
+                continue;
+            }
+            signature[(*length)++] = t->next_state;
+            signature[(*length)++] = t->pre_tags;
+            signature[(*length)++] = t->post_tags;
+            signature[count_pos]++;
+        }
+    }
+
+    return signature;
+}
+
+
+tagged_nfa* new_tagged_nfa(regex* r) {
+    int* signatures[NR_SYMBOLS];
+    int signature_lengths[NR_SYMBOLS];
+    int class_symbol[NR_SYMBOLS + 1]; /* a representative of every class */
+    int nr_transitions = 0;
+
+    tagged_nfa* t = counted_malloc(sizeof(tagged_nfa));
+    t->nr_states = r->nr_states;
+
+    /* class 0 holds every symbol without any transition */
+    t->nr_classes = 1;
+    class_symbol[0] = -1;
+    for (int c = 0; c < NR_SYMBOLS; c++) {
+        signatures[c] = symbol_signature(r, c, &signature_lengths[c]);
+
+        int empty = 1;
+        for (int i = 0; i < signature_lengths[c]; i++) {
+            empty = empty && !signatures[c][i];
+        }
+        if (empty) {
+            t->symbol_class[c] = 0;
+            continue;
+        }
+
+        int class_nr = 1;
+        while (class_nr < t->nr_classes &&
+               (signature_lengths[class_symbol[class_nr]] !=
+                    signature_lengths[c] ||
+                memcmp(signatures[class_symbol[class_nr]], signatures[c],
+                       signature_lengths[c] * sizeof(int)))) {
+            class_nr++;
+        }
+        if (class_nr == t->nr_classes) {
+            class_symbol[t->nr_classes++] = c;
+            nr_transitions += (signature_lengths[c] - r->nr_states) / 3;
+        }
+        t->symbol_class[c] = class_nr;
+    }
+
+    /* copy the transitions of every state and class in priority order */
+    t->offsets =
+        counted_malloc((t->nr_states * t->nr_classes + 1) * sizeof(int));
+    t->transitions = counted_malloc(nr_transitions * sizeof(tagged_transition));
+    int nr_written = 0;
+    for (int i = 0; i < t->nr_states; i++) {
+        t->offsets[i * t->nr_classes] = nr_written;
+        for (int class_nr = 1; class_nr < t->nr_classes; class_nr++) {
+            t->offsets[i * t->nr_classes + class_nr] = nr_written;
+            int symbol = class_symbol[class_nr];
+            for (int j = 0; j < r->states[i]->nr_transitions; j++) {
+                transition* tr = r->states[i]->transitions[j];
+                if (tr->status == ts_active && tr->lo <= symbol &&
+                    symbol <= tr->hi) {
+                    t->transitions[nr_written].next_state = tr->next_state;
+                    t->transitions[nr_written].pre_tags = tr->pre_tags;
+                    t->transitions[nr_written].post_tags = tr->post_tags;
+                    nr_written++;
+                }
+            }
+        }
+    }
+    t->offsets[t->nr_states * t->nr_classes] = nr_written;
+    t->one_pass = NULL;
+
+    t->state_flags = counted_malloc(t->nr_states);
+    for (int i = 0; i < t->nr_states; i++) {
+        t->state_flags[i] = 0;
+        if (r->states[i]->type == st_end ||
+            r->states[i]->type == st_start_end) {
+            t->state_flags[i] |= sf_end;
+        }
+        if (r->states[i]->behaviour == sb_greedy) {
+            t->state_flags[i] |= sf_greedy;
+        }
+    }
+
+    for (int c = 0; c < NR_SYMBOLS; c++) {
+        counted_free(signatures[c]);
+    }
+
+    return t;
+}
+
+
+static void delete_one_pass_dfa(one_pass_dfa** d) {
+    if ((*d) == NULL) {
+        return;
+    }
+    counted_free((*d)->next);
+    counted_free((*d)->pre_tags);
+    counted_free((*d)->post_tags);
+    counted_free((*d)->is_end);
+    counted_free((*d)->end_pre_tags);
+    counted_free((*d)->end_post_tags);
+    counted_free(*d);
+    *d = NULL;
+}
+
+
+void delete_tagged_nfa(tagged_nfa** t) {
+    if ((*t) == NULL) {
+        return;
+    }
+    counted_free((*t)->offsets);
+    counted_free((*t)->transitions);
+    counted_free((*t)->state_flags);
+    delete_one_pass_dfa(&(*t)->one_pass);
+    counted_free(*t);
+    *t = NULL;
+}
+
+
+
+// ONE PASS DFA
+
+
+/* Most patterns that are worth extracting from, like ^([A-Z]+) ([0-9]+)$,
+ * never really have a choice: of all threads in a list, only one continues
+ * with the next symbol, the others die or reach the same states later. Then
+ * the lists themselves form a dfa, whose every step continues a single thread
+ * and so only has to commit the tags that thread was created with; the
+ * extraction runs it with one set of tags instead of the thread lists. */
+
+
+#define ONE_PASS_MAX_STATES 256
+#define ONE_PASS_BUCKETS 512 /* a power of 2 */
+
+
+/* the thread lists found so far, as (state, pre_tags, post_tags) per thread,
+ * and the buckets to find them by their hash in */
+typedef struct {
+    unsigned int* threads;
+    size_t nr_threads;
+    size_t capacity;
+    size_t first[ONE_PASS_MAX_STATES + 1];
+    unsigned int hashes[ONE_PASS_MAX_STATES];
+    int chain[ONE_PASS_MAX_STATES];
+    int heads[ONE_PASS_BUCKETS];
+    int nr_lists;
+} thread_lists;
+
+
+/* the number of the list of nr_threads threads, which is added if it is new;
+ * -1 if there are ONE_PASS_MAX_STATES lists already */
+static int find_thread_list(thread_lists* l,
+                            const unsigned int* threads,
+                            size_t nr_threads) {
+    size_t size = 3 * nr_threads;
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ threads[i]) * 16777619u;
+    }
+
+    int bucket = hash & (ONE_PASS_BUCKETS - 1);
+    for (int j = l->heads[bucket]; j >= 0; j = l->chain[j]) {
+        if (l->hashes[j] == hash && l->first[j + 1] - l->first[j] == size &&
+            !memcmp(l->threads + l->first[j], threads,
+                    size * sizeof(unsigned int))) {
+            return j;
+        }
+    }
+    if (l->nr_lists == ONE_PASS_MAX_STATES) {
+        return -1;
+    }
+
+    if (l->nr_threads + size > l->capacity) {
+        l->capacity = 2 * (l->nr_threads + size);
+        l->threads =
+            counted_realloc(l->threads, l->capacity * sizeof(unsigned int));
+    }
+    memcpy(l->threads + l->nr_threads, threads, size * sizeof(unsigned int));
+    l->nr_threads += size;
+    l->first[l->nr_lists + 1] = l->nr_threads;
+    l->hashes[l->nr_lists] = hash;
+    l->chain[l->nr_lists] = l->heads[bucket];
+    l->heads[bucket] = l->nr_lists;
+    return l->nr_lists++;
+}
+
+
+one_pass_dfa* new_one_pass_dfa(const tagged_nfa* t) {
+    int nr_classes = t->nr_classes;
+    size_t nr_entries = (size_t)ONE_PASS_MAX_STATES * nr_classes;
+    thread_lists l = {.nr_lists = 0};
+    size_t* added = counted_calloc(t->nr_states, sizeof(size_t));
+    size_t generation = 0;
+    unsigned int* next = counted_malloc(3 * t->nr_states * sizeof(unsigned int));
+    int one_pass = 1;
+
+    one_pass_dfa* d = counted_malloc(sizeof(one_pass_dfa));
+    d->next = counted_malloc(nr_entries * sizeof(int));
+    d->pre_tags = counted_malloc(nr_entries * sizeof(unsigned int));
+    d->post_tags = counted_malloc(nr_entries * sizeof(unsigned int));
+    d->is_end = counted_malloc(ONE_PASS_MAX_STATES);
+    d->end_pre_tags =
+        counted_malloc(ONE_PASS_MAX_STATES * sizeof(unsigned int));
+    d->end_post_tags =
+        counted_malloc(ONE_PASS_MAX_STATES * sizeof(unsigned int));
+
+    /* a single thread in the start state, just like the extraction starts */
+    memset(l.heads, -1, sizeof(l.heads));
+    l.first[0] = 0;
+    unsigned int start[3] = {0, 0, 0};
+    find_thread_list(&l, start, 1);
+
+    for (int i = 0; one_pass && i < l.nr_lists; i++) {
+        int nr_threads = (l.first[i + 1] - l.first[i]) / 3;
+
+        /* step_threads() on every class, as long as the next list only
+         * holds threads created by one thread of this list */
+        for (int c = 0; one_pass && c < nr_classes; c++) {
+            int entry = i * nr_classes + c;
+            int parent = -1;
+            size_t nr_next = 0;
+            generation++;
+            for (int k = 0; one_pass && k < nr_threads; k++) {
+                int offset = l.threads[l.first[i] + 3 * k] * nr_classes + c;
+                for (int j = t->offsets[offset]; j < t->offsets[offset + 1];
+                     j++) {
+                    const tagged_transition* tr = &t->transitions[j];
+                    if (added[tr->next_state] == generation) {
+                        continue;
+                    }
+                    if (parent >= 0 && parent != k) {
+                        one_pass = 0;
+                        break;
+                    }
+                    added[tr->next_state] = generation;
+                    parent = k;
+                    next[3 * nr_next] = tr->next_state;
+                    next[3 * nr_next + 1] = tr->pre_tags;
+                    next[3 * nr_next + 2] = tr->post_tags;
+                    nr_next++;
+                }
+            }
+
+            d->next[entry] = -1;
+            d->pre_tags[entry] = d->post_tags[entry] = 0;
+            if (one_pass && nr_next) {
+                d->next[entry] = find_thread_list(&l, next, nr_next);
+                one_pass = d->next[entry] >= 0;
+                d->pre_tags[entry] = l.threads[l.first[i] + 3 * parent + 1];
+                d->post_tags[entry] = l.threads[l.first[i] + 3 * parent + 2];
+            }
+        }
+
+        /* find_end_thread() */
+        d->is_end[i] = 0;
+        for (int k = 0; k < nr_threads; k++) {
+            const unsigned int* thread = l.threads + l.first[i] + 3 * k;
+            if (t->state_flags[thread[0]] & sf_end) {
+                d->is_end[i] = 1;
+                d->end_pre_tags[i] = thread[1];
+                d->end_post_tags[i] = thread[2];
+                break;
+            }
+        }
+    }
+    d->nr_states = l.nr_lists;
+
+    counted_free(l.threads);
+    counted_free(next);
+    counted_free(added);
+
+    if (!one_pass) {
+        delete_one_pass_dfa(&d);
+        return NULL;
+    }
+
+    /* keep only the states found */
+    nr_entries = (size_t)d->nr_states * nr_classes;
+    d->next = counted_realloc(d->next, nr_entries * sizeof(int));
+    d->pre_tags =
+        counted_realloc(d->pre_tags, nr_entries * sizeof(unsigned int));
+    d->post_tags =
+        counted_realloc(d->post_tags, nr_entries * sizeof(unsigned int));
+    return d;
+}
+
+// EXTRACTION
+
+
+/* adds a thread in state to l unless there already is one, which then has the
+ * higher priority; tags are copied from the creating thread and updated with
+ * the tags of the transition */
+static inline void add_thread(regex_scratch* s,
+                              thread_list* l,
+                              int nr_tags,
+                              int state,
+                              const size_t* tags,
+                              const tagged_transition* t,
+                              size_t pre_position,
+                              size_t post_position) {
+    if (s->added[state] == s->generation) {
+        return;
+    }
+    s->added[state] = s->generation;
+
+    size_t* new_tags = l->tags + l->size * nr_tags;
+    for (int i = 0; i < nr_tags; i++) {
+        if (t->post_tags & (1u << i)) {
+            new_tags[i] = post_position;
+        } else if (t->pre_tags & (1u << i)) {
+            new_tags[i] = pre_position;
+        } else {
+            new_tags[i] = tags[i];
+        }
+    }
+    l->states[l->size++] = state;
+}
+
+
+/* advances every thread of current by symbol into next; symbols of the input
+ * span the positions pos to pos + 1, LINE_START and LINE_END none */
+static void step_threads(const tagged_nfa* nfa,
+                         regex_scratch* s,
+                         int nr_tags,
+                         const thread_list* current,
+                         thread_list* next,
+                         int symbol,
+                         size_t pos,
+                         size_t width) {
+    int class_nr = nfa->symbol_class[symbol];
+
+    s->generation++;
+    next->size = 0;
+    for (int i = 0; i < current->size; i++) {
+        int offset = current->states[i] * nfa->nr_classes + class_nr;
+        for (int j = nfa->offsets[offset]; j < nfa->offsets[offset + 1]; j++) {
+            add_thread(s, next, nr_tags, nfa->transitions[j].next_state,
+                       current->tags + i * nr_tags, &nfa->transitions[j], pos,
+                       pos + width);
+        }
+    }
+}
+
+
+/* commits the tags of a transition that read the symbol spanning the
+ * positions pos to pos + width */
+static inline void commit_tags(size_t* tags,
+                               unsigned int pre_tags,
+                               unsigned int post_tags,
+                               size_t pos,
+                               size_t width) {
+    for (unsigned int bits = pre_tags | post_tags; bits; bits &= bits - 1) {
+        int i = __builtin_ctz(bits);
+        tags[i] = (post_tags & (1u << i)) ? pos + width : pos;
+    }
+}
+
+
+/* the single thread of a one pass dfa: its state, the tags committed so far
+ * and the symbol it read last, whose tags are committed by the next step */
+typedef struct {
+    int state;
+    size_t* tags;
+    size_t last_pos;
+    size_t last_width;
+} one_pass_thread;
+
+
+/* moves t on by symbol, which spans the positions pos to pos + width; returns
+ * 0 if the dfa has no transition */
+static inline int one_pass_step(const tagged_nfa* nfa,
+                                const one_pass_dfa* d,
+                                one_pass_thread* t,
+                                int symbol,
+                                size_t pos,
+                                size_t width) {
+    int entry = t->state * nfa->nr_classes + nfa->symbol_class[symbol];
+    if (d->next[entry] < 0) {
+        return 0;
+    }
+    commit_tags(t->tags, d->pre_tags[entry], d->post_tags[entry], t->last_pos,
+                t->last_width);
+    t->state = d->next[entry];
+    t->last_pos = pos;
+    t->last_width = width;
+    return 1;
+}
+
+
+/* the tags of the end thread the thread lists would find, run through the one
+ * pass dfa d instead; returns 0 if there is none */
+static int one_pass_tags(const tagged_nfa* nfa,
+                         const one_pass_dfa* d,
+                         int nr_tags,
+                         const char* input,
+                         size_t location,
+                         size_t end,
+                         int at_line_start,
+                         int at_line_end,
+                         size_t* tags) {
+    one_pass_thread t = {0, tags, location, 0};
+
+    for (int i = 0; i < nr_tags; i++) {
+        tags[i] = NO_POSITION;
+    }
+    if (at_line_start && !one_pass_step(nfa, d, &t, LINE_START, location, 0)) {
+        return 0;
+    }
+    for (size_t pos = location; pos < end; pos++) {
+        if (!one_pass_step(nfa, d, &t, (unsigned char)input[pos], pos, 1)) {
+            return 0;
+        }
+    }
+    if (!d->is_end[t.state] && at_line_end &&
+        !one_pass_step(nfa, d, &t, LINE_END, end, 0)) {
+        return 0;
+    }
+    if (!d->is_end[t.state]) {
+        return 0;
+    }
+
+    commit_tags(tags, d->end_pre_tags[t.state], d->end_post_tags[t.state],
+                t.last_pos, t.last_width);
+    return 1;
+}
+
+
+/* returns the index of the thread with the highest priority that is in an
+ * end state, -1 if there is none */
+static int find_end_thread(const tagged_nfa* nfa, const thread_list* l) {
+    for (int i = 0; i < l->size; i++) {
+        if (nfa->state_flags[l->states[i]] & sf_end) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/* the tags of the thread with the highest priority that ends in an end state
+ * after all paths of the nfa were run over the span from location to end in
+ * lockstep; NULL if there is none */
+static const size_t* thread_tags(const tagged_nfa* nfa,
+                                 regex_scratch* s,
+                                 int nr_tags,
+                                 const char* input,
+                                 size_t location,
+                                 size_t end,
+                                 int at_line_start,
+                                 int at_line_end) {
+    thread_list lists[2] = {
+        {s->threads, s->thread_tags, 0},
+        {s->threads + nfa->nr_states,
+         s->thread_tags + (size_t)nfa->nr_states * nr_tags, 0}};
+    thread_list* current = &lists[0];
+    thread_list* next = &lists[1];
+    thread_list* temp;
+
+    /* a single thread in the start state, just like the matcher starts */
+    tagged_transition start = {0, 0, 0};
+    size_t no_tags[2 * REGEX_MAX_GROUPS];
+    for (int i = 0; i < nr_tags; i++) {
+        no_tags[i] = NO_POSITION;
+    }
+    s->generation++;
+    current->size = 0;
+    add_thread(s, current, nr_tags, 0, no_tags, &start, 0, 0);
+
+    if (at_line_start) {
+        step_threads(nfa, s, nr_tags, current, next, LINE_START, location, 0);
+        temp = current, current = next, next = temp;
+    }
+    for (size_t pos = location; pos < end; pos++) {
+        step_threads(nfa, s, nr_tags, current, next,
+                     (unsigned char)input[pos], pos, 1);
+        temp = current, current = next, next = temp;
+    }
+
+    int found = find_end_thread(nfa, current);
+    if (found < 0 && at_line_end) {
+        step_threads(nfa, s, nr_tags, current, next, LINE_END, end, 0);
+        temp = current, current = next, next = temp;
+        found = find_end_thread(nfa, current);
+    }
+
+    return found < 0 ? NULL : current->tags + found * nr_tags;
+}
+
+
+int regex_match_captures(const regex* r,
+                         regex_scratch* s,
+                         const char* input,
+                         size_t input_length,
+                         regex_capture* captures,
+                         int nr_captures) {
+    const tagged_nfa* nfa = r->tagged;
+    int nr_tags = 2 * r->nr_groups;
+    size_t location, length;
+
+    if (nfa == NULL) {
+        ERROR("regex was not compiled with REGEX_CAPTURE\n");
+        return 0;
+    }
+    if (s == NULL || s->r != r || s->threads == NULL) {
+        ERROR("scratch does not belong to this regex\n");
+        return 0;
+    }
+
+    for (int i = 0; i < nr_captures; i++) {
+        captures[i].success = 0;
+    }
+    if (!regex_match_first_n(r, s, input, input_length, &location, &length)) {
+        return 0;
+    }
+    if (nr_captures > 0) {
+        captures[0].success = 1;
+        captures[0].location = location;
+        captures[0].length = length;
+    }
+
+    /* the matched span is bounded by the line it lies in */
+    size_t end = location + length;
+    int multiline = r->flags & REGEX_MULTILINE;
+    int at_line_start =
+        location == 0 || (multiline && input[location - 1] == '\n');
+    int at_line_end =
+        end == input_length || (multiline && input[end] == '\n');
+
+    /* without tags, the match is the empty one the matcher reports at the
+     * start of a line that does not end there */
+    size_t one_pass[2 * REGEX_MAX_GROUPS];
+    const size_t* tags = one_pass;
+    if (nfa->one_pass == NULL) {
+        tags = thread_tags(nfa, s, nr_tags, input, location, end,
+                           at_line_start, at_line_end);
+    } else if (!one_pass_tags(nfa, nfa->one_pass, nr_tags, input, location,
+                              end, at_line_start, at_line_end, one_pass)) {
+        tags = NULL;
+    }
+    if (tags == NULL) {
+        return 1;
+    }
+
+    for (int group = 0; group < r->nr_groups && group + 1 < nr_captures;
+         group++) {
+        size_t group_start = tags[2 * group];
+        size_t group_end = tags[2 * group + 1];
+        if (group_start != NO_POSITION && group_end != NO_POSITION &&
+            group_start <= group_end) {
+            captures[group + 1].success = 1;
+            captures[group + 1].location = group_start;
+            captures[group + 1].length = group_end - group_start;
+        }
+    }
+
+    return 1;
+}
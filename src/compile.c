@@ -1,756 +1,917 @@
+#include "alloc.h"
+#include "budget.h"
 #include "helper_functions.h"
+#include "parse.h"
 #include "regex.h"
 #include "stack.h"
 #include "vector.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-
-/* CONSTANTS */
-
-const char* REGULAR_SYMBOLS = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUV"
-                              "WXYZ0123456789\"\'#/&=@!%_: \t<>";
-const char* ESCAPED_SYMBOLS = "-^$()[]{}\\*+?.|";
-const char* ALL_SYMBOLS = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUV<>"
-                          "WXYZ0123456789\"\'#/&=@!%_: \t-^$()[]{}\\*+?.|";
+#include <time.h>
+
+
+/* the most dfa states built for a pattern that would use the position
+ * automaton but has a loop state; beyond that it keeps the automaton */
+#define LOOP_MAX_STATES 256
+
+
+/* PRIVATE TYPES */
+
+
+/* the words first_word to first_word + nr_words - 1 of a bitset of all
+ * states, stored at offset in a shared array */
+typedef struct {
+    int first_word;
+    int nr_words;
+    size_t offset;
+} closure_window;
+
+/* a bitset of all states that keeps the range of words that may be set, so
+ * clearing and iterating it stays cheap for large automata */
+typedef struct {
+    uint64_t* words;
+    int lo;
+    int hi;
+} state_bits;
+
+/* with capture groups: the tags collected on the way from source to the
+ * states of its epsilon closure; tags[p] is valid if stamp[p] is generation */
+typedef struct {
+    int source;
+    size_t generation;
+    size_t* stamp;
+    unsigned int* tags;
+    int* pending;
+} closure_tags;
+
+/* finds the state sets of a subset construction by their hash: heads holds
+ * the first set of every bucket, chain the next set of the same bucket, -1
+ * ends both */
+typedef struct {
+    int* heads;
+    int* chain;
+    unsigned int* hashes;
+    int nr_buckets;
+    int nr_sets;
+} state_set_index;
 
 
 /* PRIVATE FUNCTIONS */
 
 
-static int string_to_regex(regex** r, char* input);
-static int remove_epsilon_transitions(regex* r);
-static int nfa_to_dfa(regex* r);
-
-/* a = a - b */
-static void string_subtract(vector* a, vector* b);
+static int string_to_regex(regex** r,
+                           char* input,
+                           int capture,
+                           int fold_case,
+                           compile_budget* budget);
+static int string_to_glushkov(regex** r,
+                              char* input,
+                              int fold_case,
+                              compile_budget* budget,
+                              regex_compile_stats* stats);
+static int remove_epsilon_transitions(regex* r, compile_budget* budget);
+static int new_closure_tags(closure_tags* c, int nr_states);
+static void delete_closure_tags(closure_tags* c);
+static const unsigned int*
+epsilon_closure_tags(regex* r, closure_tags* c, int source);
+static int epsilon_components(regex* r, int* component);
+static uint64_t* epsilon_closures(regex* r,
+                                  const int* component,
+                                  int nr_components,
+                                  closure_window* windows);
+static void state_bits_add(state_bits* s,
+                           const uint64_t* closure,
+                           const closure_window* window);
+static void state_bits_clear(state_bits* s);
+static int nfa_to_dfa(regex* r, int max_states, compile_budget* budget);
+static int build_table(regex* r);
+static int start_state_reads(regex* r, int symbol);
+static int is_anchored(regex* r);
+static regex_start_bytes* new_start_bytes(regex* r);
+static int is_end_anchored(regex* r);
+static regex*
+build_reverse(regex* r, int max_states, compile_budget* budget);
+static void collect_predecessors(regex* r,
+                                 const char* member,
+                                 int line_start,
+                                 const int* intervals,
+                                 int nr_intervals,
+                                 const int* interval_of,
+                                 int* next_states,
+                                 int* nr_next_states);
+static void new_state_set_index(state_set_index* index);
+static void delete_state_set_index(state_set_index* index);
+static unsigned int hash_state_set(const int* set, int nr_set);
+static int find_state_set(const state_set_index* index,
+                          vector* state_sets,
+                          const int* set,
+                          int nr_set,
+                          unsigned int hash);
+static void add_state_set(state_set_index* index, unsigned int hash);
+static int reverse_is_exact(regex* r);
+static int symbol_intervals(regex* r, int** intervals);
+static void phase_begin(regex_compile_stats* stats,
+                        regex_phase phase,
+                        int input_phase,
+                        struct timespec* start);
+static void phase_end(regex_compile_stats* stats,
+                      regex_phase phase,
+                      const regex* r,
+                      const regex* reverse,
+                      const struct timespec* start);
 
 
 /* main function called from outside */
 int regex_compile(regex** r, char* input) {
+    return regex_compile_ex(r, input, NULL);
+}
+
+
+int regex_compile_ex(regex** r, char* input, const regex_options* options) {
     int success;
+    int flags = options ? options->flags : 0;
+    int max_states = (options && options->max_states)
+                         ? options->max_states
+                         : REGEX_DEFAULT_MAX_STATES;
+    regex_compile_stats* stats = options ? options->stats : NULL;
+    alloc_stats allocations = {0};
+    compile_budget budget;
+    struct timespec start;
     delete_regex(r);
 
-    success = string_to_regex(r, input);
-
-    if (success) {
-        success = remove_epsilon_transitions(*r);
+    /* max_dfa_states below max_states takes its place, but fails the compile
+     * where max_states falls back to the nfa */
+    int dfa_limited = options && options->max_dfa_states > 0 &&
+                      (max_states < 0 || options->max_dfa_states < max_states);
+    if (dfa_limited) {
+        max_states = options->max_dfa_states;
     }
 
-    if (success) {
-        success = nfa_to_dfa(*r);
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(regex_compile_stats));
     }
-
-    if (!success) {
-        delete_regex(r);
+    if (stats != NULL || (options && options->max_memory)) {
+        alloc_track(&allocations);
     }
+    budget_start(&budget, options, &allocations);
 
-    return success;
-}
-
-
-static int string_to_regex(regex** r, char* input) {
-    int level = 0;
-    int success = 1;
-
-    regex* current_regex = NULL;
-
-    int pos = 0;
-
-    vector* alternative_on_level = new_vector(sizeof(int), NULL);
-    vector_push(alternative_on_level, &level);
+    phase_begin(stats, rp_parse, -1, &start);
+    success =
+        string_to_glushkov(r, input, flags & REGEX_ICASE, &budget, stats);
+    phase_end(stats, rp_parse, *r, NULL, &start);
 
-    /* initialize the regex objects vector with an optional start of line */
-    vector* regex_objects = new_vector(sizeof(vector*), NULL);
-    {
-        vector* temp_vector = new_vector(sizeof(regex*), NULL);
-        regex* temp_regex = new_single_transition_regex(LINE_START);
-        regex_optional(temp_regex);
-        vector_push(temp_vector, &temp_regex);
-        vector_push(regex_objects, &temp_vector);
-    }
-
-    while (success && input[pos] != 0) {
-        current_regex = NULL;
-        if (contains(input[pos], REGULAR_SYMBOLS, strlen(REGULAR_SYMBOLS)) ||
-            contains(input[pos], "[.)\\", 4)) {
-
-            switch (input[pos]) {
-            /* escaped character */
-            case '\\':
-                if (!contains(input[pos + 1], ESCAPED_SYMBOLS,
-                              strlen(ESCAPED_SYMBOLS))) {
-                    success = 0;
-                } else {
-                    current_regex = new_single_transition_regex(input[++pos]);
-                }
-                break;
-
-            /* closed block */
-            case ')': {
-                int open_alternative;
-                vector_pop(alternative_on_level, &open_alternative);
-                if (open_alternative) {
-                    success = 0;
-                    break;
-                }
+    if (success) {
+        (*r)->flags = flags;
+        (*r)->line_end = is_end_anchored(*r);
+    }
 
-                vector* block_regex_objects = NULL;
-                vector_pop(regex_objects, &block_regex_objects);
-                if (!block_regex_objects->size) {
-                    success = 0;
-                    vector_push(regex_objects, &block_regex_objects);
-                    break;
-                }
+    /* the tags ride on the epsilon transitions, so the tagged nfa is built
+     * from a second parse into an nfa with epsilon transitions; the group
+     * wrappers change how the behaviours of the nfa states combine in the
+     * dfa, but both accept the same language */
+    if (success && (flags & REGEX_CAPTURE)) {
+        regex* tagged = NULL;
+        phase_begin(stats, rp_capture, -1, &start);
+        success = string_to_regex(&tagged, input, 1, flags & REGEX_ICASE,
+                                  &budget) &&
+                  remove_epsilon_transitions(tagged, &budget);
+        if (success) {
+            (*r)->nr_groups = tagged->nr_groups;
+            (*r)->tagged = new_tagged_nfa(tagged);
+            (*r)->tagged->one_pass = new_one_pass_dfa((*r)->tagged);
+        }
+        delete_regex(&tagged);
+        phase_end(stats, rp_capture, *r, NULL, &start);
+    }
 
-                /* chain all elements inside the block together */
-                vector_reset_iterator(block_regex_objects);
-                if (vector_next(block_regex_objects, &current_regex)) {
-                    regex* buffer_regex = NULL;
-                    while (vector_next(block_regex_objects, &buffer_regex)) {
-                        regex_chain(current_regex, &buffer_regex);
-                    }
-                }
-                delete_vector(&block_regex_objects);
+    /* small patterns skip the subset construction, patterns whose dfa would
+     * be too large keep the nfa for matching */
+    if (success && !(flags & REGEX_DFA)) {
+        phase_begin(stats, rp_positions, rp_parse, &start);
+        (*r)->positions = new_position_nfa(*r);
+        phase_end(stats, rp_positions, *r, NULL, &start);
+    }
+    /* but the position automaton steps through every byte, while an sf_loop
+     * state of the dfa, like the one of [^"]*, skips to the next byte that
+     * leaves it with a single search; a small dfa replaces it for these */
+    if (success && (*r)->positions != NULL &&
+        position_nfa_has_loop((*r)->positions)) {
+        int loop_max_states = (max_states >= 0 && max_states < LOOP_MAX_STATES)
+                                  ? max_states
+                                  : LOOP_MAX_STATES;
+        phase_begin(stats, rp_dfa, rp_parse, &start);
+        if (nfa_to_dfa(*r, loop_max_states, &budget)) {
+            delete_position_nfa(&(*r)->positions);
+        }
+        phase_end(stats, rp_dfa, *r, NULL, &start);
+        success = budget.error == re_none;
 
-                level--;
-                break;
-            }
+        if (success && (*r)->positions == NULL) {
+            phase_begin(stats, rp_table, rp_dfa, &start);
+            success = build_table(*r);
+            phase_end(stats, rp_table, *r, NULL, &start);
+        }
+    }
+    if (success && (*r)->positions == NULL && (*r)->table == NULL) {
+        phase_begin(stats, rp_dfa, rp_parse, &start);
+        int built = nfa_to_dfa(*r, max_states, &budget);
+        phase_end(stats, rp_dfa, *r, NULL, &start);
+        int over_states = !built && budget.error == re_none;
+        if (over_states && dfa_limited) {
+            budget.error = re_dfa_states;
+        }
+        success = budget.error == re_none;
 
-            /* any character */
-            case '.':
-                current_regex = new_single_transition_regex(ALL_SYMBOLS[0]);
-                current_regex->states[0]->transitions =
-                    realloc(current_regex->states[0]->transitions,
-                            strlen(ALL_SYMBOLS) * sizeof(transition*));
-                for (int i = 1; i < strlen(ALL_SYMBOLS); i++) {
-                    current_regex->states[0]->transitions[i] =
-                        new_transition(ts_active, ALL_SYMBOLS[i], 1);
-                }
-                current_regex->states[0]->nr_transitions = strlen(ALL_SYMBOLS);
-                break;
+        phase_begin(stats, rp_table, rp_dfa, &start);
+        if (success && built) {
+            success = build_table(*r);
+        } else if (success) {
+            (*r)->nfa = new_tagged_nfa(*r);
+        }
+        phase_end(stats, rp_table, *r, NULL, &start);
+        if (stats != NULL) {
+            stats->dfa_over_budget = over_states;
+        }
+    }
 
-            /* character class */
-            case '[': {
-                int inverted = 0;
+    /* the reverse automaton needs the end of the leftmost match to start
+     * from, and only for patterns ending in $ is that known before matching:
+     * the line end. For other patterns the first match end found going
+     * forwards may belong to a later start, so the only safe place to start
+     * is again the line end, which reads every line in full even when the
+     * match is at its start. It is only of use next to a forward dfa or
+     * position automaton that it can tell exactly where to start. It is built
+     * from a second parse, since nfa_to_dfa() has replaced the nfa by now */
+    if (success && (flags & REGEX_REVERSE) && (*r)->line_end &&
+        (*r)->nfa == NULL && reverse_is_exact(*r)) {
+        regex* nfa = NULL;
+        phase_begin(stats, rp_reverse, rp_parse, &start);
+        if (string_to_glushkov(&nfa, input, flags & REGEX_ICASE, &budget,
+                               NULL)) {
+            (*r)->reverse = build_reverse(nfa, max_states, &budget);
+        }
+        delete_regex(&nfa);
+        phase_end(stats, rp_reverse, *r, (*r)->reverse, &start);
+        success = budget.error == re_none;
+    }
 
-                if (input[pos + 1] == '^') {
-                    inverted = 1;
-                    pos++;
-                }
+    if (success) {
+        (*r)->line_start = is_anchored(*r);
+        (*r)->start_bytes = new_start_bytes(*r);
+        (*r)->trace = options ? options->trace : NULL;
+        (*r)->trace_data = options ? options->trace_data : NULL;
+    }
 
-                if (input[++pos] == ']') {
-                    success = 0;
-                    break;
-                }
+    if (!success) {
+        delete_regex(r);
+    }
 
-                vector* v_symbols = new_vector(sizeof(char), NULL);
+    if (options && options->error) {
+        *options->error = success ? re_none : budget.error;
+    }
 
-                while (input[pos] != ']' && input[pos] != 0) {
-                    if (contains(input[pos], "\n\0", 2)) {
-                        success = 0;
-                        break;
-                    }
+    if (stats != NULL || (options && options->max_memory)) {
+        alloc_track(NULL);
+    }
+    if (stats != NULL) {
+        stats->nr_allocations = allocations.nr_allocations;
+        stats->peak_memory = allocations.peak;
+        stats->memory = allocations.live > 0 ? allocations.live : 0;
+    }
 
-                    /* escaped symbol */
-                    if (input[pos] == '\\' &&
-                        contains(input[pos + 1], ESCAPED_SYMBOLS,
-                                 strlen(ESCAPED_SYMBOLS))) {
-                        pos++;
-                        vector_push(v_symbols, &input[pos++]);
-                    }
+    return success;
+}
 
-                    /* range */
-                    else if (input[pos + 1] == '-') {
-                        if (contains(input[pos + 2], "\n\0]", 3)) {
-                            success = 0;
-                            break;
-                        }
-                        /* possible ranges a-zA-Z0-9 and between */
-                        else if (!((input[pos] <= input[pos + 2]) &&
-                                   ((input[pos] >= 'a' && input[pos] <= 'z') ||
-                                    (input[pos] >= 'A' && input[pos] <= 'Z') ||
-                                    (input[pos] >= '0' &&
-                                     input[pos] <= '9')))) {
-                            success = 0;
-                            break;
-                        } else {
-                            for (char c = input[pos]; c <= input[pos + 2];
-                                 c++) {
-                                if (!contains(c, v_symbols->content,
-                                              v_symbols->size)) {
-                                    vector_push(v_symbols, &c);
-                                }
-                            }
-                            pos += 3; /* every range consists of 3 characters */
-                        }
-                    }
 
-                    /* standard symbol */
-                    else {
-                        vector_push(v_symbols, &input[pos++]);
-                    }
-                }
+// COMPILE STATISTICS
 
-                if (!success) {
-                    break;
-                }
 
-                /* inverted class: ALL_SYMBOLS - v_symbols */
-                if (inverted) {
-                    vector* v_inverted_symbols = new_vector(sizeof(char), NULL);
-                    for (int i = 0; i < strlen(ALL_SYMBOLS); i++) {
-                        vector_push(v_inverted_symbols, &ALL_SYMBOLS[i]);
-                    }
-                    string_subtract(v_inverted_symbols, v_symbols);
-                    delete_vector(&v_symbols);
-                    v_symbols = v_inverted_symbols;
-                    v_inverted_symbols = NULL;
-                }
+/* states and transitions of the automaton a phase produced */
+static void
+automaton_size(regex_phase phase, const regex* r, const regex* reverse,
+               int* nr_states, int* nr_transitions) {
+    *nr_states = 0;
+    *nr_transitions = 0;
 
-                char symbol;
-                vector_reset_iterator(v_symbols);
-                vector_next(v_symbols, &symbol);
-                current_regex = new_single_transition_regex(symbol);
-                current_regex->states[0]->transitions =
-                    realloc(current_regex->states[0]->transitions,
-                            v_symbols->size * sizeof(transition*));
-                while (vector_next(v_symbols, &symbol)) {
-                    current_regex->states[0]
-                        ->transitions[v_symbols->iterator - 1] =
-                        new_transition(ts_active, symbol, 1);
-                }
-                current_regex->states[0]->nr_transitions = v_symbols->size;
+    if (phase == rp_reverse) {
+        r = reverse;
+    }
+    if (r == NULL) {
+        return;
+    }
 
-                delete_vector(&v_symbols);
-                break;
+    const tagged_nfa* flat = phase == rp_capture ? r->tagged : r->nfa;
+    if (phase == rp_positions) {
+        const position_nfa* p = r->positions;
+        if (p != NULL) {
+            *nr_states = p->nr_positions;
+            for (int k = 0; k < p->nr_positions; k++) {
+                *nr_transitions += __builtin_popcountll(
+                    p->follow[(k / 8) * 256 + (1 << (k % 8))]);
             }
-
-            /* standard character */
-            default:
-                current_regex = new_single_transition_regex(input[pos]);
-                break;
+        }
+    } else if (phase == rp_table && r->table != NULL) {
+        *nr_states = r->nr_states;
+        for (int i = 0; i < r->nr_states * r->nr_classes; i++) {
+            *nr_transitions += r->table[i] >= 0;
+        }
+    } else if (phase == rp_capture || phase == rp_table) {
+        if (flat != NULL) {
+            *nr_states = flat->nr_states;
+            *nr_transitions = flat->offsets[flat->nr_states * flat->nr_classes];
+        }
+    } else {
+        *nr_states = r->nr_states;
+        for (int i = 0; i < r->nr_states; i++) {
+            for (int j = 0; j < r->states[i]->nr_transitions; j++) {
+                *nr_transitions +=
+                    r->states[i]->transitions[j]->status != ts_dead;
             }
+        }
+    }
+}
 
 
-            /* modifiers */
-            switch (input[pos + 1]) {
-            /* repetition range a{2,5} */
-            case '{': {
-                int min = 0;
-                int max = 0;
-                pos += 2;
+/* starts timing phase, which works on the automaton input_phase produced; -1
+ * if it starts from the pattern */
+static void phase_begin(regex_compile_stats* stats,
+                        regex_phase phase,
+                        int input_phase,
+                        struct timespec* start) {
+    if (stats == NULL) {
+        return;
+    }
+    regex_phase_stats* p = &stats->phases[phase];
+    p->ran = 1;
+    if (input_phase >= 0) {
+        p->states_before = stats->phases[input_phase].states_after;
+        p->transitions_before = stats->phases[input_phase].transitions_after;
+    }
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
 
-                /* parse min */
-                while (input[pos] != ',' && input[pos] != '}') {
-                    if (input[pos] >= '0' && input[pos] <= '9') {
-                        min = min * 10 + (input[pos++] - '0');
-                    } else {
-                        success = 0;
-                        break;
-                    }
-                }
 
-                if (!success) {
-                    break;
-                }
+static void phase_end(regex_compile_stats* stats,
+                      regex_phase phase,
+                      const regex* r,
+                      const regex* reverse,
+                      const struct timespec* start) {
+    if (stats == NULL) {
+        return;
+    }
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    regex_phase_stats* p = &stats->phases[phase];
+    p->seconds =
+        (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+    automaton_size(phase, r, reverse, &p->states_after, &p->transitions_after);
+}
 
-                if (input[pos] == ',') {
-                    if (input[++pos] == '}') {
-                        max = min;
-                    } else {
-                        /* parse max */
-                        while (input[pos] != '}') {
-                            if (input[pos] >= '0' && input[pos] <= '9') {
-                                max = max * 10 + (input[pos++] - '0');
-                            } else {
-                                success = 0;
-                                break;
-                            }
-                        }
-                    }
-                } else if (input[pos] == '}') {
-                    max = min;
-                }
 
+/* parses input and emits its nfa into *r; with fold_case, letters are turned
+ * into classes of both cases while parsing, so the automaton itself treats
+ * them as one symbol and matching costs nothing extra; fails budget with the
+ * reason if the pattern can't be compiled */
+static int string_to_regex(regex** r,
+                           char* input,
+                           int capture,
+                           int fold_case,
+                           compile_budget* budget) {
+    ast a;
+    int success = parse_regex(&a, input, capture, fold_case);
+    if (!success) {
+        budget->error = a.too_large ? re_nfa_states : re_syntax;
+    } else if (budget_nfa_states(budget, a.nodes[a.root].nr_states)) {
+        *r = ast_to_regex(&a);
+    }
+    free_ast(&a);
+    return *r != NULL;
+}
 
-                if (!success) {
-                    break;
-                }
 
-                pos++;
+/* parses input straight into the epsilon free nfa of its positions; plain
+ * strings also get their literal */
+static int string_to_glushkov(regex** r,
+                              char* input,
+                              int fold_case,
+                              compile_budget* budget,
+                              regex_compile_stats* stats) {
+    ast a;
+    int success = parse_regex(&a, input, 0, fold_case);
+    if (!success) {
+        budget->error = a.too_large ? re_nfa_states : re_syntax;
+    } else {
+        *r = ast_to_glushkov(&a, budget, stats);
+    }
+    if (*r != NULL) {
+        (*r)->literal = ast_to_literal(&a);
+    }
+    free_ast(&a);
+    return *r != NULL;
+}
 
-                if (min < 0 || max < 1 || min > max) {
-                    success = 0;
-                    break;
-                }
 
-                /* chain max-1 copies of current_regex */
-                vector* copy_vector = new_vector(sizeof(regex*), NULL);
-                for (int i = 0; i < (max - 1); i++) {
-                    regex* temp_regex = copy_regex(current_regex);
-                    vector_push(copy_vector, &temp_regex);
-                }
+/* splits the symbols of all active transitions of r at the bounds of every
+ * transition, so that each transition covers either all or none of the
+ * symbols of an interval; stores the bounds of every interval as a pair
+ * (lo, hi) in intervals and returns the number of intervals */
+static int symbol_intervals(regex* r, int** intervals) {
+    char bound[NR_SYMBOLS + 1] = {0};
+    char used[NR_SYMBOLS + 1] = {0};
+    int nr_intervals = 0;
 
+    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+        for (int transition_nr = 0;
+             transition_nr < r->states[state_nr]->nr_transitions;
+             transition_nr++) {
+            transition* t = r->states[state_nr]->transitions[transition_nr];
+            if (t->status == ts_active) {
+                bound[t->lo] = 1;
+                bound[t->hi + 1] = 1;
+                memset(used + t->lo, 1, t->hi - t->lo + 1);
+            }
+        }
+    }
 
-                /* fold all copied regexes into one */
-                regex* left = NULL;
-                regex* right = NULL;
-                for (int i = max - 2; i >= 0; i--) {
-                    vector_pop(copy_vector, &right);
-                    if (i >= min - 1) {
-                        regex_optional(right);
-                    }
-                    if (i > 0) {
-                        vector_pop(copy_vector, &left);
-                        regex_chain(left, &right);
-                        vector_push(copy_vector, &left);
-                    }
-                }
+    /* the anchors always get intervals of their own */
+    bound[LINE_START] = bound[LINE_END] = 1;
 
-                /* chain the copies behind current_regex */
-                vector_pop(copy_vector, &right);
-                regex_chain(current_regex, &right);
+    *intervals = counted_malloc(2 * NR_SYMBOLS * sizeof(int));
+    for (int lo = 0; lo < NR_SYMBOLS; lo++) {
+        int hi = lo;
+        while (!bound[hi + 1]) {
+            hi++;
+        }
+        if (used[lo]) {
+            (*intervals)[2 * nr_intervals] = lo;
+            (*intervals)[2 * nr_intervals + 1] = hi;
+            nr_intervals++;
+        }
+        lo = hi;
+    }
 
-                delete_vector(&copy_vector);
+    return nr_intervals;
+}
 
-                if (min == 0) {
-                    regex_optional(current_regex);
-                }
-            } break;
-
-            /* zero or one repetition a? */
-            case '?':
-                regex_optional(current_regex);
-                if (input[pos + 2] == '?') {
-                    regex_make_lazy(current_regex);
-                    pos += 3;
-                } else {
-                    regex_make_greedy(current_regex);
-                    pos += 2;
-                }
-                break;
 
-            /* zero or many repetitions a* */
-            case '*':
-                regex_repeat(current_regex);
-                if (input[pos + 2] == '?') {
-                    regex_make_lazy(current_regex);
-                    pos += 3;
-                } else {
-                    regex_make_greedy(current_regex);
-                    pos += 2;
-                }
-                break;
+// EPSILON FUNCTION
 
-            /* one or many repetitions a+ */
-            case '+': {
-                regex* temp_regex = copy_regex(current_regex);
-                regex_repeat(temp_regex);
-                regex_chain(current_regex, &temp_regex);
-                if (input[pos + 2] == '?') {
-                    regex_make_lazy(current_regex);
-                    pos += 3;
-                } else {
-                    regex_make_greedy(current_regex);
-                    pos += 2;
-                }
-            } break;
 
-            /* no modifiers */
-            default:
-                pos++;
-                break;
-            }
-        }
+/* allocates c for an nfa of nr_states states; returns 0 if that fails */
+static int new_closure_tags(closure_tags* c, int nr_states) {
+    c->source = -1;
+    c->generation = 0;
+    c->stamp = counted_calloc(nr_states, sizeof(size_t));
+    c->tags = counted_malloc(nr_states * sizeof(unsigned int));
+    c->pending = counted_malloc(nr_states * sizeof(int));
+    return c->stamp != NULL && c->tags != NULL && c->pending != NULL;
+}
 
-        /* ^ line start */
-        else if (input[pos] == '^') {
-            pos++;
-            current_regex = new_single_transition_regex(LINE_START);
-        }
 
-        /* line end */
-        else if (input[pos] == '$') {
-            pos++;
-            current_regex = new_single_transition_regex(LINE_END);
-        }
+static void delete_closure_tags(closure_tags* c) {
+    counted_free(c->stamp);
+    counted_free(c->tags);
+    counted_free(c->pending);
+}
 
-        /* block start */
-        else if (input[pos] == '(') {
-            pos++;
-            level++;
-            int temp_int = 0;
-            vector_push(alternative_on_level, &temp_int);
-            vector* temp_vector = new_vector(sizeof(vector*), NULL);
-            vector_push(regex_objects, &temp_vector);
-        }
 
-        /* alternative */
-        else if (input[pos] == '|') {
-            int alternative;
-            vector* regex_objects_top;
-            vector_top(regex_objects, &regex_objects_top);
-            vector_pop(alternative_on_level, &alternative);
-            if (!regex_objects_top->size || alternative) {
-                success = 0;
-                vector_push(alternative_on_level, &alternative);
-                break;
-            } else {
-                alternative = 1;
-                vector_push(alternative_on_level, &alternative);
-                pos++;
+/* the tags collected on the way from source to every state of its epsilon
+ * closure, indexed by state; if several paths lead to a state, the first one
+ * found wins; only one source at a time is kept in c, a walk is repeated
+ * only when the source changes */
+static const unsigned int*
+epsilon_closure_tags(regex* r, closure_tags* c, int source) {
+    if (c->source == source) {
+        return c->tags;
+    }
+    c->source = source;
+    c->generation++;
+
+    size_t nr_pending = 0;
+    c->stamp[source] = c->generation;
+    c->tags[source] = 0;
+    c->pending[nr_pending++] = source;
+    while (nr_pending) {
+        int p = c->pending[--nr_pending];
+        for (int i = 0; i < r->states[p]->nr_transitions; i++) {
+            transition* t = r->states[p]->transitions[i];
+            int next = t->next_state;
+            if (t->status == ts_epsilon && c->stamp[next] != c->generation) {
+                c->stamp[next] = c->generation;
+                c->tags[next] = c->tags[p] | t->pre_tags;
+                c->pending[nr_pending++] = next;
             }
         }
+    }
+    return c->tags;
+}
 
-        /* invalid symbol */
-        else {
-            success = 0;
-            break;
-        }
 
-        /* if necessary, integrate current_regex */
-        if (current_regex != NULL) {
-            vector* v_temp_regex;
-            vector_pop(regex_objects, &v_temp_regex);
-            int alternative;
-            vector_pop(alternative_on_level, &alternative);
-            if (alternative) {
-                regex* temp_regex;
-                vector_pop(v_temp_regex, &temp_regex);
-                regex_alternative(temp_regex, &current_regex);
-                vector_push(v_temp_regex, &temp_regex);
-                alternative = 0;
-            } else {
-                vector_push(v_temp_regex, &current_regex);
-            }
-            vector_push(alternative_on_level, &alternative);
-            vector_push(regex_objects, &v_temp_regex);
-            current_regex = NULL;
-        }
+/* numbers the strongly connected components of the epsilon graph in the order
+ * tarjan's algorithm completes them, so every component only reaches
+ * components with a smaller number; writes the component of every state and
+ * returns the number of components */
+static int epsilon_components(regex* r, int* component) {
+    int n = r->nr_states;
+    int* index = counted_malloc(n * sizeof(int));
+    int* low = counted_malloc(n * sizeof(int));
+    int* next_transition = counted_malloc(n * sizeof(int));
+    int* path = counted_malloc(n * sizeof(int));
+    int* open = counted_malloc(n * sizeof(int));
+    int nr_components = 0, nr_visited = 0, nr_open = 0;
+
+    for (int i = 0; i < n; i++) {
+        index[i] = -1;
+        component[i] = -1;
     }
 
-    if (success) {
-        int alternative;
-        vector_pop(alternative_on_level, &alternative);
-
-        if (level || alternative) {
-            success = 0;
-        } else {
-            /* chain all level 0 elements */
-            vector* level_0_elements;
-            vector_pop(regex_objects, &level_0_elements);
-            vector_reset_iterator(level_0_elements);
-            regex* temp_regex;
-            if (vector_next(level_0_elements, &current_regex)) {
-                while (vector_next(level_0_elements, &temp_regex)) {
-                    regex_chain(current_regex, &temp_regex);
+    for (int root = 0; root < n; root++) {
+        if (index[root] != -1) {
+            continue;
+        }
+        /* depth first search without recursion, path holds the states whose
+         * transitions are being followed */
+        int depth = 0;
+        path[depth++] = root;
+        index[root] = low[root] = nr_visited++;
+        next_transition[root] = 0;
+        open[nr_open++] = root;
+
+        while (depth) {
+            int v = path[depth - 1];
+            state* s = r->states[v];
+
+            if (next_transition[v] < s->nr_transitions) {
+                transition* t = s->transitions[next_transition[v]++];
+                int w = t->next_state;
+                if (t->status != ts_epsilon) {
+                    continue;
+                }
+                if (index[w] == -1) {
+                    index[w] = low[w] = nr_visited++;
+                    next_transition[w] = 0;
+                    open[nr_open++] = w;
+                    path[depth++] = w;
+                }
+                /* visited but without component: w is still open */
+                else if (component[w] == -1 && index[w] < low[v]) {
+                    low[v] = index[w];
                 }
+                continue;
             }
-            delete_vector(&level_0_elements);
-            /* chain an optional end of line regex to the end */
-            temp_regex = new_single_transition_regex(LINE_END);
-            regex_optional(temp_regex);
-            regex_chain(current_regex, &temp_regex);
 
-            *r = current_regex;
-            current_regex = NULL;
+            depth--;
+            if (depth && low[v] < low[path[depth - 1]]) {
+                low[path[depth - 1]] = low[v];
+            }
+            if (low[v] == index[v]) {
+                int w;
+                do {
+                    w = open[--nr_open];
+                    component[w] = nr_components;
+                } while (w != v);
+                nr_components++;
+            }
         }
     }
 
-
-    /* clean up */
-    delete_regex(&current_regex);
-    delete_vector(&regex_objects);
-    delete_vector(&alternative_on_level);
-
-    return success;
+    counted_free(open);
+    counted_free(path);
+    counted_free(next_transition);
+    counted_free(low);
+    counted_free(index);
+    return nr_components;
 }
 
-// EPSILON FUNCTION
-
-
-static int remove_epsilon_transitions(regex* r) {
-    /* stores a list of all states in the epsilon closure of state n at position
-     * n */
-    vector* epsilon_closure_list = new_vector(sizeof(vector*), NULL);
-    /* redundant but faster access than using the epsilon_closure_list and
-     * checking individual sizes of sub-vectors */
-    vector* epsilon_closure_size = new_vector(sizeof(int), NULL);
-    /* used in multiple passes to mark states as visited/contained/...,
-     * initialized once because the size never changes */
-    vector* marked = new_vector(sizeof(int), NULL);
-
-    /* used to mark/unmark states; necessary because passing values to a vector
-     * is only possible by reference */
-    int null_const = 0;
-    int one_const = 1;
-    int two_const = 2;
-
-    /* initialize vectors; because every state's epsilon closure contains the
-     * state itself, each epsilon closure is initialized with the iterator value
-     * and size 1
-     */
-    for (int i = 0; i < r->nr_states; i++) {
-        vector_push(epsilon_closure_size, &one_const);
-        vector_push(marked, &null_const);
-        vector* temp_vector = new_vector(sizeof(int), NULL);
-        vector_push(temp_vector, &i);
-        vector_push(epsilon_closure_list, &temp_vector);
-    }
-
-    /* always contains the states that need to be processed in the current
-     * iteration */
-    stack* s = new_stack(sizeof(int), NULL);
 
-    /* iterate over all states and calculate the epsilon closures */
-    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
-        /* reset the marked vector */
-        vector_reset_iterator(marked);
-        do {
-            vector_set(marked, &null_const);
-        } while (vector_move_iterator(marked));
-
-        /* get a "reference" to the partial vector (contains a list of all
-         * states that are in the epsilon closure; contains at least the
-         * processed state itself)
-         */
-        vector* current_epsilon_closure;
-        vector_get_at(epsilon_closure_list, state_nr, &current_epsilon_closure);
-
-        /* push all to the stack for further processing + mark them as already
-         * visited, but with a 2 so they won't get stored twice */
-        vector_reset_iterator(current_epsilon_closure);
-        int state_to_examine;
-        while (vector_next(current_epsilon_closure, &state_to_examine)) {
-            stack_push(s, &state_to_examine);
-            vector_set_at(marked, state_to_examine, &two_const);
-        }
-
-        /* process all states on the stack */
-        int processed_state;
-        while (stack_pop(s, &processed_state)) {
-            for (int transition_nr = 0;
-                 transition_nr < r->states[processed_state]->nr_transitions;
-                 transition_nr++) {
-                if (r->states[processed_state]
-                        ->transitions[transition_nr]
-                        ->status == ts_epsilon) {
-                    int next_state = r->states[processed_state]
-                                         ->transitions[transition_nr]
-                                         ->next_state;
-                    int next_state_marked;
-                    vector_get_at(marked, next_state, &next_state_marked);
-                    if (!next_state_marked) {
-                        vector_set_at(marked, next_state, &one_const);
-                        stack_push(s, &next_state);
-                        /* push next_state to the epsilon closure of
-                         * processed_state for later */
-                        vector* temp_epsilon_closure;
-                        int temp_epsilon_closure_size;
-                        vector_get_at(epsilon_closure_list, processed_state,
-                                      &temp_epsilon_closure);
-                        vector_get_at(epsilon_closure_size, processed_state,
-                                      &temp_epsilon_closure_size);
-                        temp_epsilon_closure_size++;
-                        vector_set_at(epsilon_closure_size, processed_state,
-                                      &temp_epsilon_closure_size);
-                        vector_push(temp_epsilon_closure, &next_state);
-                        vector_set_at(epsilon_closure_list, processed_state,
-                                      &temp_epsilon_closure);
-                    }
+/* the epsilon closures, one per component: its own states and the closures of
+ * the components its states lead to, which are complete by then because they
+ * have smaller numbers; every closure only keeps the words of the bitset of
+ * all states from its lowest to its highest state, which are few because
+ * epsilon transitions lead to states close by */
+static uint64_t* epsilon_closures(regex* r,
+                                  const int* component,
+                                  int nr_components,
+                                  closure_window* windows) {
+    int n = r->nr_states;
+    size_t size = 0;
+    size_t capacity = nr_components + 1;
+    uint64_t* closures = counted_malloc(capacity * sizeof(uint64_t));
+
+    /* the states sorted by component */
+    int* first = counted_calloc(nr_components + 1, sizeof(int));
+    int* members = counted_malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        first[component[i] + 1]++;
+    }
+    for (int c = 0; c < nr_components; c++) {
+        first[c + 1] += first[c];
+    }
+    for (int i = 0; i < n; i++) {
+        members[first[component[i]]++] = i;
+    }
+    for (int c = nr_components; c > 0; c--) {
+        first[c] = first[c - 1];
+    }
+    first[0] = 0;
+
+    for (int c = 0; c < nr_components; c++) {
+        /* the window covers the members and the closures they lead to */
+        int lo = members[first[c]] / 64, hi = lo;
+        for (int m = first[c]; m < first[c + 1]; m++) {
+            state* s = r->states[members[m]];
+            lo = members[m] / 64 < lo ? members[m] / 64 : lo;
+            hi = members[m] / 64 > hi ? members[m] / 64 : hi;
+            for (int j = 0; j < s->nr_transitions; j++) {
+                closure_window* next =
+                    &windows[component[s->transitions[j]->next_state]];
+                if (s->transitions[j]->status == ts_epsilon &&
+                    component[s->transitions[j]->next_state] != c) {
+                    int next_hi = next->first_word + next->nr_words - 1;
+                    lo = next->first_word < lo ? next->first_word : lo;
+                    hi = next_hi > hi ? next_hi : hi;
                 }
             }
         }
 
-        /* put the reachable states into the epsilon closure list */
-        vector_reset_iterator(marked);
-        int examined_state = 0;
-        int state_reachable = 0;
-        while (vector_next(marked, &state_reachable)) {
-            if (state_reachable == 1) {
-                examined_state = marked->iterator - 1;
-                vector_push(current_epsilon_closure, &examined_state);
+        closure_window* window = &windows[c];
+        window->first_word = lo;
+        window->nr_words = hi - lo + 1;
+        window->offset = size;
+        size += window->nr_words;
+        if (size > capacity) {
+            capacity = 2 * size;
+            closures = counted_realloc(closures, capacity * sizeof(uint64_t));
+        }
+        uint64_t* closure = closures + window->offset;
+        memset(closure, 0, window->nr_words * sizeof(uint64_t));
+
+        for (int m = first[c]; m < first[c + 1]; m++) {
+            state* s = r->states[members[m]];
+            closure[members[m] / 64 - lo] |= (uint64_t)1 << (members[m] % 64);
+            for (int j = 0; j < s->nr_transitions; j++) {
+                int next = component[s->transitions[j]->next_state];
+                if (s->transitions[j]->status != ts_epsilon || next == c) {
+                    continue;
+                }
+                const uint64_t* reached = closures + windows[next].offset;
+                uint64_t* target = closure + (windows[next].first_word - lo);
+                for (int w = 0; w < windows[next].nr_words; w++) {
+                    target[w] |= reached[w];
+                }
             }
         }
-
-        /* copy the (maybe) changed partial vector back and write its size */
-        vector_set_at(epsilon_closure_list, state_nr, &current_epsilon_closure);
-        vector_set_at(epsilon_closure_size, state_nr,
-                      &(current_epsilon_closure->size));
     }
-    delete_stack(&s);
 
-    /* remove all epsilon transitions by marking them as dead */
-    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
-        for (int j = r->states[state_nr]->nr_transitions - 1; j >= 0; j--) {
-            if (r->states[state_nr]->transitions[j]->status == ts_epsilon) {
-                r->states[state_nr]->transitions[j]->status = ts_dead;
-            }
-        }
+    counted_free(members);
+    counted_free(first);
+    return closures;
+}
+
+
+/* adds the states of the closure window at closure to s */
+static void state_bits_add(state_bits* s,
+                           const uint64_t* closure,
+                           const closure_window* window) {
+    int hi = window->first_word + window->nr_words - 1;
+    for (int w = 0; w < window->nr_words; w++) {
+        s->words[window->first_word + w] |= closure[w];
     }
+    s->lo = window->first_word < s->lo ? window->first_word : s->lo;
+    s->hi = hi > s->hi ? hi : s->hi;
+}
 
-    /* make a list of all symbols the automaton knows */
-    int nr_symbols = 0;
-    vector* symbols = new_vector(sizeof(char), NULL);
 
-    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
-        for (int transition_nr = 0;
-             transition_nr < r->states[state_nr]->nr_transitions;
-             transition_nr++) {
-            if (r->states[state_nr]->transitions[transition_nr]->status ==
-                    ts_active &&
-                !contains(
-                    r->states[state_nr]->transitions[transition_nr]->symbol,
-                    symbols->content, symbols->size)) {
-                vector_push(
-                    symbols,
-                    &(r->states[state_nr]->transitions[transition_nr]->symbol));
-            }
-        }
+static void state_bits_clear(state_bits* s) {
+    if (s->lo <= s->hi) {
+        memset(s->words + s->lo, 0, (s->hi - s->lo + 1) * sizeof(uint64_t));
     }
+    s->lo = INT_MAX;
+    s->hi = -1;
+}
 
 
+/* returns 0 once budget fails, leaving r half converted */
+static int remove_epsilon_transitions(regex* r, compile_budget* budget) {
+    int n = r->nr_states;
+    int tagged = r->nr_groups > 0;
+
+    /* with groups, the tags of the epsilon paths from the current state and
+     * from the state whose closure is added, walked before the epsilon
+     * transitions are removed at the end */
+    closure_tags own_tags = {0}, added_tags = {0};
+    int allocated = !tagged || (new_closure_tags(&own_tags, n) &&
+                                new_closure_tags(&added_tags, n));
+    /* tags of the path to every state reached in the current pass */
+    unsigned int* pre_tags = counted_calloc(n, sizeof(unsigned int));
+    unsigned int* post_tags = counted_calloc(n, sizeof(unsigned int));
+
+    /* all states of a cycle of epsilon transitions share their closure, so
+     * closures are computed once per strongly connected component */
+    int* component = counted_malloc(n * sizeof(int));
+    int nr_components = component ? epsilon_components(r, component) : 0;
+    closure_window* windows =
+        counted_malloc(nr_components * sizeof(closure_window));
+    uint64_t* closures =
+        windows ? epsilon_closures(r, component, nr_components, windows) : NULL;
+#define WINDOW(state_nr) (&windows[component[state_nr]])
+#define CLOSURE(state_nr) (closures + WINDOW(state_nr)->offset)
+
+    /* split the symbols the automaton knows into intervals that every
+     * transition covers either completely or not at all */
+    int* intervals;
+    int nr_intervals = symbol_intervals(r, &intervals);
+
+    /* the states entered directly with the current interval, and those
+     * together with their closures */
+    int nr_words = (n + 63) / 64;
+    state_bits targets = {counted_calloc(nr_words, sizeof(uint64_t)), INT_MAX,
+                          -1};
+    state_bits reached = {counted_calloc(nr_words, sizeof(uint64_t)), INT_MAX,
+                          -1};
+    allocated = budget_allocated(budget, allocated && pre_tags && post_tags &&
+                                             component && windows && closures &&
+                                             targets.words && reached.words);
+
     /* iterate over all states and write the new transitions */
-    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
-        vector* current_epsilon_closure;
-        vector_get_at(epsilon_closure_list, state_nr, &current_epsilon_closure);
-
-        /* iterate over all possible symbols */
-        char symbol;
-        vector_reset_iterator(symbols);
-        while (vector_next(symbols, &symbol)) {
-            /* mark all states as not reachable */
-            vector_reset_iterator(marked);
-            do {
-                vector_set(marked, &null_const);
-            } while (vector_move_iterator(marked));
-
-            /* iterate over all states in the epsilon closure mark their
-             * successor if they have a transition with the current symbol */
-            vector_reset_iterator(current_epsilon_closure);
-            int processed_state;
-            while (vector_next(current_epsilon_closure, &processed_state)) {
-                for (int transition_iterator = 0;
-                     transition_iterator <
-                     r->states[processed_state]->nr_transitions;
-                     transition_iterator++) {
-                    if (r->states[processed_state]
-                            ->transitions[transition_iterator]
-                            ->symbol == symbol) {
-                        vector_set_at(marked,
-                                      r->states[processed_state]
-                                          ->transitions[transition_iterator]
-                                          ->next_state,
-                                      &one_const);
+    for (int state_nr = 0; allocated && state_nr < n && budget_check(budget);
+         state_nr++) {
+        const closure_window* window = WINDOW(state_nr);
+        const uint64_t* closure = CLOSURE(state_nr);
+        const unsigned int* own =
+            tagged ? epsilon_closure_tags(r, &own_tags, state_nr) : NULL;
+
+        /* iterate over all symbol intervals */
+        for (int interval = 0; interval < nr_intervals; interval++) {
+            int lo = intervals[2 * interval];
+            int hi = intervals[2 * interval + 1];
+
+            /* collect the successors of every state in the epsilon closure
+             * that have a transition with the current interval */
+            for (int w = 0; w < window->nr_words; w++) {
+                for (uint64_t bits = closure[w]; bits; bits &= bits - 1) {
+                    int processed_state = (window->first_word + w) * 64 +
+                                          __builtin_ctzll(bits);
+                    state* s = r->states[processed_state];
+                    for (int j = 0; j < s->nr_transitions; j++) {
+                        transition* t = s->transitions[j];
+                        int next = t->next_state;
+                        uint64_t bit = (uint64_t)1 << (next % 64);
+                        if (t->status != ts_active || t->lo > lo ||
+                            hi > t->hi) {
+                            continue;
+                        }
+                        if (!(targets.words[next / 64] & bit) && tagged) {
+                            pre_tags[next] =
+                                own[processed_state] | t->pre_tags;
+                            post_tags[next] = t->post_tags;
+                        }
+                        targets.words[next / 64] |= bit;
+                        targets.lo = next / 64 < targets.lo ? next / 64
+                                                            : targets.lo;
+                        targets.hi = next / 64 > targets.hi ? next / 64
+                                                            : targets.hi;
                     }
                 }
             }
 
-            /* now all states directly reachable with symbol from the current
-             * epsilon closure are marked -> mark the epsilon closure of those
-             * states */
-            for (int checked_state = 0; checked_state < r->nr_states;
-                 checked_state++) {
-                int is_reachable;
-                vector_get_at(marked, checked_state, &is_reachable);
-                if (is_reachable) {
-                    vector* checked_epsilon_closure;
-                    vector_get_at(epsilon_closure_list, checked_state,
-                                  &checked_epsilon_closure);
-                    vector_reset_iterator(checked_epsilon_closure);
-                    int next_reachable_state;
-                    while (vector_next(checked_epsilon_closure,
-                                       &next_reachable_state)) {
-                        vector_set_at(marked, next_reachable_state, &one_const);
+            /* add the epsilon closures of the successors */
+            if (!tagged) {
+                for (int w = targets.lo; w <= targets.hi; w++) {
+                    for (uint64_t bits = targets.words[w]; bits;
+                         bits &= bits - 1) {
+                        int next = w * 64 + __builtin_ctzll(bits);
+                        state_bits_add(&reached, CLOSURE(next), WINDOW(next));
+                    }
+                }
+            }
+            /* with tags every state is reached from the lowest state that
+             * leads to it, so states are visited in order as they come in */
+            else if (targets.lo <= targets.hi) {
+                memcpy(reached.words + targets.lo, targets.words + targets.lo,
+                       (targets.hi - targets.lo + 1) * sizeof(uint64_t));
+                reached.lo = targets.lo;
+                reached.hi = targets.hi;
+                for (int w = targets.lo; w <= reached.hi; w++) {
+                    uint64_t visited = 0, bits;
+                    while ((bits = reached.words[w] & ~visited)) {
+                        int checked_state = w * 64 + __builtin_ctzll(bits);
+                        const closure_window* next_window =
+                            WINDOW(checked_state);
+                        const uint64_t* next_closure = CLOSURE(checked_state);
+                        visited |= bits & -bits;
+                        for (int k = 0; k < next_window->nr_words; k++) {
+                            int word = next_window->first_word + k;
+                            for (uint64_t new = next_closure[k] &
+                                                ~reached.words[word];
+                                 new; new &= new - 1) {
+                                int next = word * 64 + __builtin_ctzll(new);
+                                const unsigned int* added =
+                                    epsilon_closure_tags(r, &added_tags,
+                                                         checked_state);
+                                pre_tags[next] = pre_tags[checked_state];
+                                post_tags[next] =
+                                    post_tags[checked_state] | added[next];
+                            }
+                        }
+                        state_bits_add(&reached, next_closure, next_window);
                     }
                 }
             }
 
-            /* remove duplicates: iterate over the current state's transitions
-             * and unmark all states that are already reachable with the current
-             * symbol; if not done, the nfa->dfa conversion can create endless
-             * loops by building state sets that contain the same state multiple
-             * times */
-            for (int transition_iterator = 0;
-                 transition_iterator < r->states[state_nr]->nr_transitions;
-                 transition_iterator++) {
-                if (r->states[state_nr]
-                            ->transitions[transition_iterator]
-                            ->symbol == symbol &&
-                    r->states[state_nr]
-                            ->transitions[transition_iterator]
-                            ->status == ts_active) {
-                    vector_set_at(marked,
-                                  r->states[state_nr]
-                                      ->transitions[transition_iterator]
-                                      ->next_state,
-                                  &null_const);
+            /* remove duplicates: unmark all states that are already reachable
+             * with the current symbol; if not done, the nfa->dfa conversion
+             * can create endless loops by building state sets that contain the
+             * same state multiple times */
+            for (int j = 0; j < r->states[state_nr]->nr_transitions; j++) {
+                transition* t = r->states[state_nr]->transitions[j];
+                if (t->status == ts_active && t->lo <= lo && hi <= t->hi) {
+                    reached.words[t->next_state / 64] &=
+                        ~((uint64_t)1 << (t->next_state % 64));
                 }
             }
 
             /* now all states that can be reached with symbol are marked so
              * finally, we can add transitions for them */
-            int is_reachable;
-            vector_reset_iterator(marked);
-            while (vector_next(marked, &is_reachable)) {
-                if (is_reachable) {
-                    r->states[state_nr]->transitions =
-                        realloc(r->states[state_nr]->transitions,
-                                ++(r->states[state_nr]->nr_transitions) *
-                                    sizeof(transition*));
-                    r->states[state_nr]
-                        ->transitions[r->states[state_nr]->nr_transitions - 1] =
-                        new_transition(ts_active, symbol, marked->iterator - 1);
+            for (int w = reached.lo; w <= reached.hi; w++) {
+                for (uint64_t bits = reached.words[w]; bits; bits &= bits - 1) {
+                    state* s = r->states[state_nr];
+                    s->transitions =
+                        counted_realloc(s->transitions,
+                                ++(s->nr_transitions) * sizeof(transition*));
+                    transition* t = new_transition(
+                        ts_active, lo, hi, w * 64 + __builtin_ctzll(bits));
+                    t->pre_tags = pre_tags[t->next_state];
+                    t->post_tags = post_tags[t->next_state];
+                    s->transitions[s->nr_transitions - 1] = t;
                 }
             }
+
+            state_bits_clear(&targets);
+            state_bits_clear(&reached);
         }
     }
+#undef CLOSURE
+#undef WINDOW
 
-    delete_vector(&symbols);
-    delete_vector(&marked);
-    delete_vector(&epsilon_closure_size);
-    vector* temp_vector;
-    while (vector_pop(epsilon_closure_list, &temp_vector)) {
-        delete_vector(&temp_vector);
+    /* remove all epsilon transitions by marking them as dead */
+    for (int state_nr = 0; state_nr < n; state_nr++) {
+        for (int j = r->states[state_nr]->nr_transitions - 1; j >= 0; j--) {
+            if (r->states[state_nr]->transitions[j]->status == ts_epsilon) {
+                r->states[state_nr]->transitions[j]->status = ts_dead;
+            }
+        }
     }
-    delete_vector(&epsilon_closure_list);
 
-    return 1;
+    counted_free(reached.words);
+    counted_free(targets.words);
+    counted_free(intervals);
+    counted_free(closures);
+    counted_free(windows);
+    counted_free(component);
+    counted_free(post_tags);
+    counted_free(pre_tags);
+    delete_closure_tags(&added_tags);
+    delete_closure_tags(&own_tags);
+
+    return budget_check(budget);
 }
 
 
 // NFA-DFA-CONVERSION
 
 
-static int nfa_to_dfa(regex* r) {
+// returns 0 and leaves r unchanged if the dfa would need more than max_states
+// states, unless max_states is negative, or once budget fails
+static int nfa_to_dfa(regex* r, int max_states, compile_budget* budget) {
     // store the new combined states
     int nr_state_sets = 0;
+    int over_budget = 0;
     vector* state_sets = new_vector(sizeof(vector*), NULL);
     vector* states = new_vector(sizeof(state*), NULL);
 
+    // the combined states by their hash, so a lookup does not compare the
+    // next states with every combined state found so far
+    state_set_index index;
+    new_state_set_index(&index);
+
     // stack for storing states that need to be processed
     stack* s = new_stack(sizeof(int), NULL);
 
-    // accumulate a string with all symbols the automaton knows
-    char* symbols = NULL;
-    int nr_symbols = 0;
-    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
-        for (int transition_nr = 0;
-             transition_nr < r->states[state_nr]->nr_transitions;
-             transition_nr++) {
-            if ((r->states[state_nr]->transitions[transition_nr]->status ==
-                 ts_active) &&
-                !contains(
-                    r->states[state_nr]->transitions[transition_nr]->symbol,
-                    symbols, nr_symbols)) {
-                symbols = realloc(symbols, ++nr_symbols * sizeof(char));
-                symbols[nr_symbols - 1] =
-                    r->states[state_nr]->transitions[transition_nr]->symbol;
-            }
-        }
-    }
+    // split the symbols the automaton knows into intervals that every
+    // transition covers either completely or not at all
+    int* intervals;
+    int nr_intervals = symbol_intervals(r, &intervals);
+
+    // the next states of a combined state and an interval; added_in holds
+    // the generation an nfa state was last added in, so large alternations
+    // with thousands of next states are collected in linear time
+    int* next_states = counted_malloc(r->nr_states * sizeof(int));
+    size_t* added_in = counted_calloc(r->nr_states, sizeof(size_t));
+    size_t generation = 0;
+
     {
         // initialize the stack
         int start_state_nr = 0;
@@ -760,6 +921,7 @@ static int nfa_to_dfa(regex* r) {
         vector* start_state_set = new_vector(sizeof(int), NULL);
         vector_push(start_state_set, &start_state_nr);
         vector_push(state_sets, &start_state_set);
+        add_state_set(&index, hash_state_set(&start_state_nr, 1));
 
         nr_state_sets++;
 
@@ -771,16 +933,20 @@ static int nfa_to_dfa(regex* r) {
     // process all states on the stack
     // state_pos is an index into the states vector
     int state_pos;
-    while (stack_pop(s, &state_pos)) {
-        // iterate over symbols
-        for (int symbol_iterator = 0; symbol_iterator < nr_symbols;
-             symbol_iterator++) {
+    while (!over_budget && stack_pop(s, &state_pos)) {
+        // iterate over symbol intervals
+        for (int interval = 0; interval < nr_intervals; interval++) {
+            if (!budget_check(budget)) {
+                over_budget = 1;
+                break;
+            }
             int end_state_marker = 0;
-            char symbol = symbols[symbol_iterator];
+            int lo = intervals[2 * interval];
+            int hi = intervals[2 * interval + 1];
 
             // accumulate all possible next states
-            int* next_states = NULL;
             int nr_next_states = 0;
+            generation++;
 
             vector* current_state_set;
             vector_get_at(state_sets, state_pos, &current_state_set);
@@ -790,48 +956,24 @@ static int nfa_to_dfa(regex* r) {
             // iterate over all old states that belong to the current
             // combined state
             while (vector_next(current_state_set, &state_nr)) {
-                // find all next states with the current symbol
+                // find all next states with the current interval
                 for (int transition_iterator = 0;
                      transition_iterator < r->states[state_nr]->nr_transitions;
                      transition_iterator++) {
-                    if (r->states[state_nr]
-                                ->transitions[transition_iterator]
-                                ->symbol == symbol &&
-                        r->states[state_nr]
-                                ->transitions[transition_iterator]
-                                ->status == ts_active) {
-                        int already_there = 0;
-                        // check if the next_state is already contained in
+                    transition* t =
+                        r->states[state_nr]->transitions[transition_iterator];
+                    if (t->status == ts_active && t->lo <= lo &&
+                        hi <= t->hi) {
+                        // skip the next_state if it is already contained in
                         // next_states
-                        for (int next_states_iterator = 0;
-                             next_states_iterator < nr_next_states;
-                             next_states_iterator++) {
-                            if (r->states[state_nr]
-                                    ->transitions[transition_iterator]
-                                    ->next_state ==
-                                next_states[next_states_iterator]) {
-                                already_there = 1;
-                                break;
-                            }
-                        }
-                        if (!already_there) {
-                            next_states = realloc(
-                                next_states, ++nr_next_states * sizeof(int));
-                            next_states[nr_next_states - 1] =
-                                r->states[state_nr]
-                                    ->transitions[transition_iterator]
-                                    ->next_state;
+                        if (added_in[t->next_state] != generation) {
+                            added_in[t->next_state] = generation;
+                            next_states[nr_next_states++] = t->next_state;
 
                             // check if it is an end state -> must be marked
                             // in the new state
-                            if (r->states[r->states[state_nr]
-                                              ->transitions[transition_iterator]
-                                              ->next_state]
-                                        ->type == st_end ||
-                                r->states[r->states[state_nr]
-                                              ->transitions[transition_iterator]
-                                              ->next_state]
-                                        ->type == st_start_end) {
+                            state_type type = r->states[t->next_state]->type;
+                            if (type == st_end || type == st_start_end) {
                                 end_state_marker = 1;
                             }
                         }
@@ -840,35 +982,21 @@ static int nfa_to_dfa(regex* r) {
             }
 
             if (!nr_next_states) {
-                free(next_states);
                 continue;
             }
 
             sort_int_array(next_states, nr_next_states);
 
             // check if this combination of old states already exists
-            int exists = -1;
-
-            for (int j = 0; j < nr_state_sets; j++) {
-                vector* temp_state_set;
-                vector_get_at(state_sets, j, &temp_state_set);
-                int nr_states_comp = temp_state_set->size;
-                vector* state_set_comp;
-                vector_get_at(state_sets, j, &state_set_comp);
-                if (nr_states_comp == nr_next_states) {
-                    exists = j;
-                    for (int k = 0; k < nr_next_states; k++) {
-                        int state_comp;
-                        vector_get_at(state_set_comp, k, &state_comp);
-                        if (next_states[k] != state_comp) {
-                            exists = -1;
-                            break;
-                        }
-                    }
-                    if (exists > -1) {
-                        break; // found the state
-                    }
-                }
+            unsigned int hash = hash_state_set(next_states, nr_next_states);
+            int exists = find_state_set(&index, state_sets, next_states,
+                                        nr_next_states, hash);
+
+            // state is new, but the budget is used up
+            if (exists < 0 && max_states >= 0 &&
+                nr_state_sets >= max_states) {
+                over_budget = 1;
+                break;
             }
 
             // state is new and needs to be created
@@ -897,6 +1025,7 @@ static int nfa_to_dfa(regex* r) {
                     }
                 }
                 vector_push(state_sets, &v_next_states);
+                add_state_set(&index, hash);
 
 
                 state* created_state = new_state(
@@ -917,36 +1046,56 @@ static int nfa_to_dfa(regex* r) {
                 stack_push(s, &exists);
             }
 
-            // now the current state can be linked to the created next_state
+            // now the current state can be linked to the created next_state;
+            // adjacent byte intervals with the same next_state share one
+            // transition, the anchors always get their own
             state* current_state;
             vector_get_at(states, state_pos, &current_state);
-            current_state->transitions = realloc(
-                current_state->transitions,
-                ++(current_state->nr_transitions) * sizeof(transition*));
-            current_state->transitions[current_state->nr_transitions - 1] =
-                new_transition(ts_active, symbol, exists);
+            transition* last =
+                current_state->nr_transitions
+                    ? current_state->transitions[current_state->nr_transitions -
+                                                 1]
+                    : NULL;
+            if (last != NULL && last->next_state == exists &&
+                last->hi + 1 == lo && hi < 256) {
+                last->hi = hi;
+            } else {
+                current_state->transitions = counted_realloc(
+                    current_state->transitions,
+                    ++(current_state->nr_transitions) * sizeof(transition*));
+                current_state->transitions[current_state->nr_transitions - 1] =
+                    new_transition(ts_active, lo, hi, exists);
+            }
             vector_set_at(states, state_pos, &current_state);
-
-            free(next_states);
         }
     }
 
-    // empty the old regex object
-    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
-        free_state(r->states[state_nr]);
-        free(r->states[state_nr]);
-    }
-    free(r->states);
+    if (over_budget) {
+        // drop the partial dfa, r still holds the nfa
+        state* created_state;
+        while (vector_pop(states, &created_state)) {
+            free_state(created_state);
+            counted_free(created_state);
+        }
+        delete_vector(&states);
+    } else {
+        // empty the old regex object
+        for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+            free_state(r->states[state_nr]);
+            counted_free(r->states[state_nr]);
+        }
+        counted_free(r->states);
 
-    // replace it with the new one
-    state** state_array = malloc(states->size * sizeof(state*));
-    for (int state_nr = 0; state_nr < states->size; state_nr++) {
-        vector_get_at(states, state_nr, &state_array[state_nr]);
-    }
-    delete_vector(&states);
+        // replace it with the new one
+        state** state_array = counted_malloc(states->size * sizeof(state*));
+        for (int state_nr = 0; state_nr < states->size; state_nr++) {
+            vector_get_at(states, state_nr, &state_array[state_nr]);
+        }
+        delete_vector(&states);
 
-    r->states = state_array;
-    r->nr_states = nr_state_sets;
+        r->states = state_array;
+        r->nr_states = nr_state_sets;
+    }
 
     // free resources
     for (int i = 0; i < nr_state_sets; i++) {
@@ -955,25 +1104,480 @@ static int nfa_to_dfa(regex* r) {
         delete_vector(&state_set);
     }
     delete_vector(&state_sets);
+    delete_state_set_index(&index);
     delete_stack(&s);
-    free(symbols);
+    counted_free(intervals);
+    counted_free(next_states);
+    counted_free(added_in);
+
+    return !over_budget;
+}
+
+
+// TRANSITION TABLE
+
+
+static int build_table(regex* r) {
+    /* the column of every symbol: its next state for each state */
+    int* symbol_columns[NR_SYMBOLS] = {NULL};
+    /* the distinct columns, one per class; class 0 never has a transition */
+    int* class_columns[NR_SYMBOLS + 1] = {NULL};
+
+    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+        for (int transition_nr = 0;
+             transition_nr < r->states[state_nr]->nr_transitions;
+             transition_nr++) {
+            transition* t = r->states[state_nr]->transitions[transition_nr];
+            if (t->status != ts_active) {
+                continue;
+            }
+            for (int symbol = t->lo; symbol <= t->hi; symbol++) {
+                if (symbol_columns[symbol] == NULL) {
+                    symbol_columns[symbol] =
+                        counted_malloc(r->nr_states * sizeof(int));
+                    for (int i = 0; i < r->nr_states; i++) {
+                        symbol_columns[symbol][i] = -1;
+                    }
+                }
+                /* the matcher always took the first transition of a symbol */
+                if (symbol_columns[symbol][state_nr] < 0) {
+                    symbol_columns[symbol][state_nr] = t->next_state;
+                }
+            }
+        }
+    }
+
+    /* symbols with identical columns share a class */
+    r->nr_classes = 1;
+    memset(r->symbol_class, 0, sizeof(r->symbol_class));
+    for (int symbol = 0; symbol < NR_SYMBOLS; symbol++) {
+        if (symbol_columns[symbol] == NULL) {
+            continue;
+        }
+        int class_nr;
+        for (class_nr = 1; class_nr < r->nr_classes; class_nr++) {
+            if (!memcmp(class_columns[class_nr], symbol_columns[symbol],
+                        r->nr_states * sizeof(int))) {
+                break;
+            }
+        }
+        if (class_nr == r->nr_classes) {
+            class_columns[r->nr_classes++] = symbol_columns[symbol];
+        } else {
+            counted_free(symbol_columns[symbol]);
+        }
+        r->symbol_class[symbol] = class_nr;
+    }
+
+    /* write the table row by row */
+    r->table = counted_malloc(r->nr_states * r->nr_classes * sizeof(int));
+    r->state_flags = counted_malloc(r->nr_states * sizeof(unsigned char));
+    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+        int* row = r->table + state_nr * r->nr_classes;
+        row[0] = -1;
+        for (int class_nr = 1; class_nr < r->nr_classes; class_nr++) {
+            row[class_nr] = class_columns[class_nr][state_nr];
+        }
+
+        r->state_flags[state_nr] = 0;
+        if (r->states[state_nr]->type == st_end ||
+            r->states[state_nr]->type == st_start_end) {
+            r->state_flags[state_nr] |= sf_end;
+        }
+        if (r->states[state_nr]->behaviour == sb_greedy) {
+            r->state_flags[state_nr] |= sf_greedy;
+        }
+    }
+
+    /* states like the one of [^"]* stay on most bytes */
+    r->escapes = counted_calloc(r->nr_states, REGEX_MAX_ESCAPES + 1);
+    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+        const int* row = r->table + state_nr * r->nr_classes;
+        unsigned char* escapes =
+            r->escapes + state_nr * (REGEX_MAX_ESCAPES + 1);
+        int nr_escapes = 0;
+        for (int c = 0; c < 256 && nr_escapes <= REGEX_MAX_ESCAPES; c++) {
+            if (row[r->symbol_class[c]] != state_nr) {
+                if (nr_escapes < REGEX_MAX_ESCAPES) {
+                    escapes[1 + nr_escapes] = c;
+                }
+                nr_escapes++;
+            }
+        }
+        if (nr_escapes <= REGEX_MAX_ESCAPES) {
+            escapes[0] = nr_escapes;
+            r->state_flags[state_nr] |= sf_loop;
+        }
+    }
+
+    for (int class_nr = 1; class_nr < r->nr_classes; class_nr++) {
+        counted_free(class_columns[class_nr]);
+    }
 
     return 1;
 }
 
 
-static void string_subtract(vector* a, vector* b) {
-    vector_reset_iterator(b);
-    char comp_char;
-    while (vector_next(b, &comp_char)) {
-        vector_reset_iterator(a);
-        char current_char;
-        while (vector_next(a, &current_char)) {
-            if (current_char == comp_char && current_char != 0) {
-                a->iterator--;
-                vector_remove(a);
-                vector_next(a, &current_char);
+/* checks if the start state of the matcher of r has a transition on symbol */
+static int start_state_reads(regex* r, int symbol) {
+    if (r->table != NULL) {
+        return r->table[r->symbol_class[symbol]] >= 0;
+    }
+    if (r->nfa != NULL) {
+        int class_nr = r->nfa->symbol_class[symbol];
+        return r->nfa->offsets[class_nr] < r->nfa->offsets[class_nr + 1];
+    }
+    return r->positions != NULL &&
+           (r->positions->follow[1] & r->positions->symbol_mask[symbol]);
+}
+
+
+/* a regex is anchored if its start state can only be left by LINE_START: every
+ * match must then start at a line start and restarting in the middle of a
+ * line is pointless */
+static int is_anchored(regex* r) {
+    for (int symbol = 0; symbol < NR_SYMBOLS; symbol++) {
+        if (symbol != LINE_START && start_state_reads(r, symbol)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static regex_start_bytes* new_start_bytes(regex* r) {
+    regex_start_bytes* b = counted_calloc(1, sizeof(regex_start_bytes));
+    for (int c = 0; c < 256; c++) {
+        if (!start_state_reads(r, c)) {
+            continue;
+        }
+        if (b->nr_bytes < REGEX_MAX_ESCAPES) {
+            b->bytes[b->nr_bytes] = c;
+        }
+        b->nr_bytes++;
+        b->member[c] = 1;
+        b->nibble_masks[c >> 7][c & 15] |= 1 << ((c >> 4) & 7);
+    }
+    if (b->nr_bytes == 256) {
+        counted_free(b);
+        return NULL;
+    }
+    return b;
+}
+
+
+// REVERSE AUTOMATON
+
+
+/* a regex is end anchored if its end states can only be entered by LINE_END;
+ * r must still be the epsilon free nfa */
+static int is_end_anchored(regex* r) {
+    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+        for (int transition_nr = 0;
+             transition_nr < r->states[state_nr]->nr_transitions;
+             transition_nr++) {
+            transition* t = r->states[state_nr]->transitions[transition_nr];
+            state_type type = r->states[t->next_state]->type;
+            if (t->status == ts_active && t->lo != LINE_END &&
+                (type == st_end || type == st_start_end)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* stores the sorted list of states that have a transition into a state
+ * marked in member in next_states, nr_states entries per symbol interval;
+ * only for the interval of LINE_START if line_start is set, for all other
+ * intervals otherwise. interval_of maps every used symbol to its interval */
+static void collect_predecessors(regex* r,
+                                 const char* member,
+                                 int line_start,
+                                 const int* intervals,
+                                 int nr_intervals,
+                                 const int* interval_of,
+                                 int* next_states,
+                                 int* nr_next_states) {
+    for (int interval = 0; interval < nr_intervals; interval++) {
+        if ((intervals[2 * interval] == LINE_START) == line_start) {
+            nr_next_states[interval] = 0;
+        }
+    }
+
+    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+        for (int transition_nr = 0;
+             transition_nr < r->states[state_nr]->nr_transitions;
+             transition_nr++) {
+            transition* t = r->states[state_nr]->transitions[transition_nr];
+            if (t->status != ts_active || !member[t->next_state]) {
+                continue;
+            }
+            for (int interval = interval_of[t->lo];
+                 interval <= interval_of[t->hi]; interval++) {
+                int* set = next_states + interval * r->nr_states;
+                if ((intervals[2 * interval] == LINE_START) != line_start) {
+                    continue;
+                }
+                /* states are visited in order, so a duplicate is always
+                 * last */
+                if (!nr_next_states[interval] ||
+                    set[nr_next_states[interval] - 1] != state_nr) {
+                    set[nr_next_states[interval]++] = state_nr;
+                }
+            }
+        }
+    }
+}
+
+
+#define STATE_SET_MIN_BUCKETS 64
+
+
+static void new_state_set_index(state_set_index* index) {
+    index->nr_buckets = STATE_SET_MIN_BUCKETS;
+    index->nr_sets = 0;
+    index->heads = counted_malloc(index->nr_buckets * sizeof(int));
+    index->chain = counted_malloc(index->nr_buckets * sizeof(int));
+    index->hashes = counted_malloc(index->nr_buckets * sizeof(unsigned int));
+    memset(index->heads, -1, index->nr_buckets * sizeof(int));
+}
+
+
+static void delete_state_set_index(state_set_index* index) {
+    counted_free(index->heads);
+    counted_free(index->chain);
+    counted_free(index->hashes);
+}
+
+
+/* FNV-1a over the states of a set */
+static unsigned int hash_state_set(const int* set, int nr_set) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < nr_set; i++) {
+        hash = (hash ^ (unsigned int)set[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+/* the number of the set in state_sets that equals set, -1 if there is none */
+static int find_state_set(const state_set_index* index,
+                          vector* state_sets,
+                          const int* set,
+                          int nr_set,
+                          unsigned int hash) {
+    for (int j = index->heads[hash & (index->nr_buckets - 1)]; j >= 0;
+         j = index->chain[j]) {
+        vector* state_set_comp;
+        vector_get_at(state_sets, j, &state_set_comp);
+        if (index->hashes[j] == hash && state_set_comp->size == nr_set &&
+            !memcmp(state_set_comp->content, set, nr_set * sizeof(int))) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+
+/* adds the next set of the state_sets vector; the buckets double once there
+ * are as many sets as buckets */
+static void add_state_set(state_set_index* index, unsigned int hash) {
+    if (index->nr_sets == index->nr_buckets) {
+        index->nr_buckets *= 2;
+        index->heads = counted_realloc(index->heads,
+                                       index->nr_buckets * sizeof(int));
+        index->chain = counted_realloc(index->chain,
+                                       index->nr_buckets * sizeof(int));
+        index->hashes = counted_realloc(
+            index->hashes, index->nr_buckets * sizeof(unsigned int));
+        memset(index->heads, -1, index->nr_buckets * sizeof(int));
+        for (int j = 0; j < index->nr_sets; j++) {
+            int bucket = index->hashes[j] & (index->nr_buckets - 1);
+            index->chain[j] = index->heads[bucket];
+            index->heads[bucket] = j;
+        }
+    }
+    int bucket = hash & (index->nr_buckets - 1);
+    index->hashes[index->nr_sets] = hash;
+    index->chain[index->nr_sets] = index->heads[bucket];
+    index->heads[bucket] = index->nr_sets++;
+}
+
+
+/* Reads the epsilon free nfa r backwards: a state of the reverse automaton is
+ * the set of nfa states from which an end state can be reached by reading the
+ * input from the current position onwards. Since a match may end anywhere,
+ * the end states are added to the set before every step, except for the
+ * LINE_START step, which is only ever taken last: the forward matcher never
+ * checks for an end state before it has read the first symbol of a line. A
+ * match starts at a position if the set contains the start state 0. Like
+ * nfa_to_dfa(), it steps through intervals of symbols that every transition
+ * covers completely or not at all, and it finds known sets by their hash.
+ * Returns NULL beyond max_states states or once budget fails. */
+static regex*
+build_reverse(regex* r, int max_states, compile_budget* budget) {
+    vector* state_sets = new_vector(sizeof(vector*), NULL);
+    vector* states = new_vector(sizeof(state*), NULL);
+    stack* s = new_stack(sizeof(int), NULL);
+    state_set_index index;
+    /* nfa states in the current set, plus the end states */
+    char* member = counted_malloc(r->nr_states);
+    int* intervals;
+    int nr_intervals = symbol_intervals(r, &intervals);
+    int interval_of[NR_SYMBOLS];
+    /* the next set for every interval */
+    int* next_states =
+        counted_malloc((size_t)nr_intervals * r->nr_states * sizeof(int));
+    int* nr_next_states = counted_malloc(nr_intervals * sizeof(int));
+    int over_budget = 0;
+
+    for (int interval = 0; interval < nr_intervals; interval++) {
+        for (int symbol = intervals[2 * interval];
+             symbol <= intervals[2 * interval + 1]; symbol++) {
+            interval_of[symbol] = interval;
+        }
+    }
+
+    /* the empty set is the start state */
+    new_state_set_index(&index);
+    {
+        int start_state_nr = 0;
+        vector* start_state_set = new_vector(sizeof(int), NULL);
+        state* state_0 = new_state(0, sb_none, st_start);
+        vector_push(state_sets, &start_state_set);
+        vector_push(states, &state_0);
+        add_state_set(&index, hash_state_set(NULL, 0));
+        stack_push(s, &start_state_nr);
+    }
+
+    int state_pos;
+    while (!over_budget && stack_pop(s, &state_pos)) {
+        if (!budget_check(budget)) {
+            over_budget = 1;
+            break;
+        }
+        vector* current_state_set;
+        vector_get_at(state_sets, state_pos, &current_state_set);
+
+        /* the predecessors of the set for LINE_START, and of the set plus
+         * the end states for every other symbol */
+        memset(member, 0, r->nr_states);
+        vector_reset_iterator(current_state_set);
+        int state_nr;
+        while (vector_next(current_state_set, &state_nr)) {
+            member[state_nr] = 1;
+        }
+        collect_predecessors(r, member, 1, intervals, nr_intervals,
+                             interval_of, next_states, nr_next_states);
+        for (int i = 0; i < r->nr_states; i++) {
+            if (r->states[i]->type == st_end ||
+                r->states[i]->type == st_start_end) {
+                member[i] = 1;
             }
         }
+        collect_predecessors(r, member, 0, intervals, nr_intervals,
+                             interval_of, next_states, nr_next_states);
+
+        for (int interval = 0; interval < nr_intervals; interval++) {
+            int lo = intervals[2 * interval];
+            int hi = intervals[2 * interval + 1];
+            int* set = next_states + interval * r->nr_states;
+            int nr_set = nr_next_states[interval];
+            if (!nr_set) {
+                continue;
+            }
+
+            unsigned int hash = hash_state_set(set, nr_set);
+            int exists = find_state_set(&index, state_sets, set, nr_set, hash);
+
+            /* new set, but the budget is used up: give up on the reverse
+             * automaton */
+            if (exists < 0 && max_states >= 0 &&
+                state_sets->size >= max_states) {
+                over_budget = 1;
+                break;
+            }
+
+            /* new set: a match starts here if it contains the start state */
+            if (exists < 0) {
+                vector* v_set = new_vector(sizeof(int), NULL);
+                for (int i = 0; i < nr_set; i++) {
+                    vector_push(v_set, &set[i]);
+                }
+                state* created_state =
+                    new_state(0, sb_none, set[0] == 0 ? st_end : st_middle);
+                vector_push(state_sets, &v_set);
+                vector_push(states, &created_state);
+                add_state_set(&index, hash);
+                exists = state_sets->size - 1;
+                stack_push(s, &exists);
+            }
+
+            /* consecutive bytes with the same next state share a
+             * transition */
+            state* current_state;
+            vector_get_at(states, state_pos, &current_state);
+            transition* last =
+                current_state->nr_transitions
+                    ? current_state->transitions[current_state->nr_transitions -
+                                                 1]
+                    : NULL;
+            if (last != NULL && last->next_state == exists &&
+                last->hi + 1 == lo && hi < 256) {
+                last->hi = hi;
+                continue;
+            }
+            current_state->transitions = counted_realloc(
+                current_state->transitions,
+                ++(current_state->nr_transitions) * sizeof(transition*));
+            current_state->transitions[current_state->nr_transitions - 1] =
+                new_transition(ts_active, lo, hi, exists);
+        }
     }
-}
\ No newline at end of file
+
+    regex* reverse = new_empty_regex();
+    reverse->nr_states = vector_extract(states, (void**)&reverse->states);
+    if (over_budget) {
+        delete_regex(&reverse);
+    } else {
+        build_table(reverse);
+    }
+
+    vector* state_set;
+    while (vector_pop(state_sets, &state_set)) {
+        delete_vector(&state_set);
+    }
+    delete_vector(&state_sets);
+    delete_vector(&states);
+    delete_stack(&s);
+    delete_state_set_index(&index);
+    counted_free(intervals);
+    counted_free(next_states);
+    counted_free(nr_next_states);
+    counted_free(member);
+
+    return reverse;
+}
+
+
+/* The reverse automaton only finds the leftmost match start. That is all the
+ * forward matcher needs as long as no attempt can run out of input without
+ * deciding, which it does when a LINE_END leads into a state that is not an
+ * end state (only possible with a $ in the middle of the pattern). Without a
+ * table, every position entered by LINE_END must be an end state. */
+static int reverse_is_exact(regex* r) {
+    if (r->positions != NULL) {
+        const position_nfa* p = r->positions;
+        return !(p->symbol_mask[LINE_END] & ~p->end_mask);
+    }
+    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+        int next = r->table[state_nr * r->nr_classes +
+                            r->symbol_class[LINE_END]];
+        if (next >= 0 && !(r->state_flags[next] & sf_end)) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,1029 @@
+#ifndef CT_REGEX_HPP
+#define CT_REGEX_HPP
+
+#include "regex.h"
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+
+/* ct_regex<"pattern", flags> compiles a pattern that is fixed at build time
+ * while the program itself is compiled (C++20, header only, no library
+ * needed): the parser and the Glushkov construction of parse.c and
+ * glushkov.c, the subset construction and the table of compile.c, and the
+ * matcher of match.c are repeated here for constant evaluation. The table,
+ * the symbol classes and the state flags end up as constexpr arrays, so
+ * there is no startup cost at all and the compiler sees every transition the
+ * match loop can take.
+ *
+ * A ct_regex matches exactly like regex_compile_ex() with the same flags;
+ * REGEX_ICASE and REGEX_MULTILINE change what matches, REGEX_DFA and
+ * REGEX_REVERSE only how, and captures are not supported. An invalid pattern
+ * fails the build, and so does a pattern whose dfa takes the compiler past
+ * its constant evaluation limits (-fconstexpr-ops-limit and the like), where
+ * regex_compile() would fall back to the nfa. */
+
+
+/* the pattern as a template argument: ct_regex<"a+b"> */
+template <std::size_t N> struct ct_regex_pattern {
+    char chars[N] = {};
+
+    constexpr ct_regex_pattern(const char (&input)[N]) {
+        std::copy(input, input + N, chars);
+    }
+};
+
+
+/* a match of input[location] up to input[location + length - 1] */
+struct ct_match {
+    std::size_t location;
+    std::size_t length;
+};
+
+
+namespace ct_regex_detail {
+
+
+// SYNTAX TREE
+
+
+inline constexpr std::string_view escaped_symbols = "-^$()[]{}\\*+?.|";
+inline constexpr std::string_view control_symbols = "^$(|*+?{\n";
+
+/* the same limit as the parser of the library, the compiler's own limit on
+ * the depth of constant evaluation usually comes first */
+inline constexpr int max_nesting = 1000;
+
+
+/* node types of parse.h; groups are only built for captures */
+enum node_type {
+    an_symbol,
+    an_concat,
+    an_alternative,
+    an_optional,
+    an_star,
+    an_plus,
+    an_repeat
+};
+
+
+struct node {
+    node_type type;
+    int child;
+    int last;
+    int next;
+    long long nr_states;
+    int first_range;
+    int nr_ranges;
+    int min, max;
+    state_behaviour behaviour;
+};
+
+
+struct ast {
+    std::vector<node> nodes;
+    std::vector<int> ranges; /* lo and hi of every range */
+    int root = -1;
+};
+
+
+/* an open block while parsing */
+struct parse_level {
+    int concat;
+    bool alternative;
+};
+
+
+constexpr bool contains(char c, std::string_view symbols) {
+    return symbols.find(c) != std::string_view::npos;
+}
+
+
+constexpr int new_node(ast& a, node_type type, int child, long long nr_states) {
+    a.nodes.push_back({type, child, child, -1, nr_states, 0, 0, 0, 0, sb_none});
+    return (int)a.nodes.size() - 1;
+}
+
+
+constexpr void append_operand(ast& a, int parent, int child) {
+    node& p = a.nodes[parent];
+    if (p.child == -1) {
+        p.child = child;
+    } else {
+        a.nodes[p.last].next = child;
+    }
+    p.last = child;
+    p.nr_states += a.nodes[child].nr_states;
+}
+
+
+/* adds element to the block, as right operand of a pending | */
+constexpr void add_element(ast& a, parse_level& level, int element) {
+    if (!level.alternative) {
+        append_operand(a, level.concat, element);
+        return;
+    }
+
+    /* the left operand is turned into the alternative in place */
+    int left = a.nodes[level.concat].last;
+    a.nodes[level.concat].nr_states += a.nodes[element].nr_states + 1;
+    if (a.nodes[left].type != an_alternative) {
+        int moved = new_node(a, an_symbol, -1, 0);
+        a.nodes[moved] = a.nodes[left];
+        a.nodes[moved].next = -1;
+
+        node& alternative = a.nodes[left];
+        alternative.type = an_alternative;
+        alternative.child = moved;
+        alternative.last = moved;
+        alternative.behaviour = sb_none;
+    }
+    a.nodes[left].nr_states++;
+    append_operand(a, left, element);
+    level.alternative = false;
+}
+
+
+constexpr int new_symbol(ast& a, int lo, int hi) {
+    int n = new_node(a, an_symbol, -1, 2);
+    a.nodes[n].first_range = (int)a.ranges.size() / 2;
+    a.nodes[n].nr_ranges = 1;
+    a.ranges.push_back(lo);
+    a.ranges.push_back(hi);
+    return n;
+}
+
+
+/* a single symbol out of the bytes in member, one range per run of bytes */
+constexpr int new_class(ast& a, const std::array<bool, 256>& member) {
+    int n = new_node(a, an_symbol, -1, 2);
+    a.nodes[n].first_range = (int)a.ranges.size() / 2;
+
+    for (int lo = 0; lo < 256; lo++) {
+        if (!member[lo]) {
+            continue;
+        }
+        int hi = lo;
+        while (hi < 255 && member[hi + 1]) {
+            hi++;
+        }
+        a.ranges.push_back(lo);
+        a.ranges.push_back(hi);
+        a.nodes[n].nr_ranges++;
+        lo = hi;
+    }
+
+    return n;
+}
+
+
+constexpr void fold_class(std::array<bool, 256>& member) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        int upper = c - 'a' + 'A';
+        member[c] = member[upper] = member[c] || member[upper];
+    }
+}
+
+
+constexpr int new_literal(ast& a, unsigned char symbol, bool fold_case) {
+    std::array<bool, 256> member = {};
+    int lower = symbol | 0x20;
+
+    if (!fold_case || lower < 'a' || lower > 'z') {
+        return new_symbol(a, symbol, symbol);
+    }
+    member[symbol] = true;
+    fold_class(member);
+    return new_class(a, member);
+}
+
+
+/* parses the class at input[pos] up to its closing ], -1 if it is invalid */
+constexpr int
+parse_class(ast& a, const char* input, std::size_t& pos, bool fold_case) {
+    std::array<bool, 256> member = {};
+    bool inverted = false;
+
+    if (input[pos + 1] == '^') {
+        inverted = true;
+        pos++;
+    }
+
+    if (input[++pos] == ']') {
+        return -1;
+    }
+
+    while (input[pos] != ']') {
+        if (contains(input[pos], std::string_view("\n\0", 2))) {
+            return -1;
+        }
+
+        if (input[pos] == '\\' && contains(input[pos + 1], escaped_symbols)) {
+            pos++;
+            member[(unsigned char)input[pos++]] = true;
+        } else if (input[pos + 1] == '-') {
+            unsigned char lo = input[pos];
+            unsigned char hi = input[pos + 2];
+            if (contains(input[pos + 2], std::string_view("\n\0]", 3)) ||
+                lo > hi) {
+                return -1;
+            }
+            for (int c = lo; c <= hi; c++) {
+                member[c] = true;
+            }
+            pos += 3;
+        } else {
+            member[(unsigned char)input[pos++]] = true;
+        }
+    }
+
+    if (fold_case) {
+        fold_class(member);
+    }
+    if (inverted) {
+        for (bool& m : member) {
+            m = !m;
+        }
+    }
+    member['\n'] = false;
+
+    return new_class(a, member);
+}
+
+
+constexpr bool parse_bound(const char* input, std::size_t& pos, int& value) {
+    while (input[pos] != ',' && input[pos] != '}') {
+        if (input[pos] < '0' || input[pos] > '9' ||
+            value > (INT_MAX - 9) / 10) {
+            return false;
+        }
+        value = value * 10 + (input[pos++] - '0');
+    }
+    return true;
+}
+
+
+/* applies the modifier following the element at input[pos] to n */
+constexpr bool
+parse_modifier(ast& a, const char* input, std::size_t& pos, int& n) {
+    long long nr_states = a.nodes[n].nr_states;
+    node_type type = an_optional;
+
+    switch (input[pos + 1]) {
+    case '{': {
+        int min = 0;
+        int max = 0;
+        pos += 2;
+
+        if (!parse_bound(input, pos, min)) {
+            return false;
+        }
+        if (input[pos] == ',') {
+            if (input[++pos] == '}') {
+                max = min;
+            } else if (!parse_bound(input, pos, max) || input[pos] != '}') {
+                return false;
+            }
+        } else {
+            max = min;
+        }
+        pos++;
+
+        if (max < 1 || min > max || max * nr_states > INT_MAX) {
+            return false;
+        }
+        n = new_node(a, an_repeat, n, max * nr_states);
+        a.nodes[n].min = min;
+        a.nodes[n].max = max;
+        return true;
+    }
+
+    case '?':
+        type = an_optional;
+        break;
+
+    case '*':
+        type = an_star;
+        break;
+
+    case '+':
+        type = an_plus;
+        nr_states *= 2;
+        break;
+
+    default:
+        pos++;
+        return true;
+    }
+
+    n = new_node(a, type, n, nr_states);
+    if (input[pos + 2] == '?') {
+        a.nodes[n].behaviour = sb_lazy;
+        pos += 3;
+    } else {
+        a.nodes[n].behaviour = sb_greedy;
+        pos += 2;
+    }
+    return true;
+}
+
+
+/* parse_regex() of parse.c without captures */
+constexpr bool parse(ast& a, const char* input, bool fold_case) {
+    bool success = true;
+    std::size_t pos = 0;
+    std::vector<parse_level> levels = {{new_node(a, an_concat, -1, 0), false}};
+
+    /* every pattern starts with an optional start of line */
+    {
+        int line_start = new_symbol(a, LINE_START, LINE_START);
+        int optional = new_node(a, an_optional, line_start, 2);
+        append_operand(a, levels[0].concat, optional);
+    }
+
+    while (success && input[pos] != 0) {
+        int current = -1;
+        parse_level& level = levels.back();
+
+        if (!contains(input[pos], control_symbols)) {
+            switch (input[pos]) {
+            case '\\':
+                if (!contains(input[pos + 1], escaped_symbols)) {
+                    success = false;
+                } else {
+                    current =
+                        new_literal(a, (unsigned char)input[++pos], fold_case);
+                }
+                break;
+
+            case ')':
+                if (levels.size() == 1 || level.alternative ||
+                    a.nodes[level.concat].child == -1) {
+                    success = false;
+                    break;
+                }
+                current = level.concat;
+                levels.pop_back();
+                break;
+
+            case '.': {
+                std::array<bool, 256> member = {};
+                member.fill(true);
+                member['\n'] = false;
+                current = new_class(a, member);
+                break;
+            }
+
+            case '[':
+                current = parse_class(a, input, pos, fold_case);
+                success = current != -1;
+                break;
+
+            default:
+                current = new_literal(a, (unsigned char)input[pos], fold_case);
+                break;
+            }
+
+            if (success) {
+                success = parse_modifier(a, input, pos, current);
+            }
+        } else if (input[pos] == '^') {
+            pos++;
+            current = new_symbol(a, LINE_START, LINE_START);
+        } else if (input[pos] == '$') {
+            pos++;
+            current = new_symbol(a, LINE_END, LINE_END);
+        } else if (input[pos] == '(') {
+            if ((int)levels.size() > max_nesting) {
+                return false;
+            }
+            levels.push_back({new_node(a, an_concat, -1, 0), false});
+            pos++;
+        } else if (input[pos] == '|') {
+            if (a.nodes[level.concat].child == -1 || level.alternative) {
+                return false;
+            }
+            level.alternative = true;
+            pos++;
+        } else {
+            return false;
+        }
+
+        if (success && current != -1) {
+            add_element(a, levels.back(), current);
+        }
+    }
+
+    if (!success || levels.size() > 1 || levels[0].alternative) {
+        return false;
+    }
+
+    /* every pattern ends with an optional end of line */
+    int line_end = new_symbol(a, LINE_END, LINE_END);
+    int optional = new_node(a, an_optional, line_end, 2);
+    append_operand(a, levels[0].concat, optional);
+    a.root = levels[0].concat;
+    return a.nodes[a.root].nr_states <= INT_MAX;
+}
+
+
+// POSITIONS
+
+
+/* a position of the Glushkov automaton, see glushkov.c */
+struct position {
+    int node;
+    bool greedy;
+    std::vector<int> follow;
+    int mark;
+};
+
+
+struct node_sets {
+    std::vector<int> first;
+    std::vector<int> last;
+    std::vector<int> loops;
+    bool nullable = false;
+    bool greedy_entry = false;
+};
+
+
+struct glushkov {
+    const ast* a;
+    std::vector<position> positions;
+    int mark = 0;
+};
+
+
+constexpr int new_position(glushkov& g, int n) {
+    g.positions.push_back({n, false, {}, 0});
+    return (int)g.positions.size() - 1;
+}
+
+
+constexpr void append(std::vector<int>& l, const std::vector<int>& other) {
+    l.insert(l.end(), other.begin(), other.end());
+}
+
+
+/* appends the items of other that are not in l yet */
+constexpr void
+list_union(glushkov& g, std::vector<int>& l, const std::vector<int>& other) {
+    g.mark++;
+    for (int p : l) {
+        g.positions[p].mark = g.mark;
+    }
+    for (int p : other) {
+        if (g.positions[p].mark != g.mark) {
+            g.positions[p].mark = g.mark;
+            l.push_back(p);
+        }
+    }
+}
+
+
+/* every position in from is followed by the first positions of to */
+constexpr void
+link_positions(glushkov& g, const std::vector<int>& from, const node_sets& to) {
+    for (int p : from) {
+        append(g.positions[p].follow, to.first);
+        g.positions[p].greedy |= to.greedy_entry;
+    }
+}
+
+
+constexpr void visit_concat(glushkov& g, node_sets& sets, node_sets next) {
+    link_positions(g, sets.last, next);
+    if (sets.nullable) {
+        append(sets.first, next.first);
+        sets.greedy_entry |= next.greedy_entry;
+    }
+    if (next.nullable) {
+        append(next.last, sets.last);
+    }
+    sets.last = std::move(next.last);
+    sets.nullable &= next.nullable;
+}
+
+
+/* visit() of glushkov.c, which explains the behaviours */
+constexpr node_sets visit(glushkov& g,
+                          int n,
+                          state_behaviour start_behaviour,
+                          state_behaviour end_behaviour) {
+    const ast& a = *g.a;
+    const node& current = a.nodes[n];
+    node_sets sets;
+
+    state_behaviour behaviour =
+        end_behaviour != sb_none ? end_behaviour : current.behaviour;
+    state_behaviour optional_start =
+        start_behaviour != sb_none ? start_behaviour : behaviour;
+
+    switch (current.type) {
+    case an_symbol: {
+        int p = new_position(g, n);
+        sets.first.push_back(p);
+        sets.last.push_back(p);
+        sets.greedy_entry = start_behaviour == sb_greedy;
+        g.positions[p].greedy = behaviour == sb_greedy;
+        break;
+    }
+
+    case an_concat:
+        for (int child = current.child; child != -1;
+             child = a.nodes[child].next) {
+            state_behaviour end =
+                a.nodes[child].next == -1 ? behaviour : sb_none;
+            if (child == current.child) {
+                sets = visit(g, child, start_behaviour, end);
+            } else {
+                visit_concat(g, sets, visit(g, child, sb_none, end));
+            }
+        }
+        break;
+
+    case an_alternative:
+        sets.greedy_entry = start_behaviour == sb_greedy;
+        for (int child = current.child; child != -1;
+             child = a.nodes[child].next) {
+            node_sets operand = visit(g, child, sb_none, behaviour);
+            append(sets.first, operand.first);
+            append(sets.last, operand.last);
+            sets.nullable |= operand.nullable;
+            sets.greedy_entry |= operand.greedy_entry;
+        }
+        break;
+
+    case an_optional:
+        sets = visit(g, current.child, optional_start, behaviour);
+        list_union(g, sets.last, sets.loops);
+        sets.nullable = true;
+        break;
+
+    case an_star:
+        sets = visit(g, current.child, optional_start, behaviour);
+        link_positions(g, sets.last, sets);
+        list_union(g, sets.last, sets.loops);
+        sets.loops = sets.last;
+        sets.nullable = true;
+        break;
+
+    case an_plus: {
+        sets = visit(g, current.child, start_behaviour, sb_none);
+        node_sets repeat = visit(g, current.child, behaviour, behaviour);
+        link_positions(g, repeat.last, repeat);
+        list_union(g, repeat.last, repeat.loops);
+        repeat.nullable = true;
+        visit_concat(g, sets, std::move(repeat));
+        break;
+    }
+
+    case an_repeat: {
+        int optional_from = current.min > 1 ? current.min - 1 : 0;
+        sets = visit(g, current.child,
+                     current.min == 0 ? optional_start : start_behaviour,
+                     current.max == 1 ? behaviour : sb_none);
+        std::vector<int> last;
+        if (current.min == 0) {
+            append(last, sets.loops);
+        }
+        for (int copy = 1; copy < current.max; copy++) {
+            if (copy - 1 == optional_from) {
+                list_union(g, last, sets.last);
+            }
+            node_sets next =
+                visit(g, current.child,
+                      copy >= current.min ? behaviour : sb_none,
+                      copy == current.max - 1 ? behaviour : sb_none);
+            if (copy > optional_from) {
+                list_union(g, last, next.last);
+            }
+            if (copy >= current.min) {
+                list_union(g, last, next.loops);
+            }
+            visit_concat(g, sets, std::move(next));
+        }
+        if (current.max - 1 == optional_from) {
+            list_union(g, last, sets.last);
+        }
+        sets.last = std::move(last);
+        sets.nullable |= current.min == 0;
+        break;
+    }
+    }
+
+    return sets;
+}
+
+
+// DFA
+
+
+/* the symbols split into intervals at the bounds of every range, so each
+ * position is entered on either all or none of the symbols of an interval,
+ * like symbol_intervals() does; symbols in no range are left out */
+struct intervals {
+    std::vector<int> lo;
+    std::vector<int> hi;
+};
+
+
+constexpr intervals split_symbols(const ast& a) {
+    std::array<bool, NR_SYMBOLS + 1> bound = {};
+    std::array<bool, NR_SYMBOLS + 1> used = {};
+    for (std::size_t i = 0; i < a.ranges.size(); i += 2) {
+        bound[a.ranges[i]] = bound[a.ranges[i + 1] + 1] = true;
+        for (int c = a.ranges[i]; c <= a.ranges[i + 1]; c++) {
+            used[c] = true;
+        }
+    }
+
+    intervals split;
+    for (int lo = 0; lo < NR_SYMBOLS; lo++) {
+        int hi = lo;
+        while (!bound[hi + 1]) {
+            hi++;
+        }
+        if (used[lo]) {
+            split.lo.push_back(lo);
+            split.hi.push_back(hi);
+        }
+        lo = hi;
+    }
+    return split;
+}
+
+
+/* the positions of a with sf_end and sf_greedy, the positions following
+ * them, sorted and without duplicates, and the intervals entering them */
+struct position_nfa {
+    std::vector<position> positions;
+    std::vector<unsigned char> flags;
+    std::vector<std::vector<bool>> reads;
+};
+
+
+constexpr position_nfa to_positions(const ast& a, const intervals& split) {
+    glushkov g = {&a, {}, 0};
+    new_position(g, -1);
+    node_sets root = visit(g, a.root, sb_none, sb_none);
+    g.positions[0].follow = root.first;
+
+    position_nfa nfa;
+    for (position& p : g.positions) {
+        std::sort(p.follow.begin(), p.follow.end());
+        p.follow.erase(std::unique(p.follow.begin(), p.follow.end()),
+                       p.follow.end());
+        nfa.flags.push_back(p.greedy ? sf_greedy : 0);
+
+        std::vector<bool> reads(split.lo.size());
+        for (std::size_t i = 0; p.node >= 0 && i < reads.size(); i++) {
+            const node& symbol = a.nodes[p.node];
+            for (int j = 0; j < symbol.nr_ranges; j++) {
+                int range = 2 * (symbol.first_range + j);
+                reads[i] = reads[i] || (a.ranges[range] <= split.lo[i] &&
+                                        split.lo[i] <= a.ranges[range + 1]);
+            }
+        }
+        nfa.reads.push_back(std::move(reads));
+    }
+    for (int p : root.last) {
+        nfa.flags[p] |= sf_end;
+    }
+    nfa.positions = std::move(g.positions);
+    return nfa;
+}
+
+
+/* the compiled pattern, still in vectors */
+struct dfa {
+    bool valid = false;
+    int nr_states = 0;
+    int nr_classes = 0;
+    std::vector<int> table;
+    std::array<unsigned short, NR_SYMBOLS> symbol_class = {};
+    std::vector<unsigned char> state_flags;
+    bool anchored = false;
+    /* the bytes the start state reads, the first of them for find() */
+    std::array<bool, 256> start_bytes = {};
+    int nr_start_bytes = 0;
+    unsigned char start_byte = 0;
+};
+
+
+/* the subset construction of nfa_to_dfa() and the table of build_table():
+ * a dfa state is a set of positions, an end state or greedy if any of them
+ * is; intervals with the same column share a class, class 0 has none */
+constexpr dfa compile(const char* input, int flags) {
+    dfa d;
+    ast a;
+    if (!parse(a, input, flags & REGEX_ICASE)) {
+        return d;
+    }
+    intervals split = split_symbols(a);
+    position_nfa nfa = to_positions(a, split);
+    int nr_intervals = (int)split.lo.size();
+
+    /* rows[s][i] is the next state of state s on interval i; q was added to
+     * the set of state s on interval i when mark[q] is s * nr_intervals + i */
+    std::vector<std::vector<int>> sets = {{0}};
+    std::vector<std::vector<int>> rows;
+    std::vector<std::size_t> mark(nfa.positions.size(), (std::size_t)-1);
+    d.state_flags.push_back(nfa.flags[0]);
+
+    for (std::size_t s = 0; s < sets.size(); s++) {
+        std::vector<int> row(nr_intervals, -1);
+        for (int i = 0; i < nr_intervals; i++) {
+            std::size_t generation = s * nr_intervals + i;
+            std::vector<int> next;
+            unsigned char next_flags = 0;
+            for (int p : sets[s]) {
+                for (int q : nfa.positions[p].follow) {
+                    if (nfa.reads[q][i] && mark[q] != generation) {
+                        mark[q] = generation;
+                        next.push_back(q);
+                        next_flags |= nfa.flags[q];
+                    }
+                }
+            }
+            if (next.empty()) {
+                continue;
+            }
+
+            std::sort(next.begin(), next.end());
+            auto found = std::find(sets.begin(), sets.end(), next);
+            row[i] = (int)(found - sets.begin());
+            if (found == sets.end()) {
+                sets.push_back(std::move(next));
+                d.state_flags.push_back(next_flags);
+            }
+        }
+        rows.push_back(std::move(row));
+    }
+    d.nr_states = (int)sets.size();
+
+    /* intervals with identical columns share a class */
+    std::vector<int> class_interval = {-1};
+    for (int i = 0; i < nr_intervals; i++) {
+        std::size_t class_nr = 1;
+        for (; class_nr < class_interval.size(); class_nr++) {
+            bool same = true;
+            for (const auto& row : rows) {
+                same = same && row[class_interval[class_nr]] == row[i];
+            }
+            if (same) {
+                break;
+            }
+        }
+        if (class_nr == class_interval.size()) {
+            class_interval.push_back(i);
+        }
+        for (int c = split.lo[i]; c <= split.hi[i]; c++) {
+            d.symbol_class[c] = (unsigned short)class_nr;
+        }
+    }
+    d.nr_classes = (int)class_interval.size();
+
+    for (const auto& row : rows) {
+        d.table.push_back(-1);
+        for (int class_nr = 1; class_nr < d.nr_classes; class_nr++) {
+            d.table.push_back(row[class_interval[class_nr]]);
+        }
+    }
+
+    /* anchored if the start state can only be left by LINE_START */
+    d.anchored = true;
+    for (int i = 0; i < nr_intervals; i++) {
+        if (split.lo[i] != LINE_START && rows[0][i] >= 0) {
+            d.anchored = false;
+        }
+    }
+    for (int c = 255; c >= 0; c--) {
+        if (d.table[d.symbol_class[c]] >= 0) {
+            d.start_bytes[c] = true;
+            d.nr_start_bytes++;
+            d.start_byte = (unsigned char)c;
+        }
+    }
+
+    d.valid = true;
+    return d;
+}
+
+
+struct dfa_size {
+    bool valid;
+    int nr_states;
+    int nr_classes;
+};
+
+
+/* the array sizes have to be known before the tables can be filled, so the
+ * pattern is compiled twice */
+constexpr dfa_size measure(const char* input, int flags) {
+    dfa d = compile(input, flags);
+    return {d.valid, d.nr_states, d.nr_classes};
+}
+
+
+template <int NrStates, int NrClasses> struct tables {
+    using entry =
+        std::conditional_t<NrStates <= INT16_MAX, std::int16_t, std::int32_t>;
+    std::array<entry, (std::size_t)NrStates * NrClasses> table = {};
+    std::array<unsigned short, NR_SYMBOLS> symbol_class = {};
+    std::array<unsigned char, NrStates> state_flags = {};
+    bool anchored = false;
+    std::array<bool, 256> start_bytes = {};
+    int nr_start_bytes = 0;
+    unsigned char start_byte = 0;
+};
+
+
+template <int NrStates, int NrClasses>
+constexpr tables<NrStates, NrClasses> build(const char* input, int flags) {
+    tables<NrStates, NrClasses> t;
+    dfa d = compile(input, flags);
+    if (d.valid) {
+        std::copy(d.table.begin(), d.table.end(), t.table.begin());
+        t.symbol_class = d.symbol_class;
+        std::copy(d.state_flags.begin(), d.state_flags.end(),
+                  t.state_flags.begin());
+        t.anchored = d.anchored;
+        t.start_bytes = d.start_bytes;
+        t.nr_start_bytes = d.nr_start_bytes;
+        t.start_byte = d.start_byte;
+    }
+    return t;
+}
+
+
+// MATCHING
+
+
+enum walk_result { wr_running, wr_match, wr_fail, wr_exhausted };
+
+
+/* the walker of match.c, for a single attempt from start */
+struct walker {
+    std::string_view input;
+    std::size_t line_start;
+    std::size_t line_end;
+    std::size_t start;
+    std::size_t pos;
+    long checkpoint; /* -1: no checkpoint, >-1: end position */
+    int current_state;
+};
+
+
+} // namespace ct_regex_detail
+
+
+template <ct_regex_pattern Pattern, int Flags = 0> class ct_regex {
+    static constexpr ct_regex_detail::dfa_size size =
+        ct_regex_detail::measure(Pattern.chars, Flags);
+    static_assert(size.valid, "ct_regex: invalid pattern");
+    static_assert(!(Flags & REGEX_CAPTURE), "ct_regex: no captures");
+
+    static constexpr auto compiled =
+        ct_regex_detail::build<size.nr_states, size.nr_classes>(Pattern.chars,
+                                                                Flags);
+
+  public:
+    static constexpr int nr_states = size.nr_states;
+    static constexpr int nr_classes = size.nr_classes;
+
+    /* finds the first match in input like regex_match_first_n() */
+    static constexpr std::optional<ct_match>
+    match_first(std::string_view input) {
+        ct_regex_detail::walker w = {input, 0, 0, 0, 0, -1, 0};
+        ct_match match = {0, 0};
+
+        start_line(w, 0);
+        while (true) {
+            ct_regex_detail::walk_result status = step(w, match);
+            if (status == ct_regex_detail::wr_match) {
+                return match;
+            }
+            if (status != ct_regex_detail::wr_running && !restart(w, status)) {
+                return std::nullopt;
+            }
+        }
+    }
+
+  private:
+    static constexpr int next_state(int state, int symbol) {
+        int class_nr = compiled.symbol_class[symbol];
+        return compiled.table[state * nr_classes + class_nr];
+    }
+
+
+    static constexpr void start_line(ct_regex_detail::walker& w,
+                                     std::size_t line_start) {
+        w.line_start = line_start;
+        w.line_end = w.input.size();
+        if (Flags & REGEX_MULTILINE) {
+            std::size_t newline = w.input.find('\n', line_start);
+            if (newline != std::string_view::npos) {
+                w.line_end = newline;
+            }
+        }
+        w.start = line_start;
+        w.pos = line_start;
+        w.checkpoint = -1;
+        w.current_state = next_state(0, LINE_START);
+    }
+
+
+    /* the first position from start on at which the start state can read
+     * the input, end if there is none; find() searches for a single byte with
+     * memchr() */
+    static constexpr std::size_t
+    find_start(std::string_view input, std::size_t start, std::size_t end) {
+        if (compiled.nr_start_bytes == 1) {
+            std::size_t found = input.substr(0, end).find(
+                (char)compiled.start_byte, start);
+            return found != std::string_view::npos ? found : end;
+        }
+        while (start < end &&
+               !compiled.start_bytes[(unsigned char)input[start]]) {
+            start++;
+        }
+        return start;
+    }
+
+
+    /* walker_restart(): the next position the start state can read, or the
+     * next line */
+    static constexpr bool restart(ct_regex_detail::walker& w,
+                                  ct_regex_detail::walk_result status) {
+        if (status == ct_regex_detail::wr_fail && !compiled.anchored &&
+            w.start < w.line_end) {
+            w.start = find_start(w.input, w.start + 1, w.line_end);
+            w.pos = w.start;
+            w.checkpoint = -1;
+            w.current_state = 0;
+            return true;
+        }
+        if ((Flags & REGEX_MULTILINE) && w.line_end + 1 < w.input.size()) {
+            start_line(w, w.line_end + 1);
+            return true;
+        }
+        return false;
+    }
+
+
+    /* walker_step(): consumes one symbol, line_end stands for LINE_END */
+    static constexpr ct_regex_detail::walk_result
+    step(ct_regex_detail::walker& w, ct_match& match) {
+        if (w.pos > w.line_end) {
+            if (w.checkpoint > 0) {
+                match = {w.start, (std::size_t)w.checkpoint + 1 - w.start};
+                return ct_regex_detail::wr_match;
+            }
+            return ct_regex_detail::wr_exhausted;
+        }
+
+        int symbol = (w.pos == w.line_end) ? LINE_END
+                                           : (unsigned char)w.input[w.pos];
+        int temp_state = next_state(w.current_state, symbol);
+
+        if (temp_state < 0) {
+            if (w.checkpoint >= 0) {
+                match = {w.start, (std::size_t)w.checkpoint + 1 - w.start};
+                return ct_regex_detail::wr_match;
+            }
+            return ct_regex_detail::wr_fail;
+        }
+
+        if (compiled.state_flags[temp_state] & sf_end) {
+            if (w.pos == w.line_end) {
+                if (w.start == w.pos) {
+                    match = {w.line_start, 0};
+                } else {
+                    match = {w.start, w.pos - w.start};
+                }
+                return ct_regex_detail::wr_match;
+            } else if (compiled.state_flags[w.current_state] & sf_greedy) {
+                w.current_state = temp_state;
+                w.checkpoint = (long)w.pos++;
+            } else {
+                match = {w.start, w.pos + 1 - w.start};
+                return ct_regex_detail::wr_match;
+            }
+        } else {
+            w.current_state = temp_state;
+            w.pos++;
+        }
+
+        return ct_regex_detail::wr_running;
+    }
+};
+
+#endif
@@ -0,0 +1,431 @@
+#include "alloc.h"
+#include "helper_functions.h"
+#include "parse.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The Glushkov automaton of a pattern has a state for every occurrence of a
+ * symbol in the pattern, its position, plus the start state 0. Reading a
+ * symbol always enters a position, so the automaton is epsilon free from the
+ * start and all transitions into a position carry its symbols. It is built
+ * from three sets per node of the syntax tree: the positions that can be
+ * entered first, those after which the node can be left, and whether it
+ * matches the empty string; a position is followed by the first positions of
+ * everything that can come after it. Repetitions are unrolled like the
+ * emitter unrolls them, so a{2,3} has three positions.
+ *
+ * A position stands for the states the nfa of ast_to_regex() reaches after
+ * its symbol, through the epsilon transitions that follow it, and the
+ * position gets their flags: it is an end state if the pattern can end after
+ * it, and greedy if one of them is greedy. The emitter marks the end states
+ * of a ?, * or + with its behaviour, and an enclosing one that marks the same
+ * states later wins; the walk below hands these behaviours down the tree to
+ * mark the same states the same way.
+ *
+ * The nfa shares one start state between a node and the nodes it begins
+ * with, so in (c*d)? the loop of c* leads back to the start state of the ?,
+ * which ends it: c is followed by whatever follows the ?, and "ce" matches
+ * (c*d)?e. Positions that loop back to the start of a node are collected for
+ * this, and every ?, * and optional copy of a repetition can be left after
+ * them.
+ *
+ * Once the budget fails, every node is visited as if it were empty, so the
+ * walk unwinds quickly and frees what it has built. */
+
+
+/* PRIVATE TYPES */
+
+
+typedef struct {
+    int* items;
+    int size;
+    int capacity;
+} position_list;
+
+/* a position and what it leads to */
+typedef struct {
+    int node; /* the an_symbol node it was made of */
+    int greedy;
+    position_list follow;
+    int mark; /* for list_union() */
+} position;
+
+/* a node as seen from the nodes around it */
+typedef struct {
+    position_list first; /* entered with the first symbol of the node */
+    position_list last;  /* after which the node can be left */
+    position_list loops; /* leading back to the start state of the node */
+    int nullable;
+    int greedy_entry; /* entering the node passes a greedy state */
+} node_sets;
+
+typedef struct {
+    const ast* a;
+    compile_budget* budget;
+    position* positions; /* 0 is the start state */
+    int nr_positions;
+    int mark;
+} glushkov;
+
+
+/* PRIVATE FUNCTIONS */
+
+
+static long long count_positions(const ast* a, int node);
+static void
+add_state(glushkov* g, regex* r, int p, regex_compile_stats* stats);
+static node_sets visit(glushkov* g,
+                       int node,
+                       state_behaviour start_behaviour,
+                       state_behaviour end_behaviour);
+static void visit_concat(glushkov* g, node_sets* sets, node_sets next);
+static void link_positions(glushkov* g,
+                           const position_list* from,
+                           const node_sets* to);
+static int new_position(glushkov* g, int node);
+static void list_add(position_list* l, int item);
+static void list_append(position_list* l, const position_list* other);
+static void
+list_union(glushkov* g, position_list* l, const position_list* other);
+static void free_sets(node_sets* sets);
+
+
+regex* ast_to_glushkov(const ast* a,
+                       compile_budget* budget,
+                       regex_compile_stats* stats) {
+    long long nr_positions = count_positions(a, a->root) + 1;
+    if (nr_positions > INT_MAX) {
+        budget->error = re_nfa_states;
+        return NULL;
+    }
+    if (!budget_nfa_states(budget, nr_positions)) {
+        return NULL;
+    }
+
+    glushkov g = {a, budget, NULL, 0, 0};
+    new_position(&g, -1);
+    node_sets root = visit(&g, a->root, sb_none, sb_none);
+    g.positions[0].follow = root.first;
+    root.first = (position_list){NULL, 0, 0};
+
+    regex* r = budget_check(budget) ? new_empty_regex() : NULL;
+    if (r != NULL) {
+        r->nr_states = g.nr_positions;
+        r->states = counted_malloc(r->nr_states * sizeof(state*));
+        r->nr_groups = a->nr_groups;
+    }
+    for (int p = 0; p < g.nr_positions; p++) {
+        if (r != NULL && !budget_check(budget)) {
+            /* only the states before p exist */
+            r->nr_states = p;
+            delete_regex(&r);
+        }
+        if (r != NULL) {
+            add_state(&g, r, p, stats);
+        }
+        counted_free(g.positions[p].follow.items);
+    }
+
+    for (int i = 0; r != NULL && i < root.last.size; i++) {
+        r->states[root.last.items[i]]->type = st_end;
+    }
+
+    free_sets(&root);
+    counted_free(g.positions);
+    return r;
+}
+
+
+/* the positions of the nfa of node, without the start state; counts beyond
+ * INT_MAX are cut to INT_MAX + 1, so the nested repetitions of a short pattern
+ * can't overflow them */
+static long long count_positions(const ast* a, int node) {
+    const ast_node* n = &a->nodes[node];
+    long long nr_positions = n->type == an_symbol;
+    for (int child = n->child; child != -1; child = a->nodes[child].next) {
+        nr_positions += count_positions(a, child);
+        if (nr_positions > INT_MAX) {
+            return (long long)INT_MAX + 1;
+        }
+    }
+    if (n->type == an_plus) {
+        nr_positions *= 2;
+    } else if (n->type == an_repeat) {
+        nr_positions *= n->max;
+    }
+    return nr_positions > INT_MAX ? (long long)INT_MAX + 1 : nr_positions;
+}
+
+
+/* writes state p of r with a transition into every position that follows p */
+static void
+add_state(glushkov* g, regex* r, int p, regex_compile_stats* stats) {
+    const ast* a = g->a;
+    position* from = &g->positions[p];
+
+    /* nested repetitions reach a position in more than one way */
+    position_list* follow = &from->follow;
+    sort_int_array(follow->items, follow->size);
+    int size = 0;
+    for (int i = 0; i < follow->size; i++) {
+        if (!size || follow->items[size - 1] != follow->items[i]) {
+            follow->items[size++] = follow->items[i];
+        }
+    }
+    follow->size = size;
+
+    int nr_transitions = 0;
+    for (int i = 0; i < follow->size; i++) {
+        int next = follow->items[i];
+        nr_transitions += a->nodes[g->positions[next].node].nr_ranges;
+    }
+    r->states[p] = new_state(nr_transitions, from->greedy ? sb_greedy : sb_none,
+                             p ? st_middle : st_start);
+    nr_transitions = 0;
+    for (int i = 0; i < follow->size; i++) {
+        int next = follow->items[i];
+        const ast_node* symbol = &a->nodes[g->positions[next].node];
+        for (int j = 0; j < symbol->nr_ranges; j++) {
+            const int* range = a->ranges + 2 * (symbol->first_range + j);
+            r->states[p]->transitions[nr_transitions++] =
+                new_transition(ts_active, range[0], range[1], next);
+        }
+    }
+
+    if (stats != NULL) {
+        stats->max_follow = size > stats->max_follow ? size : stats->max_follow;
+        stats->total_follow += size;
+    }
+}
+
+
+// SETS OF A NODE
+
+
+/* start_behaviour is given to the start state of node by the ? and * it is
+ * the first operand of, end_behaviour to its end states by the nodes it ends;
+ * both are sb_none if no such node has a behaviour */
+static node_sets visit(glushkov* g,
+                       int node,
+                       state_behaviour start_behaviour,
+                       state_behaviour end_behaviour) {
+    const ast* a = g->a;
+    const ast_node* n = &a->nodes[node];
+    node_sets sets = {{NULL, 0, 0}, {NULL, 0, 0}, {NULL, 0, 0}, 0, 0};
+    if (!budget_check(g->budget)) {
+        return sets;
+    }
+
+    /* the behaviour of the end states of node: the outermost node marking
+     * them wins */
+    state_behaviour behaviour =
+        end_behaviour != sb_none ? end_behaviour : n->behaviour;
+    /* the start state of a ?, * or + is an end state as well */
+    state_behaviour optional_start =
+        start_behaviour != sb_none ? start_behaviour : behaviour;
+
+    switch (n->type) {
+    case an_symbol: {
+        int p = new_position(g, node);
+        list_add(&sets.first, p);
+        list_add(&sets.last, p);
+        sets.greedy_entry = start_behaviour == sb_greedy;
+        g->positions[p].greedy = behaviour == sb_greedy;
+        break;
+    }
+
+    /* only the last operand ends the concatenation */
+    case an_concat:
+        for (int child = n->child; child != -1; child = a->nodes[child].next) {
+            state_behaviour end =
+                a->nodes[child].next == -1 ? behaviour : sb_none;
+            if (child == n->child) {
+                sets = visit(g, child, start_behaviour, end);
+            } else {
+                visit_concat(g, &sets, visit(g, child, sb_none, end));
+            }
+        }
+        break;
+
+    /* the start states of the alternatives only lead into the operands */
+    case an_alternative:
+        sets.greedy_entry = start_behaviour == sb_greedy;
+        for (int child = n->child; child != -1; child = a->nodes[child].next) {
+            node_sets operand = visit(g, child, sb_none, behaviour);
+            list_append(&sets.first, &operand.first);
+            list_append(&sets.last, &operand.last);
+            sets.nullable |= operand.nullable;
+            sets.greedy_entry |= operand.greedy_entry;
+            free_sets(&operand);
+        }
+        break;
+
+    /* the operand is entered from the start state of the group and leaves to
+     * its end state, which alone ends the group */
+    case an_group:
+        sets = visit(g, n->child, sb_none, sb_none);
+        sets.loops.size = 0;
+        if (behaviour == sb_greedy) {
+            for (int i = 0; i < sets.last.size; i++) {
+                g->positions[sets.last.items[i]].greedy = 1;
+            }
+        }
+        sets.greedy_entry = start_behaviour == sb_greedy ||
+                            sets.greedy_entry ||
+                            (sets.nullable && behaviour == sb_greedy);
+        break;
+
+    case an_optional:
+        sets = visit(g, n->child, optional_start, behaviour);
+        list_union(g, &sets.last, &sets.loops);
+        sets.nullable = 1;
+        break;
+
+    /* the end states of a lead back to the start state */
+    case an_star:
+        sets = visit(g, n->child, optional_start, behaviour);
+        link_positions(g, &sets.last, &sets);
+        list_union(g, &sets.last, &sets.loops);
+        sets.loops.size = 0;
+        list_append(&sets.loops, &sets.last);
+        sets.nullable = 1;
+        break;
+
+    /* a+ is a followed by a copy of a* that ends it */
+    case an_plus: {
+        sets = visit(g, n->child, start_behaviour, sb_none);
+        node_sets repeat = visit(g, n->child, behaviour, behaviour);
+        link_positions(g, &repeat.last, &repeat);
+        list_union(g, &repeat.last, &repeat.loops);
+        repeat.nullable = 1;
+        visit_concat(g, &sets, repeat);
+        break;
+    }
+
+    /* a{min,max} is a followed by max - 1 copies; from copy min - 1 on, the
+     * rest is optional, so the start state of every later copy is an end
+     * state and the repetition can be left after any of these copies */
+    case an_repeat: {
+        int optional_from = n->min > 1 ? n->min - 1 : 0;
+        sets = visit(g, n->child,
+                     n->min == 0 ? optional_start : start_behaviour,
+                     n->max == 1 ? behaviour : sb_none);
+        position_list last = {NULL, 0, 0};
+        if (n->min == 0) {
+            list_append(&last, &sets.loops);
+        }
+        for (int copy = 1; copy < n->max && budget_check(g->budget); copy++) {
+            if (copy - 1 == optional_from) {
+                list_union(g, &last, &sets.last);
+            }
+            node_sets next =
+                visit(g, n->child, copy >= n->min ? behaviour : sb_none,
+                      copy == n->max - 1 ? behaviour : sb_none);
+            if (copy > optional_from) {
+                list_union(g, &last, &next.last);
+            }
+            if (copy >= n->min) {
+                list_union(g, &last, &next.loops);
+            }
+            visit_concat(g, &sets, next);
+        }
+        if (n->max - 1 == optional_from) {
+            list_union(g, &last, &sets.last);
+        }
+        counted_free(sets.last.items);
+        sets.last = last;
+        sets.nullable |= n->min == 0;
+        break;
+    }
+    }
+
+    return sets;
+}
+
+
+/* appends next to the concatenation in sets, taking over next */
+static void visit_concat(glushkov* g, node_sets* sets, node_sets next) {
+    link_positions(g, &sets->last, &next);
+    if (sets->nullable) {
+        list_append(&sets->first, &next.first);
+        sets->greedy_entry |= next.greedy_entry;
+    }
+    if (next.nullable) {
+        list_append(&next.last, &sets->last);
+    }
+    counted_free(sets->last.items);
+    sets->last = next.last;
+    sets->nullable &= next.nullable;
+    counted_free(next.first.items);
+    counted_free(next.loops.items);
+}
+
+
+/* every position in from is followed by the first positions of to */
+static void link_positions(glushkov* g,
+                           const position_list* from,
+                           const node_sets* to) {
+    for (int i = 0; i < from->size && budget_check(g->budget); i++) {
+        position* p = &g->positions[from->items[i]];
+        list_append(&p->follow, &to->first);
+        p->greedy |= to->greedy_entry;
+    }
+}
+
+
+static int new_position(glushkov* g, int node) {
+    /* the array doubles whenever its size reaches a power of two */
+    if (!(g->nr_positions & (g->nr_positions - 1))) {
+        int size = g->nr_positions ? 2 * g->nr_positions : 1;
+        g->positions = counted_realloc(g->positions, size * sizeof(position));
+    }
+    g->positions[g->nr_positions] = (position){node, 0, {NULL, 0, 0}, 0};
+    return g->nr_positions++;
+}
+
+
+// POSITION LISTS
+
+
+static void list_add(position_list* l, int item) {
+    list_append(l, &(position_list){&item, 1, 1});
+}
+
+
+static void list_append(position_list* l, const position_list* other) {
+    if (other->size == 0) {
+        return;
+    }
+    if (l->size + other->size > l->capacity) {
+        l->capacity = 2 * (l->size + other->size);
+        l->items = counted_realloc(l->items, l->capacity * sizeof(int));
+    }
+    memcpy(l->items + l->size, other->items, other->size * sizeof(int));
+    l->size += other->size;
+}
+
+
+/* appends the items of other that are not in l yet */
+static void
+list_union(glushkov* g, position_list* l, const position_list* other) {
+    g->mark++;
+    for (int i = 0; i < l->size; i++) {
+        g->positions[l->items[i]].mark = g->mark;
+    }
+    for (int i = 0; i < other->size; i++) {
+        position* p = &g->positions[other->items[i]];
+        if (p->mark != g->mark) {
+            p->mark = g->mark;
+            list_add(l, other->items[i]);
+        }
+    }
+}
+
+
+static void free_sets(node_sets* sets) {
+    counted_free(sets->first.items);
+    counted_free(sets->last.items);
+    counted_free(sets->loops.items);
+}
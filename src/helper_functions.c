@@ -15,18 +15,36 @@ int contains(const char a, const char* b, int length) {
 }
 
 
+static int compare_int(const void* a, const void* b) {
+    int int_a = *(const int*)a;
+    int int_b = *(const int*)b;
+    return (int_a > int_b) - (int_a < int_b);
+}
+
+
 int sort_int_array(int* array, int size) {
-    int changes = 1;
-    while (changes > 0) {
-        changes = 0;
-        for (int i = 0; i < size - 1; i++) {
-            if (array[i] > array[i + 1]) {
-                int temp = array[i];
-                array[i] = array[i + 1];
-                array[i + 1] = temp;
-                changes++;
-            }
-        }
+    if (size > 1) {
+        qsort(array, size, sizeof(int), compare_int);
     }
     return 1;
-}
\ No newline at end of file
+}
+
+
+void deadline_in(struct timespec* deadline, double seconds) {
+    long long nanoseconds = seconds * 1e9;
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += nanoseconds / 1000000000;
+    deadline->tv_nsec += nanoseconds % 1000000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+
+int deadline_passed(const struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec ||
+           (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
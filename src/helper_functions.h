@@ -1,12 +1,21 @@
 #ifndef HELPER_FUNCTIONS_H
 #define HELPER_FUNCTIONS_H
 
+#include <time.h>
+
 
 /* checks if string b contains character a */
 int contains(const char a, const char* b, int length);
 
-/* simple bubblesort to sort a small array of size ~5 */
+/* sorts array in ascending order; follow sets of large alternations hold
+ * thousands of positions, so this is a qsort() */
 int sort_int_array(int* array, int size);
 
+/* sets deadline to seconds from now on the monotonic clock */
+void deadline_in(struct timespec* deadline, double seconds);
+
+/* checks if the monotonic clock has reached deadline */
+int deadline_passed(const struct timespec* deadline);
+
 
 #endif
\ No newline at end of file
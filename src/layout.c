@@ -0,0 +1,170 @@
+#include "alloc.h"
+#include "regex.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The dfa states are numbered in the order the subset construction found
+ * them, so the rows of the table the matcher spends its time in can lie far
+ * apart. regex_optimize_layout() runs the attempts of the matcher over a
+ * sample, counts how often every row is read and every transition taken,
+ * and renumbers the states: the start state keeps number 0, every state is
+ * followed by the successors it goes to most often, and the hottest states
+ * come first, so the rows of a typical match share a few cache lines. */
+
+
+/* a state and how often it was read, or a successor and how often it was
+ * gone to */
+typedef struct {
+    size_t visits;
+    int state_nr;
+} state_heat;
+
+
+/* PRIVATE FUNCTIONS */
+
+
+static int compare_heat(const void* a, const void* b);
+static int*
+hot_order(const regex* r, const size_t* visits, const size_t* counts);
+static void renumber_states(regex* r, const int* order);
+
+
+int regex_optimize_layout(regex* r, const char* sample, size_t sample_length) {
+    if (r->table == NULL) {
+        return 0;
+    }
+
+    size_t* visits = counted_calloc(r->nr_states, sizeof(size_t));
+    size_t* counts =
+        counted_calloc(r->nr_states * r->nr_classes, sizeof(size_t));
+    regex_profile_table(r, sample, sample_length, visits, counts);
+
+    int* order = hot_order(r, visits, counts);
+    renumber_states(r, order);
+
+    counted_free(order);
+    counted_free(visits);
+    counted_free(counts);
+    return 1;
+}
+
+
+/* hotter states first, states read equally often in their old order */
+static int compare_heat(const void* a, const void* b) {
+    const state_heat* heat_a = a;
+    const state_heat* heat_b = b;
+    if (heat_a->visits != heat_b->visits) {
+        return heat_a->visits < heat_b->visits ? 1 : -1;
+    }
+    return heat_a->state_nr - heat_b->state_nr;
+}
+
+
+/* the states of r in their new order, state 0 first: behind every placed
+ * state follow the successors it went to on the sample that are not placed
+ * yet, the most taken transition first; when no placed state has any left,
+ * the hottest remaining state goes next */
+static int*
+hot_order(const regex* r, const size_t* visits, const size_t* counts) {
+    int* order = counted_malloc(r->nr_states * sizeof(int));
+    char* placed = counted_calloc(r->nr_states, 1);
+    state_heat* by_heat = counted_malloc(r->nr_states * sizeof(state_heat));
+    state_heat* successors = counted_malloc(r->nr_classes * sizeof(state_heat));
+
+    for (int state_nr = 0; state_nr < r->nr_states; state_nr++) {
+        by_heat[state_nr].visits = visits[state_nr];
+        by_heat[state_nr].state_nr = state_nr;
+    }
+    qsort(by_heat + 1, r->nr_states - 1, sizeof(state_heat), compare_heat);
+
+    int nr_placed = 1, next_hottest = 1;
+    order[0] = 0;
+    placed[0] = 1;
+    for (int i = 0; i < r->nr_states; i++) {
+        if (i == nr_placed) {
+            while (placed[by_heat[next_hottest].state_nr]) {
+                next_hottest++;
+            }
+            order[nr_placed++] = by_heat[next_hottest].state_nr;
+            placed[by_heat[next_hottest].state_nr] = 1;
+        }
+
+        /* several classes can lead to the same successor, their transitions
+         * add up */
+        const int* row = r->table + order[i] * r->nr_classes;
+        const size_t* row_counts = counts + order[i] * r->nr_classes;
+        int nr_successors = 0;
+        for (int class_nr = 1; class_nr < r->nr_classes; class_nr++) {
+            int next = row[class_nr];
+            if (next < 0 || placed[next] || row_counts[class_nr] == 0) {
+                continue;
+            }
+            int j = 0;
+            while (j < nr_successors && successors[j].state_nr != next) {
+                j++;
+            }
+            if (j == nr_successors) {
+                successors[nr_successors].state_nr = next;
+                successors[nr_successors++].visits = 0;
+            }
+            successors[j].visits += row_counts[class_nr];
+        }
+        qsort(successors, nr_successors, sizeof(state_heat), compare_heat);
+        for (int j = 0; j < nr_successors; j++) {
+            order[nr_placed++] = successors[j].state_nr;
+            placed[successors[j].state_nr] = 1;
+        }
+    }
+
+    counted_free(successors);
+    counted_free(by_heat);
+    counted_free(placed);
+    return order;
+}
+
+
+/* moves state order[i] to number i: the rows of the table, the state flags,
+ * the escapes and the states themselves, and every transition to them */
+static void renumber_states(regex* r, const int* order) {
+    int* new_number = counted_malloc(r->nr_states * sizeof(int));
+    for (int i = 0; i < r->nr_states; i++) {
+        new_number[order[i]] = i;
+    }
+
+    int* table = counted_malloc(r->nr_states * r->nr_classes * sizeof(int));
+    unsigned char* state_flags = counted_malloc(r->nr_states);
+    unsigned char* escapes =
+        counted_malloc(r->nr_states * (REGEX_MAX_ESCAPES + 1));
+    state** states = counted_malloc(r->nr_states * sizeof(state*));
+    for (int i = 0; i < r->nr_states; i++) {
+        const int* old_row = r->table + order[i] * r->nr_classes;
+        int* row = table + i * r->nr_classes;
+        for (int class_nr = 0; class_nr < r->nr_classes; class_nr++) {
+            row[class_nr] =
+                old_row[class_nr] < 0 ? -1 : new_number[old_row[class_nr]];
+        }
+        state_flags[i] = r->state_flags[order[i]];
+        memcpy(escapes + i * (REGEX_MAX_ESCAPES + 1),
+               r->escapes + order[i] * (REGEX_MAX_ESCAPES + 1),
+               REGEX_MAX_ESCAPES + 1);
+
+        states[i] = r->states[order[i]];
+        for (int j = 0; j < states[i]->nr_transitions; j++) {
+            transition* t = states[i]->transitions[j];
+            if (t->status == ts_active) {
+                t->next_state = new_number[t->next_state];
+            }
+        }
+    }
+
+    counted_free(r->table);
+    counted_free(r->state_flags);
+    counted_free(r->escapes);
+    counted_free(r->states);
+    r->table = table;
+    r->state_flags = state_flags;
+    r->escapes = escapes;
+    r->states = states;
+    counted_free(new_number);
+}
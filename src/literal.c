@@ -0,0 +1,114 @@
+#include "alloc.h"
+#include "parse.h"
+#include "regex.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/* A large share of patterns are plain strings. Their automaton reads every
+ * byte of the input, while Boyer-Moore-Horspool compares the last byte of a
+ * window first and, on a mismatch, moves the window by the distance of that
+ * byte from the end of the literal, or by the whole length if the literal
+ * doesn't contain it, so long literals skip most of the input. */
+
+
+/* PRIVATE FUNCTIONS */
+
+
+static int literal_bytes(const ast* a, int node, unsigned char* bytes);
+
+
+regex_literal* ast_to_literal(const ast* a) {
+    /* the optional ^ and $ the parser wraps every pattern in come first and
+     * last, unless a leading | took the ^ as its left operand */
+    const ast_node* root = &a->nodes[a->root];
+    const ast_node* line_start = &a->nodes[root->child];
+    if (line_start->type != an_optional ||
+        a->nodes[line_start->child].type != an_symbol) {
+        return NULL;
+    }
+    int first = a->nodes[root->child].next;
+    if (first == root->last) {
+        return NULL;
+    }
+
+    /* counted first, since the tree of a long repetition is small, but its
+     * nfa isn't */
+    int length = 0;
+    for (int child = first; child != root->last; child = a->nodes[child].next) {
+        int child_length = literal_bytes(a, child, NULL);
+        if (child_length < 0) {
+            return NULL;
+        }
+        length += child_length;
+    }
+
+    unsigned char* bytes = counted_malloc(length);
+    length = 0;
+    for (int child = first; child != root->last; child = a->nodes[child].next) {
+        length += literal_bytes(a, child, bytes + length);
+    }
+    regex_literal* l = new_regex_literal(bytes, length);
+    counted_free(bytes);
+    return l;
+}
+
+
+/* writes the bytes node consists of to bytes, unless that is NULL, and
+ * returns their number; -1 if node is anything but a string of single bytes */
+static int literal_bytes(const ast* a, int node, unsigned char* bytes) {
+    const ast_node* n = &a->nodes[node];
+    if (n->type == an_symbol) {
+        const int* range = a->ranges + 2 * n->first_range;
+        if (n->nr_ranges != 1 || range[0] != range[1] || range[0] >= 256 ||
+            range[0] == '\n') {
+            return -1;
+        }
+        if (bytes != NULL) {
+            bytes[0] = range[0];
+        }
+        return 1;
+    }
+    if (n->type != an_concat) {
+        return -1;
+    }
+
+    int length = 0;
+    for (int child = n->child; child != -1; child = a->nodes[child].next) {
+        int child_length =
+            literal_bytes(a, child, bytes != NULL ? bytes + length : NULL);
+        if (child_length < 0) {
+            return -1;
+        }
+        length += child_length;
+    }
+    return length;
+}
+
+
+regex_literal* new_regex_literal(const unsigned char* bytes, int length) {
+    regex_literal* l = counted_malloc(sizeof(regex_literal));
+    l->length = length;
+    l->bytes = counted_malloc(length);
+    memcpy(l->bytes, bytes, length);
+
+    /* the last byte itself is left out: after a mismatch, the window has to
+     * move on to its previous occurrence */
+    for (int c = 0; c < 256; c++) {
+        l->shift[c] = length;
+    }
+    for (int i = 0; i < length - 1; i++) {
+        l->shift[bytes[i]] = length - 1 - i;
+    }
+    return l;
+}
+
+
+void delete_regex_literal(regex_literal** l) {
+    if ((*l) == NULL) {
+        return;
+    }
+    counted_free((*l)->bytes);
+    counted_free(*l);
+    *l = NULL;
+}
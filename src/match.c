@@ -1,114 +1,1295 @@
+#include "helper_functions.h"
 #include "regex.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+
+/* With -DREGEX_COUNTERS, the walker counts what it reads and how often it
+ * restarts, and every call adds that to the counters of the regex once, so
+ * the hot loop only touches the walker itself. Without it, COUNT() and TRACE()
+ * expand to nothing. */
+#ifdef REGEX_COUNTERS
+#define COUNT(statement) statement
+#define TRACE(r, event, position)                                              \
+    do {                                                                       \
+        if ((r)->trace != NULL) {                                              \
+            (r)->trace((r), (event), (position), (r)->trace_data);             \
+        }                                                                      \
+    } while (0)
+#else
+#define COUNT(statement)
+#define TRACE(r, event, position)
+#endif
+
+
+/* regex_match_first_limited() reads the clock only this often, in steps */
+#define MATCH_CLOCK_INTERVAL 1024
+
+
+/* result of a single matching attempt from a fixed start position */
+typedef enum { wr_running, wr_match, wr_fail, wr_exhausted } walk_result;
+
+
+/* what regex_profile_table() counts */
+typedef struct {
+    size_t* visits;
+    size_t* counts;
+} table_heat;
+
+
+/* state of a single matching attempt from a fixed start position */
+typedef struct {
+    regex_scratch* s; /* holds the state sets if r has no dfa */
+    const char* input;
+    size_t length;
+    size_t line_start; /* the line the attempt runs in; without */
+    size_t line_end;   /* REGEX_MULTILINE that is the whole input */
+    size_t start;
+    size_t pos;
+    long checkpoint; /* -1: no checkpoint, >-1: end position */
+    int current_state;
+    /* the limits of regex_match_first_limited() */
+    size_t limited_steps;
+    size_t max_steps;
+    size_t next_clock_check;
+    int has_deadline;
+    struct timespec deadline;
+#ifdef REGEX_COUNTERS
+    size_t nr_steps;
+    size_t nr_restarts;
+    size_t nr_prefilter_hits;
+    size_t nr_prefilter_misses;
+#endif
+} walker;
+
+
+/* without a dfa, states are sets of nfa states: 0 is the start state, 1 and
+ * 2 are the sets of the scratch; the next state always goes to the set that
+ * current_state does not use, so current_state stays valid until the walker
+ * moves on; returns -1 for the empty set */
+static int nfa_next_state(const regex* r,
+                          regex_scratch* s,
+                          int current_state,
+                          int symbol) {
+    const tagged_nfa* nfa = r->nfa;
+    int class_nr = nfa->symbol_class[symbol];
+    int next = (current_state == 1) ? 2 : 1;
+    int* set = s->sets + (next - 1) * nfa->nr_states;
+    int start_state = 0;
+    const int* current_set = &start_state;
+    int current_size = 1;
+
+    if (current_state != 0) {
+        current_set = s->sets + (current_state - 1) * nfa->nr_states;
+        current_size = s->set_sizes[current_state];
+    }
+
+    /* the dfa state would stand for the union of all next nfa states, it is
+     * an end state or greedy if any of them is */
+    s->generation++;
+    s->set_sizes[next] = 0;
+    s->set_flags[next] = 0;
+    for (int i = 0; i < current_size; i++) {
+        int offset = current_set[i] * nfa->nr_classes + class_nr;
+        for (int j = nfa->offsets[offset]; j < nfa->offsets[offset + 1]; j++) {
+            int state = nfa->transitions[j].next_state;
+            if (s->added[state] != s->generation) {
+                s->added[state] = s->generation;
+                set[s->set_sizes[next]++] = state;
+                s->set_flags[next] |= nfa->state_flags[state];
+            }
+        }
+    }
+
+    return s->set_sizes[next] ? next : -1;
+}
+
+
+/* with a position automaton, states are sets of positions just like the nfa
+ * sets: 0 is the start position, 1 and 2 the sets of the scratch */
+static inline int position_next_state(const regex* r,
+                                      regex_scratch* s,
+                                      int current_state,
+                                      int symbol) {
+    const position_nfa* p = r->positions;
+    uint64_t current = current_state ? s->position_sets[current_state] : 1;
+    uint64_t follow = 0;
+    int next = (current_state == 1) ? 2 : 1;
+
+    for (int chunk = 0; chunk < p->nr_chunks; chunk++) {
+        follow |= p->follow[chunk * 256 + ((current >> (8 * chunk)) & 0xff)];
+    }
+    s->position_sets[next] = follow & p->symbol_mask[symbol];
+
+    return s->position_sets[next] ? next : -1;
+}
 
 
 /* returns the next state or -1 on error */
-static int next_state(regex* r, int current_state, char symbol) {
-    /* iterate over all possible transitions */
-    for (int i = 0; i < r->states[current_state]->nr_transitions; i++) {
-        if (r->states[current_state]->transitions[i]->symbol == symbol) {
-            return r->states[current_state]->transitions[i]->next_state;
+static inline int next_state(const regex* r,
+                             regex_scratch* s,
+                             int current_state,
+                             int symbol) {
+    if (r->table != NULL) {
+        return r->table[current_state * r->nr_classes +
+                        r->symbol_class[symbol]];
+    }
+    if (r->positions != NULL) {
+        return position_next_state(r, s, current_state, symbol);
+    }
+    return nfa_next_state(r, s, current_state, symbol);
+}
+
+
+static inline unsigned char
+state_flags(const regex* r, regex_scratch* s, int state) {
+    if (r->table != NULL) {
+        return r->state_flags[state];
+    }
+    if (r->positions != NULL) {
+        uint64_t set = state ? s->position_sets[state] : 1;
+        return ((set & r->positions->end_mask) ? sf_end : 0) |
+               ((set & r->positions->greedy_mask) ? sf_greedy : 0);
+    }
+    return state ? s->set_flags[state] : r->nfa->state_flags[0];
+}
+
+
+/* returns the offset of the first of the nr_bytes bytes in the n bytes at
+ * input, n if there is none */
+static inline size_t find_bytes(const char* input,
+                                size_t n,
+                                const unsigned char* bytes,
+                                int nr_bytes) {
+    if (nr_bytes == 0) {
+        return n;
+    }
+    if (nr_bytes == 1) {
+        const char* found = memchr(input, bytes[0], n);
+        return found != NULL ? (size_t)(found - input) : n;
+    }
+
+    /* the last byte is repeated for two bytes */
+    unsigned char b0 = bytes[0], b1 = bytes[1], b2 = bytes[nr_bytes - 1];
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i v0 = _mm_set1_epi8(b0), v1 = _mm_set1_epi8(b1);
+    __m128i v2 = _mm_set1_epi8(b2);
+    for (; i + 16 <= n; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(input + i));
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, v0), _mm_cmpeq_epi8(chunk, v1)),
+            _mm_cmpeq_epi8(chunk, v2));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) {
+            return i + __builtin_ctz(mask);
         }
     }
-    return -1;
+#endif
+    for (; i < n; i++) {
+        unsigned char c = input[i];
+        if (c == b0 || c == b1 || c == b2) {
+            return i;
+        }
+    }
+    return n;
 }
 
 
-int regex_match_first(regex* r, char* input, int* location, int* length) {
-    int pos = 0;
-    int restart_pos = 0;
-    int current_state = 0;
-    int match_start = -1; /* -1: no partial match, >-1: start position */
-    int checkpoint = -1;  /* -1: no checkpoint, >-1: end position */
-    int success = 0;
-
-    /* copy the input to append the LINE_END symbol */
-    char* input_copy = malloc((strlen(input) + 2) * sizeof(char));
-    strcpy(input_copy, input);
-    input_copy[strlen(input)] = LINE_END;
-    input_copy[strlen(input) + 1] = 0;
-
-    /* consume an artificially produced LINE_START symbol */
-    current_state = next_state(r, current_state, LINE_START);
-
-    /* try to match until there is no more input */
-    while ((input_copy[pos] != '\0') && (!success)) {
-        int temp_state = next_state(r, current_state, input_copy[pos]);
-
-        /* no valid transition */
-        if (temp_state < 0) {
-            /* existing checkpoint: set return values and exit */
-            if (checkpoint >= 0) {
-                *location = match_start;
-                *length = checkpoint + 1 - match_start;
-                success = 1;
-                break;
+/* returns the offset of the first byte of the n bytes at input that can
+ * start a match, n if there is none */
+static inline size_t
+find_start(const regex_start_bytes* b, const char* input, size_t n) {
+    if (b->nr_bytes <= REGEX_MAX_ESCAPES) {
+        return find_bytes(input, n, b->bytes, b->nr_bytes);
+    }
+
+    size_t i = 0;
+#ifdef __SSSE3__
+    /* the low nibble of a byte picks its masks, the high bit which one, and
+     * the other three bits of the high nibble the bit in the mask */
+    __m128i masks_low = _mm_loadu_si128((const __m128i*)b->nibble_masks[0]);
+    __m128i masks_high = _mm_loadu_si128((const __m128i*)b->nibble_masks[1]);
+    __m128i bit_of = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8,
+                                   16, 32, 64, -128);
+    __m128i high_bit = _mm_set1_epi8(-128);
+    __m128i three_bits = _mm_set1_epi8(7);
+    for (; i + 16 <= n; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(input + i));
+        /* pshufb yields 0 for indices with the high bit set */
+        __m128i masks =
+            _mm_or_si128(_mm_shuffle_epi8(masks_low, chunk),
+                         _mm_shuffle_epi8(masks_high,
+                                          _mm_xor_si128(chunk, high_bit)));
+        __m128i bits = _mm_shuffle_epi8(
+            bit_of, _mm_and_si128(_mm_srli_epi16(chunk, 4), three_bits));
+        __m128i misses =
+            _mm_cmpeq_epi8(_mm_and_si128(masks, bits), _mm_setzero_si128());
+        int mask = _mm_movemask_epi8(misses) ^ 0xffff;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (i < n && !b->member[(unsigned char)input[i]]) {
+        i++;
+    }
+    return i;
+}
+
+
+/* start a new attempt at the first position of the line beginning at
+ * line_start */
+static inline void
+walker_start_line(const regex* r, walker* w, size_t line_start) {
+    w->line_start = line_start;
+    w->line_end = w->length;
+    if (r->flags & REGEX_MULTILINE) {
+        const char* newline =
+            memchr(w->input + line_start, '\n', w->length - line_start);
+        if (newline != NULL) {
+            w->line_end = newline - w->input;
+        }
+    }
+    w->start = line_start;
+    w->pos = line_start;
+    w->checkpoint = -1;
+    /* every line is preceded by an artificial LINE_START symbol */
+    w->current_state = next_state(r, w->s, 0, LINE_START);
+}
+
+
+static inline void walker_init(const regex* r,
+                               walker* w,
+                               regex_scratch* s,
+                               const char* input,
+                               size_t length) {
+    w->s = s;
+    w->input = input;
+    w->length = length;
+    w->limited_steps = 0;
+    COUNT(w->nr_steps = w->nr_restarts = 0);
+    COUNT(w->nr_prefilter_hits = w->nr_prefilter_misses = 0);
+    walker_start_line(r, w, 0);
+}
+
+
+/* moves the first attempt of w to from; unless from starts a line, it does
+ * not read LINE_START, and the line counts from there on, so an empty match
+ * at its end is reported at from; returns 1 if from starts a line */
+static int walker_start_at(const regex* r, walker* w, size_t from) {
+    if (from == 0) {
+        return 1;
+    }
+    walker_start_line(r, w, from);
+    if ((r->flags & REGEX_MULTILINE) && w->input[from - 1] == '\n') {
+        return 1;
+    }
+    w->current_state = 0;
+    return 0;
+}
+
+
+/* prepare w for the next attempt after the current one ended with status;
+ * returns 0 if there is none */
+static inline int
+walker_restart(const regex* r, walker* w, walk_result status) {
+    /* retry one position behind the last attempt, which is pointless for
+     * anchored patterns, or at the next byte the start state can read */
+    if (status == wr_fail && !r->line_start && w->start < w->line_end) {
+        w->start++;
+        if (r->start_bytes != NULL) {
+            size_t skipped = find_start(r->start_bytes, w->input + w->start,
+                                        w->line_end - w->start);
+            w->start += skipped;
+            w->limited_steps += skipped;
+            COUNT(w->nr_steps += skipped);
+        }
+        w->pos = w->start;
+        w->checkpoint = -1;
+        w->current_state = 0;
+        COUNT(w->nr_restarts++);
+        TRACE(r, rt_restart, w->start);
+        return 1;
+    }
+
+    /* otherwise continue with the next line, if there is one */
+    if ((r->flags & REGEX_MULTILINE) && w->line_end + 1 < w->length) {
+        walker_start_line(r, w, w->line_end + 1);
+        COUNT(w->nr_restarts++);
+        TRACE(r, rt_restart, w->start);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/* w has just entered an sf_loop state of the table: moves it on to the next
+ * byte that leaves the state, or to the line end, in one search */
+static inline void walker_skip(const regex* r, walker* w) {
+    const unsigned char* escapes =
+        r->escapes + w->current_state * (REGEX_MAX_ESCAPES + 1);
+    size_t skipped = find_bytes(w->input + w->pos, w->line_end - w->pos,
+                                escapes + 1, escapes[0]);
+    w->pos += skipped;
+    w->limited_steps += skipped;
+    COUNT(w->nr_steps += skipped);
+}
+
+
+/* consumes one symbol of input[start..line_end], where position line_end
+ * stands for the LINE_END symbol; the input itself is never copied or modified;
+ * returns wr_running as long as the attempt is undecided, wr_exhausted means
+ * the input ran out before the automaton could decide, which ends the search
+ * just like it did for the restart loop */
+static inline walk_result walker_step(const regex* r,
+                                      walker* w,
+                                      size_t* match_location,
+                                      size_t* match_length) {
+    if (w->pos > w->line_end) {
+        if (w->checkpoint > 0) {
+            *match_location = w->start;
+            *match_length = w->checkpoint + 1 - w->start;
+            return wr_match;
+        }
+        return wr_exhausted;
+    }
+
+    int symbol = (w->pos == w->line_end) ? LINE_END
+                                          : (unsigned char)w->input[w->pos];
+    int temp_state = next_state(r, w->s, w->current_state, symbol);
+    COUNT(w->nr_steps++);
+
+    /* no valid transition */
+    if (temp_state < 0) {
+        /* existing checkpoint: report the longest match so far */
+        if (w->checkpoint >= 0) {
+            *match_location = w->start;
+            *match_length = w->checkpoint + 1 - w->start;
+            return wr_match;
+        }
+        return wr_fail;
+    }
+
+    /* only states of the table can have sf_loop */
+    unsigned char flags = state_flags(r, w->s, temp_state);
+
+    /* end state */
+    if (flags & sf_end) {
+        /* line end must not be included in result length */
+        if (w->pos == w->line_end) {
+            if (w->start == w->pos) {
+                *match_location = w->line_start;
+                *match_length = 0;
+            } else {
+                *match_location = w->start;
+                *match_length = w->pos - w->start;
             }
-            /* reset the matching progress and retry */
-            else {
-                match_start = -1;
-                checkpoint = -1;
-                current_state = 0;
-                pos = ++restart_pos;
-                continue;
+            return wr_match;
+        }
+
+        /* greedy: try to continue, even though in an end state; a greedy
+         * loop passes an end state on every byte it skips */
+        else if (state_flags(r, w->s, w->current_state) & sf_greedy) {
+            w->current_state = temp_state;
+            w->checkpoint = w->pos++;
+            if ((flags & sf_loop) && (flags & sf_greedy)) {
+                walker_skip(r, w);
+                w->checkpoint = w->pos - 1;
             }
         }
 
-        /* end state */
-        if (r->states[temp_state]->type == st_end ||
-            r->states[temp_state]->type == st_start_end) {
-            if (match_start < 0) {
-                match_start = pos;
+        /* not greedy: set return values end exit */
+        else {
+            *match_location = w->start;
+            *match_length = w->pos + 1 - w->start;
+            return wr_match;
+        }
+    }
+
+    /* valid transition, but no end state */
+    else {
+        w->current_state = temp_state;
+        w->pos++;
+        if (flags & sf_loop) {
+            walker_skip(r, w);
+        }
+    }
+
+    return wr_running;
+}
+
+
+/* with limits: charges nr_steps steps to w before they are taken; returns 1
+ * once that exceeds the step limit or the deadline has passed */
+static int walker_over_limit(walker* w, size_t nr_steps) {
+    w->limited_steps += nr_steps;
+    if (w->limited_steps > w->max_steps) {
+        return 1;
+    }
+    if (w->has_deadline && w->limited_steps >= w->next_clock_check) {
+        w->next_clock_check = w->limited_steps + MATCH_CLOCK_INTERVAL;
+        return deadline_passed(&w->deadline);
+    }
+    return 0;
+}
+
+
+/* finds the leftmost position in the current line of w at which a match
+ * starts by reading the line backwards with the reverse automaton; returns 0
+ * if there is none */
+static int find_match_start(const regex* r, walker* w, size_t* start) {
+    const regex* reverse = r->reverse;
+    size_t pos = w->line_end;
+    int symbol = LINE_END;
+    int current_state = 0;
+    int found = 0;
+
+    while (1) {
+        current_state = next_state(reverse, NULL, current_state, symbol);
+        COUNT(w->nr_steps++);
+        /* no nfa state left: for patterns ending in $ nothing can match any
+         * more, all others can start over with the empty set */
+        if (current_state < 0) {
+            if (r->line_end) {
+                return found;
             }
+            current_state = 0;
+        }
+        if (pos == w->line_start) {
+            break;
+        }
+        if (reverse->state_flags[current_state] & sf_end) {
+            *start = pos;
+            found = 1;
+        }
+        symbol = (unsigned char)w->input[--pos];
+    }
+
+    /* an attempt at the line start reads LINE_START first */
+    current_state = next_state(reverse, NULL, current_state, LINE_START);
+    if (current_state >= 0 && (reverse->state_flags[current_state] & sf_end)) {
+        *start = w->line_start;
+        found = 1;
+    }
+
+    return found;
+}
 
-            /* line end must not be included in result length */
-            if (input_copy[pos] == LINE_END) {
-                if (match_start == pos) {
-                    *location = 0;
-                    *length = 0;
-                } else {
-                    *location = match_start;
-                    *length = pos - match_start;
+
+/* matches line by line: the reverse automaton finds where the leftmost match
+ * starts, a single forward attempt from there finds where it ends; with
+ * limited, the backward pass over a line is charged before it starts; returns
+ * -1 once the limits of w are exceeded */
+static int match_reverse(const regex* r,
+                         walker* w,
+                         size_t* location,
+                         size_t* length,
+                         int limited) {
+    do {
+        size_t start;
+        if (limited &&
+            walker_over_limit(w, w->line_end - w->line_start + 2)) {
+            return -1;
+        }
+        if (find_match_start(r, w, &start)) {
+            walk_result status;
+            COUNT(w->nr_prefilter_hits++);
+            if (start != w->line_start) {
+                w->start = start;
+                w->pos = start;
+                w->current_state = 0;
+            }
+            do {
+                if (limited && walker_over_limit(w, 1)) {
+                    return -1;
                 }
-                success = 1;
-                break;
+                status = walker_step(r, w, location, length);
+            } while (status == wr_running);
+            return status == wr_match;
+        }
+        COUNT(w->nr_prefilter_misses++);
+        TRACE(r, rt_prefilter_skip, w->line_start);
+    } while (walker_restart(r, w, wr_exhausted));
+
+    return 0;
+}
+
+
+/* finds the first occurrence of the literal of r in the input of w from the
+ * start of its attempt on */
+static int match_literal(const regex* r,
+                         walker* w,
+                         size_t* location,
+                         size_t* length) {
+    const regex_literal* l = r->literal;
+    const unsigned char* input = (const unsigned char*)w->input;
+    size_t m = l->length;
+    unsigned char last = l->bytes[m - 1];
+
+    for (size_t pos = w->start; pos + m <= w->length;) {
+        unsigned char c = input[pos + m - 1];
+        COUNT(w->nr_steps++);
+        if (c == last && !memcmp(input + pos, l->bytes, m - 1)) {
+            *location = pos;
+            *length = m;
+            return 1;
+        }
+        pos += l->shift[c];
+    }
+    return 0;
+}
+
+
+/* tries to match at every position until there is no more input; returns -1
+ * once the limits of w are exceeded, which only happens with limited */
+static int match_forward(const regex* r,
+                         walker* w,
+                         size_t* location,
+                         size_t* length,
+                         int limited) {
+    while (1) {
+        if (limited && walker_over_limit(w, 1)) {
+            return -1;
+        }
+        walk_result status = walker_step(r, w, location, length);
+        if (status == wr_match) {
+            return 1;
+        }
+        if (status != wr_running && !walker_restart(r, w, status)) {
+            return 0;
+        }
+    }
+}
+
+
+// NFA SIMULATION
+
+
+/* Without a dfa, restarting at every position would read a line again for
+ * every start, O(n^2 * m) for n bytes and m nfa states. Instead, match_nfa()
+ * runs the attempts from all start positions of a line in a single pass, like
+ * a Pike VM: every step moves the states of each attempt on by one symbol and
+ * adds a new attempt at the current position. A state reached by several
+ * attempts is only kept by the leftmost of them, so the attempts together hold
+ * at most m states and a step costs O(m). Since the leftmost attempt that
+ * matches wins, a later attempt only misses states that an earlier running
+ * attempt holds, and that one matches wherever they lead to an end state. The
+ * one thing the missing states can change is the sf_greedy bit of the later
+ * attempt: an attempt that stops at an end state because its own states are
+ * not greedy, while an earlier attempt was still running, is na_ambiguous and
+ * is walked once more on its own should it become the leftmost. That walk
+ * always ends in a match, so it happens at most once per call. */
+
+
+typedef enum {
+    na_running,
+    na_failed,
+    na_match,
+    na_ambiguous, /* matches, but where has to be walked again */
+} nfa_attempt_status;
+
+
+/* appends an attempt at start in state state_nr of the walker to the current
+ * list, which holds nr_listed states */
+static void nfa_add_attempt(const regex* r,
+                            regex_scratch* s,
+                            regex_nfa_attempt* a,
+                            int* nr_listed,
+                            size_t start,
+                            int state_nr) {
+    a->start = start;
+    a->checkpoint = -1;
+    a->first = *nr_listed;
+    a->status = na_running;
+    if (state_nr == 0) {
+        s->lists[(*nr_listed)++] = 0;
+        a->flags = r->nfa->state_flags[0];
+    } else {
+        /* the set walker_start_line() entered on LINE_START */
+        memcpy(s->lists + *nr_listed,
+               s->sets + (state_nr - 1) * r->nfa->nr_states,
+               s->set_sizes[state_nr] * sizeof(int));
+        *nr_listed += s->set_sizes[state_nr];
+        a->flags = s->set_flags[state_nr];
+    }
+    a->nr_states = *nr_listed - a->first;
+}
+
+
+/* moves attempt a on by symbol class class_nr from the current list into the
+ * next one, behind the nr_next states of the attempts before it, and decides
+ * it where walker_step() would */
+static void nfa_step_attempt(const regex* r,
+                             walker* w,
+                             regex_nfa_attempt* a,
+                             int class_nr,
+                             int earlier_running,
+                             int* nr_next) {
+    const tagged_nfa* nfa = r->nfa;
+    regex_scratch* s = w->s;
+    const int* list = s->lists;
+    int* next_list = s->lists + nfa->nr_states + 1;
+    unsigned char flags = 0;
+    int first = *nr_next;
+
+    for (int i = a->first; i < a->first + a->nr_states; i++) {
+        int offset = list[i] * nfa->nr_classes + class_nr;
+        for (int j = nfa->offsets[offset]; j < nfa->offsets[offset + 1]; j++) {
+            int state = nfa->transitions[j].next_state;
+            if (s->added[state] != s->generation) {
+                s->added[state] = s->generation;
+                next_list[(*nr_next)++] = state;
+                flags |= nfa->state_flags[state];
             }
+        }
+    }
+    a->first = first;
+    a->nr_states = *nr_next - first;
+
+    /* no valid transition: the longest match so far, if there is one */
+    if (!a->nr_states) {
+        a->status = (a->checkpoint >= 0) ? na_match : na_failed;
+        a->location = a->start;
+        a->length = a->checkpoint + 1 - a->start;
+    } else if (flags & sf_end) {
+        if (w->pos == w->line_end) {
+            a->status = na_match;
+            a->location = (a->start == w->pos) ? w->line_start : a->start;
+            a->length = w->pos - a->start;
+        } else if (a->flags & sf_greedy) {
+            a->checkpoint = w->pos;
+            a->flags = flags;
+        } else {
+            a->status = earlier_running ? na_ambiguous : na_match;
+            a->location = a->start;
+            a->length = w->pos + 1 - a->start;
+        }
+    } else {
+        a->flags = flags;
+    }
+}
+
+
+/* walks attempt a on its own from its start in state state_nr, the way
+ * match_forward() would; returns -1 once the limits of w are exceeded */
+static int nfa_walk_attempt(const regex* r,
+                            walker* w,
+                            const regex_nfa_attempt* a,
+                            int state_nr,
+                            size_t* location,
+                            size_t* length,
+                            int limited) {
+    walk_result status;
+    w->start = a->start;
+    w->pos = a->start;
+    w->checkpoint = -1;
+    w->current_state = state_nr;
+    do {
+        if (limited && walker_over_limit(w, 1)) {
+            return -1;
+        }
+        status = walker_step(r, w, location, length);
+    } while (status == wr_running);
+    return status == wr_match;
+}
+
+
+/* runs the attempts of the current line of w from its current attempt on;
+ * returns 1 with the match of the leftmost attempt that matches, 0 if none
+ * does, -1 once the limits of w are exceeded */
+static int match_nfa_line(const regex* r,
+                          walker* w,
+                          size_t* location,
+                          size_t* length,
+                          int limited) {
+    regex_scratch* s = w->s;
+    regex_nfa_attempt* attempts = s->attempts;
+    size_t first_start = w->start;
+    int first_state = w->current_state;
+    int nr_attempts = 1;
+    int nr_listed = 0;
+    /* anchored patterns only get the attempt at the line start */
+    int open = !r->line_start;
 
-            /* greedy: try to continue, even though in an end state */
-            else if (r->states[current_state]->behaviour == sb_greedy) {
-                current_state = temp_state;
-                checkpoint = pos++;
+    nfa_add_attempt(r, s, &attempts[0], &nr_listed, w->start, first_state);
+
+    for (w->pos = w->start;; w->pos++) {
+        if (w->pos > first_start && open) {
+            /* with nothing running, go straight to the next possible start */
+            if (r->start_bytes != NULL && nr_attempts == 0) {
+                size_t skipped = find_start(r->start_bytes, w->input + w->pos,
+                                            w->line_end - w->pos);
+                w->pos += skipped;
+                w->limited_steps += skipped;
+                COUNT(w->nr_steps += skipped);
             }
+            nfa_add_attempt(r, s, &attempts[nr_attempts++], &nr_listed, w->pos,
+                            0);
+            COUNT(w->nr_restarts++);
+        }
+        if (limited && walker_over_limit(w, 1)) {
+            w->start = nr_attempts ? attempts[0].start : w->pos;
+            return -1;
+        }
+        COUNT(w->nr_steps++);
+
+        int symbol = (w->pos == w->line_end) ? LINE_END
+                                              : (unsigned char)w->input[w->pos];
+        int class_nr = r->nfa->symbol_class[symbol];
+        int earlier_running = 0;
+        int nr_kept = 0;
+        int nr_next = 0;
+        s->generation++;
 
-            /* not greedy: set return values end exit */
-            else {
-                *location = match_start;
-                *length = pos + 1 - match_start;
-                success = 1;
+        /* in the order of their start, so the leftmost attempt keeps a state;
+         * once one is decided, the attempts behind it no longer matter */
+        for (int i = 0; i < nr_attempts; i++) {
+            regex_nfa_attempt a = attempts[i];
+            int running = (a.status == na_running);
+            if (running) {
+                nfa_step_attempt(r, w, &a, class_nr, earlier_running, &nr_next);
+            }
+            /* it may have held states of a later attempt before this step */
+            earlier_running |= running;
+            if (a.status == na_failed) {
+                continue;
+            }
+            attempts[nr_kept++] = a;
+            if (a.status != na_running) {
+                open = 0;
                 break;
             }
         }
+        nr_attempts = nr_kept;
+        nr_listed = nr_next;
+        memcpy(s->lists, s->lists + r->nfa->nr_states + 1,
+               nr_listed * sizeof(int));
 
-        /* valid transition, but no end state */
-        else {
-            if (match_start < 0) {
-                match_start = pos;
+        if (nr_attempts > 0 && attempts[0].status == na_ambiguous) {
+            return nfa_walk_attempt(
+                r, w, &attempts[0],
+                (attempts[0].start == first_start) ? first_state : 0,
+                location, length, limited);
+        }
+        if (nr_attempts > 0 && attempts[0].status == na_match) {
+            *location = attempts[0].location;
+            *length = attempts[0].length;
+            return 1;
+        }
+        if (w->pos == w->line_end || (nr_attempts == 0 && !open)) {
+            break;
+        }
+    }
+
+    /* the input ran out for the leftmost attempt */
+    if (nr_attempts > 0 && attempts[0].checkpoint > 0) {
+        *location = attempts[0].start;
+        *length = attempts[0].checkpoint + 1 - attempts[0].start;
+        return 1;
+    }
+    return 0;
+}
+
+
+/* match_forward() for the nfa simulation, in a single pass over every line;
+ * returns -1 once the limits of w are exceeded, which only happens with
+ * limited */
+static int match_nfa(const regex* r,
+                     walker* w,
+                     size_t* location,
+                     size_t* length,
+                     int limited) {
+    do {
+        int matched = match_nfa_line(r, w, location, length, limited);
+        if (matched) {
+            return matched;
+        }
+    } while (walker_restart(r, w, wr_exhausted));
+    return 0;
+}
+
+#ifdef REGEX_COUNTERS
+/* adds what the walker of a finished call counted to the counters of r, which
+ * are the only part of a regex that is written while matching */
+static void count_call(const regex* r, const walker* w, int matched) {
+    regex_counters* c = (regex_counters*)&r->counters;
+    __atomic_fetch_add(&c->match_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->matches, matched, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->bytes_scanned, w->nr_steps, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->restarts, w->nr_restarts, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->prefilter_hits, w->nr_prefilter_hits,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->prefilter_misses, w->nr_prefilter_misses,
+                       __ATOMIC_RELAXED);
+}
+#endif
+
+
+int regex_get_counters(const regex* r, regex_counters* counters) {
+#ifdef REGEX_COUNTERS
+    const regex_counters* c = &r->counters;
+    counters->match_calls = __atomic_load_n(&c->match_calls, __ATOMIC_RELAXED);
+    counters->matches = __atomic_load_n(&c->matches, __ATOMIC_RELAXED);
+    counters->bytes_scanned =
+        __atomic_load_n(&c->bytes_scanned, __ATOMIC_RELAXED);
+    counters->restarts = __atomic_load_n(&c->restarts, __ATOMIC_RELAXED);
+    counters->prefilter_hits =
+        __atomic_load_n(&c->prefilter_hits, __ATOMIC_RELAXED);
+    counters->prefilter_misses =
+        __atomic_load_n(&c->prefilter_misses, __ATOMIC_RELAXED);
+    return 1;
+#else
+    (void)r;
+    memset(counters, 0, sizeof(regex_counters));
+    return 0;
+#endif
+}
+
+
+void regex_reset_counters(regex* r) {
+    regex_counters* c = &r->counters;
+    __atomic_store_n(&c->match_calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->matches, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->bytes_scanned, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->restarts, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->prefilter_hits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->prefilter_misses, 0, __ATOMIC_RELAXED);
+}
+
+
+regex_scratch* new_regex_scratch(const regex* r) {
+    regex_scratch* s = malloc(sizeof(regex_scratch));
+    s->r = r;
+    s->threads = NULL;
+    s->thread_tags = NULL;
+    s->added = NULL;
+    s->generation = 0;
+    s->sets = NULL;
+    s->attempts = NULL;
+    s->lists = NULL;
+
+    /* neither the thread lists of the capture extraction nor the state sets
+     * of the nfa simulation ever need to grow */
+    size_t nr_added = 0;
+    if (r->tagged != NULL) {
+        size_t nr_states = r->tagged->nr_states;
+        s->threads = malloc(2 * nr_states * sizeof(int));
+        s->thread_tags =
+            malloc(2 * nr_states * (2 * r->nr_groups + 1) * sizeof(size_t));
+        nr_added = nr_states;
+    }
+    if (r->nfa != NULL) {
+        size_t nr_states = r->nfa->nr_states;
+        s->sets = malloc(2 * nr_states * sizeof(int));
+        /* every running attempt owns a state, the newest one may still hold
+         * the start state, and one more may wait with its match */
+        s->attempts = malloc((nr_states + 2) * sizeof(regex_nfa_attempt));
+        s->lists = malloc(2 * (nr_states + 1) * sizeof(int));
+        nr_added = nr_states > nr_added ? nr_states : nr_added;
+    }
+    if (nr_added) {
+        s->added = calloc(nr_added, sizeof(size_t));
+    }
+
+    return s;
+}
+
+
+void delete_regex_scratch(regex_scratch** s) {
+    if ((*s) == NULL) {
+        return;
+    }
+    free((*s)->threads);
+    free((*s)->thread_tags);
+    free((*s)->added);
+    free((*s)->sets);
+    free((*s)->attempts);
+    free((*s)->lists);
+    free(*s);
+    *s = NULL;
+}
+
+
+int regex_needs_scratch(const regex* r) {
+    /* the position sets fit into the scratch itself, a dfa needs none */
+    return r->table == NULL && r->positions == NULL;
+}
+
+
+int regex_match_first_n(const regex* r,
+                        regex_scratch* s,
+                        const char* input,
+                        size_t input_length,
+                        size_t* location,
+                        size_t* length) {
+    return regex_match_from(r, s, input, input_length, 0, location, length);
+}
+
+
+int regex_match_from(const regex* r,
+                     regex_scratch* s,
+                     const char* input,
+                     size_t input_length,
+                     size_t from,
+                     size_t* location,
+                     size_t* length) {
+    walker w;
+
+    if (s == NULL || s->r != r) {
+        ERROR("scratch does not belong to this regex\n");
+        return 0;
+    }
+    if (from > input_length) {
+        return 0;
+    }
+
+    /* the backward pass over a line ends at its start, so the reverse
+     * automaton only takes over at the start of a line */
+    walker_init(r, &w, s, input, input_length);
+    int line_start = walker_start_at(r, &w, from);
+    int matched;
+    if (r->literal != NULL) {
+        matched = match_literal(r, &w, location, length);
+    } else if (r->reverse != NULL && line_start) {
+        matched = match_reverse(r, &w, location, length, 0);
+    } else if (r->nfa != NULL) {
+        matched = match_nfa(r, &w, location, length, 0);
+    } else {
+        matched = match_forward(r, &w, location, length, 0);
+    }
+
+    COUNT(count_call(r, &w, matched));
+    if (matched) {
+        TRACE(r, rt_match, *location);
+    }
+    return matched;
+}
+
+
+// PROFILING
+
+
+/* Profiling has loops of its own, so the matchers above do not pay for it:
+ * before every walker_step(), heat_step() counts the row of the table the
+ * step reads and the transition it takes, and every line start counts the
+ * LINE_START transition walker_start_line() took. The bytes an sf_loop state
+ * skips with a byte search read no row and are not counted. */
+
+
+static void heat_line_start(const regex* r, table_heat* heat) {
+    heat->visits[0]++;
+    heat->counts[r->symbol_class[LINE_START]]++;
+}
+
+
+static inline void
+heat_step(const regex* r, const walker* w, table_heat* heat) {
+    if (w->pos > w->line_end) {
+        return;
+    }
+    int symbol = (w->pos == w->line_end) ? LINE_END
+                                          : (unsigned char)w->input[w->pos];
+    int state = w->current_state;
+    heat->visits[state]++;
+    heat->counts[state * r->nr_classes + r->symbol_class[symbol]]++;
+}
+
+
+/* walker_restart() with the LINE_START of a new line counted */
+static int
+heat_restart(const regex* r, walker* w, walk_result status, table_heat* heat) {
+    size_t line_start = w->line_start;
+    if (!walker_restart(r, w, status)) {
+        return 0;
+    }
+    if (w->line_start != line_start) {
+        heat_line_start(r, heat);
+    }
+    return 1;
+}
+
+
+/* match_forward() while counting heat */
+static int profile_forward(const regex* r,
+                           walker* w,
+                           size_t* location,
+                           size_t* length,
+                           table_heat* heat) {
+    while (1) {
+        heat_step(r, w, heat);
+        walk_result status = walker_step(r, w, location, length);
+        if (status == wr_match) {
+            return 1;
+        }
+        if (status != wr_running && !heat_restart(r, w, status, heat)) {
+            return 0;
+        }
+    }
+}
+
+
+/* match_reverse() while counting heat; the reverse automaton has a table of
+ * its own, which is not profiled */
+static int profile_reverse(const regex* r,
+                           walker* w,
+                           size_t* location,
+                           size_t* length,
+                           table_heat* heat) {
+    do {
+        size_t start;
+        if (find_match_start(r, w, &start)) {
+            walk_result status;
+            if (start != w->line_start) {
+                w->start = start;
+                w->pos = start;
+                w->current_state = 0;
             }
-            current_state = temp_state;
-            pos++;
+            do {
+                heat_step(r, w, heat);
+                status = walker_step(r, w, location, length);
+            } while (status == wr_running);
+            return status == wr_match;
+        }
+    } while (heat_restart(r, w, wr_exhausted, heat));
+
+    return 0;
+}
+
+
+void regex_profile_table(const regex* r,
+                         const char* input,
+                         size_t input_length,
+                         size_t* visits,
+                         size_t* counts) {
+    regex_scratch s = {.r = r};
+    table_heat heat = {visits, counts};
+    size_t from = 0, location, length;
+
+    /* the matches follow each other like those of regex_match_from() */
+    while (from <= input_length) {
+        walker w;
+        walker_init(r, &w, &s, input, input_length);
+        int line_start = walker_start_at(r, &w, from);
+        if (line_start) {
+            heat_line_start(r, &heat);
+        }
+        int matched = (r->reverse != NULL && line_start)
+                          ? profile_reverse(r, &w, &location, &length, &heat)
+                          : profile_forward(r, &w, &location, &length, &heat);
+        if (!matched) {
+            break;
+        }
+        from = location + (length ? length : 1);
+    }
+}
+
+
+int regex_match_first_limited(const regex* r,
+                              regex_scratch* s,
+                              const char* input,
+                              size_t input_length,
+                              const regex_match_limits* limits,
+                              size_t* location,
+                              size_t* length) {
+    walker w;
+
+    if (s == NULL || s->r != r) {
+        ERROR("scratch does not belong to this regex\n");
+        return 0;
+    }
+
+    walker_init(r, &w, s, input, input_length);
+    w.max_steps = limits->max_steps ? limits->max_steps : (size_t)-1;
+    w.next_clock_check = 0;
+    w.has_deadline = limits->timeout > 0;
+    if (w.has_deadline) {
+        deadline_in(&w.deadline, limits->timeout);
+    }
+
+    int matched;
+    if (r->reverse != NULL) {
+        matched = match_reverse(r, &w, location, length, 1);
+    } else if (r->nfa != NULL) {
+        matched = match_nfa(r, &w, location, length, 1);
+    } else {
+        matched = match_forward(r, &w, location, length, 1);
+    }
+
+    /* no match starts before the attempt the limit interrupted */
+    if (matched == REGEX_MATCH_LIMIT) {
+        *location = w.start;
+        *length = w.pos - w.start;
+    }
+
+    COUNT(count_call(r, &w, matched == 1));
+    if (matched == 1) {
+        TRACE(r, rt_match, *location);
+    }
+    return matched;
+}
+
+
+int regex_match_first_scratch(const regex* r,
+                              regex_scratch* s,
+                              const char* input,
+                              int* location,
+                              int* length) {
+    size_t match_location, match_length;
+
+    if (!regex_match_first_n(r, s, input, strlen(input), &match_location,
+                             &match_length)) {
+        return 0;
+    }
+
+    *location = match_location;
+    *length = match_length;
+    return 1;
+}
+
+
+int regex_match_first(const regex* r,
+                      const char* input,
+                      int* location,
+                      int* length) {
+    if (regex_needs_scratch(r)) {
+        regex_scratch* s = new_regex_scratch(r);
+        int success = regex_match_first_scratch(r, s, input, location, length);
+        delete_regex_scratch(&s);
+        return success;
+    }
+
+    regex_scratch s = {.r = r};
+    return regex_match_first_scratch(r, &s, input, location, length);
+}
+
+
+// BATCH MATCHING
+
+
+/* number of inputs that are advanced in lockstep */
+#define BATCH_LANES 8
+
+
+/* the inputs of a batch: either pointers and lengths or one buffer with
+ * offsets */
+typedef struct {
+    const char** inputs;
+    const size_t* lengths;
+    const char* buffer;
+    const size_t* offsets;
+} batch_source;
+
+
+static inline void
+batch_get(const batch_source* b, size_t i, const char** input, size_t* length) {
+    if (b->inputs != NULL) {
+        *input = b->inputs[i];
+        *length = b->lengths[i];
+    } else {
+        *input = b->buffer + b->offsets[i];
+        *length = b->offsets[i + 1] - b->offsets[i];
+    }
+}
+
+
+/* matches every input of the batch, BATCH_LANES inputs at a time in lockstep;
+ * the lanes are independent, so the table lookups of one step overlap */
+static size_t match_batch(const regex* r,
+                          const batch_source* b,
+                          size_t n,
+                          regex_batch_result* results) {
+    walker lanes[BATCH_LANES];
+    size_t lane_input[BATCH_LANES];
+    int nr_active = 0;
+    size_t next_input = 0;
+    size_t nr_matches = 0;
+
+    /* the lanes share no scratch, so without a dfa the inputs are matched
+     * one after the other; the tables of the position automaton are small
+     * enough to stay in the cache anyway */
+    if (r->table == NULL) {
+        regex_scratch* s = new_regex_scratch(r);
+        for (size_t i = 0; i < n; i++) {
+            const char* input;
+            size_t length;
+            batch_get(b, i, &input, &length);
+            results[i].success =
+                regex_match_first_n(r, s, input, length, &results[i].location,
+                                    &results[i].length);
+            nr_matches += results[i].success;
         }
+        delete_regex_scratch(&s);
+        return nr_matches;
     }
 
-    if (checkpoint > 0 && !success) {
-        *location = match_start;
-        *length = checkpoint + 1 - match_start;
-        success = 1;
+    while (nr_active > 0 || next_input < n) {
+        /* fill free lanes with new inputs */
+        while (nr_active < BATCH_LANES && next_input < n) {
+            const char* input;
+            size_t length;
+            batch_get(b, next_input, &input, &length);
+            walker_init(r, &lanes[nr_active], NULL, input, length);
+            lane_input[nr_active] = next_input;
+            results[next_input].success = 0;
+            nr_active++;
+            next_input++;
+        }
+
+        /* advance every lane by one symbol; finished lanes are replaced by the
+         * last active one */
+        for (int lane = 0; lane < nr_active; lane++) {
+            regex_batch_result* result = &results[lane_input[lane]];
+            walk_result status = walker_step(r, &lanes[lane], &result->location,
+                                             &result->length);
+
+            if (status == wr_running) {
+                continue;
+            }
+            if (status == wr_match) {
+                result->success = 1;
+                nr_matches++;
+                TRACE(r, rt_match, result->location);
+            } else if (walker_restart(r, &lanes[lane], status)) {
+                continue;
+            }
+            COUNT(count_call(r, &lanes[lane], result->success));
+
+            nr_active--;
+            lanes[lane] = lanes[nr_active];
+            lane_input[lane] = lane_input[nr_active];
+            lane--;
+        }
     }
 
-    /* cleaning up */
-    free(input_copy);
+    return nr_matches;
+}
+
+
+size_t regex_match_batch(const regex* r,
+                         const char** inputs,
+                         const size_t* lengths,
+                         size_t n,
+                         regex_batch_result* results) {
+    batch_source b = {inputs, lengths, NULL, NULL};
+    return match_batch(r, &b, n, results);
+}
+
 
-    return success;
+size_t regex_match_batch_buffer(const regex* r,
+                                const char* buffer,
+                                const size_t* offsets,
+                                size_t n,
+                                regex_batch_result* results) {
+    batch_source b = {NULL, NULL, buffer, offsets};
+    return match_batch(r, &b, n, results);
 }
@@ -0,0 +1,164 @@
+#include "regex.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Patterns can't match a '\n' (it is rejected in patterns and excluded from
+ * . and inverted classes), so a match never crosses a line boundary. Lines can
+ * therefore be matched independently and chunks that start at a line
+ * boundary need no speculation: every worker computes exactly the results a
+ * sequential scan would compute for its lines. */
+
+
+typedef struct {
+    size_t location;
+    size_t length;
+} line_match;
+
+
+/* work package of one thread: a chunk of whole lines and its results */
+typedef struct {
+    const regex* r;
+    const char* buffer;
+    size_t chunk_start;
+    size_t chunk_end;
+    line_match* matches;
+    size_t nr_matches;
+    size_t capacity;
+    int started; /* 1 if the chunk runs in a thread of its own */
+    int failed;  /* 1 if its results could not be stored */
+} chunk_job;
+
+
+/* returns 0 if there is no memory for another match; the matches collected
+ * so far are kept */
+static int push_match(chunk_job* job, size_t location, size_t length) {
+    if (job->nr_matches == job->capacity) {
+        size_t capacity = job->capacity ? job->capacity * 2 : 64;
+        line_match* matches =
+            realloc(job->matches, capacity * sizeof(line_match));
+        if (matches == NULL) {
+            return 0;
+        }
+        job->matches = matches;
+        job->capacity = capacity;
+    }
+    job->matches[job->nr_matches].location = location;
+    job->matches[job->nr_matches].length = length;
+    job->nr_matches++;
+    return 1;
+}
+
+
+/* match every line of the chunk and collect the results */
+static void* scan_chunk(void* arg) {
+    chunk_job* job = arg;
+    regex_scratch* s = new_regex_scratch(job->r);
+    size_t line_start = job->chunk_start;
+
+    while (line_start < job->chunk_end) {
+        const char* line = job->buffer + line_start;
+        const char* newline = memchr(line, '\n', job->chunk_end - line_start);
+        size_t line_length =
+            newline ? (size_t)(newline - line) : job->chunk_end - line_start;
+        size_t location, length;
+
+        if (regex_match_first_n(job->r, s, line, line_length, &location,
+                                &length) &&
+            !push_match(job, line_start + location, length)) {
+            job->failed = 1;
+            break;
+        }
+
+        line_start += line_length + 1;
+    }
+
+    delete_regex_scratch(&s);
+    return NULL;
+}
+
+
+/* returns the first position at or behind pos that starts a line */
+static size_t next_line_start(const char* buffer, size_t length, size_t pos) {
+    if (pos == 0 || pos >= length) {
+        return pos < length ? pos : length;
+    }
+    const char* newline = memchr(buffer + pos - 1, '\n', length - pos + 1);
+    return newline ? (size_t)(newline - buffer) + 1 : length;
+}
+
+
+int regex_match_parallel(const regex* r,
+                         const char* buffer,
+                         size_t length,
+                         int nr_threads,
+                         regex_match_callback callback,
+                         void* data) {
+    if (callback == NULL) {
+        ERROR("no callback given\n");
+        return 0;
+    }
+    if (nr_threads < 1) {
+        nr_threads = 1;
+    }
+
+    chunk_job* jobs = calloc(nr_threads, sizeof(chunk_job));
+    pthread_t* threads = malloc(nr_threads * sizeof(pthread_t));
+
+    /* split the buffer into chunks of roughly equal size that start and end
+     * on line boundaries */
+    for (int i = 0; i < nr_threads; i++) {
+        jobs[i].r = r;
+        jobs[i].buffer = buffer;
+        jobs[i].chunk_start =
+            next_line_start(buffer, length, length / nr_threads * i);
+        jobs[i].chunk_end =
+            (i == nr_threads - 1)
+                ? length
+                : next_line_start(buffer, length,
+                                  length / nr_threads * (i + 1));
+    }
+
+    /* the calling thread takes the first chunk itself and every chunk whose
+     * thread could not be started */
+    for (int i = 1; i < nr_threads; i++) {
+        jobs[i].started =
+            !pthread_create(&threads[i], NULL, scan_chunk, &jobs[i]);
+    }
+    for (int i = 0; i < nr_threads; i++) {
+        if (!jobs[i].started) {
+            scan_chunk(&jobs[i]);
+        }
+    }
+    for (int i = 1; i < nr_threads; i++) {
+        if (jobs[i].started) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    /* a chunk with missing results fails the whole scan before the callback
+     * has seen any match */
+    int failed = 0;
+    for (int i = 0; i < nr_threads; i++) {
+        failed |= jobs[i].failed;
+    }
+    if (failed) {
+        ERROR("out of memory while collecting matches\n");
+    }
+
+    /* stitch the results together in order */
+    for (int i = 0; i < nr_threads; i++) {
+        for (size_t j = 0; !failed && j < jobs[i].nr_matches; j++) {
+            callback(jobs[i].matches[j].location, jobs[i].matches[j].length,
+                     data);
+        }
+        free(jobs[i].matches);
+    }
+
+    free(threads);
+    free(jobs);
+
+    return !failed;
+}
@@ -0,0 +1,720 @@
+#include "alloc.h"
+#include "parse.h"
+#include "helper_functions.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* CONSTANTS */
+
+const char* ESCAPED_SYMBOLS = "-^$()[]{}\\*+?.|";
+/* every other byte matches itself; a line break can't be part of a pattern at
+ * all and is excluded from . and inverted classes, so no match ever spans a
+ * line break */
+const char* CONTROL_SYMBOLS = "^$(|*+?{\n";
+
+/* the emitter recurses into nested blocks */
+#define MAX_NESTING 1000
+
+
+/* an open block while parsing */
+typedef struct {
+    int concat;      /* the an_concat node collecting the block's elements */
+    int alternative; /* a | waits for its right operand */
+    int group;       /* the number of the group, -1 if it is not captured */
+} parse_level;
+
+
+/* an emitted node: the states start to end - 1, none of those before tail is
+ * an end state */
+typedef struct {
+    int start;
+    int end;
+    int tail;
+} fragment;
+
+
+/* PRIVATE FUNCTIONS */
+
+
+static int new_node(ast* a, ast_type type, int child, long long nr_states);
+static void append_operand(ast* a, int parent, int child);
+static void add_element(ast* a, parse_level* level, int element);
+static void add_range(ast* a, int lo, int hi);
+static int new_symbol(ast* a, int lo, int hi);
+static int new_class(ast* a, const char* member);
+static int new_literal(ast* a, unsigned char symbol, int fold_case);
+static void fold_class(char* member);
+static int parse_class(ast* a, const char* input, int* pos, int fold_case);
+static int parse_bound(const char* input, int* pos, int* value);
+static int parse_modifier(ast* a, const char* input, int* pos, int* node);
+static fragment emit(const ast* a, int node, regex* r, int base);
+static fragment emit_alternative(const ast* a, int node, regex* r, int base);
+static void add_epsilon(state* s, int next_state, unsigned int pre_tags);
+static void chain(regex* r, fragment* f, fragment g, unsigned int pre_tags);
+static void make_optional(regex* r, fragment* f);
+static void make_repeat(regex* r, fragment* f);
+static void set_behaviour(regex* r, fragment f, state_behaviour behaviour);
+
+
+int parse_regex(ast* a, const char* input, int capture, int fold_case) {
+    int success = 1;
+    int pos = 0;
+    int nr_groups = 0;
+
+    memset(a, 0, sizeof(ast));
+    a->root = -1;
+
+    int nr_levels = 1;
+    int levels_size = 8;
+    parse_level* levels = counted_malloc(levels_size * sizeof(parse_level));
+    levels[0].concat = new_node(a, an_concat, -1, 0);
+    levels[0].alternative = 0;
+    levels[0].group = -1;
+
+    /* every pattern starts with an optional start of line */
+    {
+        int line_start = new_symbol(a, LINE_START, LINE_START);
+        int optional = new_node(a, an_optional, line_start, 2);
+        append_operand(a, levels[0].concat, optional);
+    }
+
+    while (success && input[pos] != 0) {
+        int current = -1;
+        parse_level* level = &levels[nr_levels - 1];
+
+        if (!contains(input[pos], CONTROL_SYMBOLS, strlen(CONTROL_SYMBOLS))) {
+            switch (input[pos]) {
+            /* escaped character */
+            case '\\':
+                if (!contains(input[pos + 1], ESCAPED_SYMBOLS,
+                              strlen(ESCAPED_SYMBOLS))) {
+                    success = 0;
+                } else {
+                    current = new_literal(a, (unsigned char)input[++pos],
+                                          fold_case);
+                }
+                break;
+
+            /* closed block: open, without a pending | and not empty */
+            case ')':
+                if (nr_levels == 1 || level->alternative ||
+                    a->nodes[level->concat].child == -1) {
+                    success = 0;
+                    break;
+                }
+                current = level->concat;
+                if (level->group >= 0) {
+                    long long nr_states = a->nodes[current].nr_states + 2;
+                    current = new_node(a, an_group, current, nr_states);
+                    a->nodes[current].group = level->group;
+                }
+                nr_levels--;
+                break;
+
+            /* any character */
+            case '.': {
+                char member[256];
+                memset(member, 1, sizeof(member));
+                member['\n'] = 0;
+                current = new_class(a, member);
+                break;
+            }
+
+            /* character class */
+            case '[':
+                current = parse_class(a, input, &pos, fold_case);
+                success = current != -1;
+                break;
+
+            /* standard character */
+            default:
+                current = new_literal(a, (unsigned char)input[pos], fold_case);
+                break;
+            }
+
+            if (success) {
+                success = parse_modifier(a, input, &pos, &current);
+            }
+        }
+
+        /* ^ line start */
+        else if (input[pos] == '^') {
+            pos++;
+            current = new_symbol(a, LINE_START, LINE_START);
+        }
+
+        /* line end */
+        else if (input[pos] == '$') {
+            pos++;
+            current = new_symbol(a, LINE_END, LINE_END);
+        }
+
+        /* block start */
+        else if (input[pos] == '(') {
+            if (nr_levels > MAX_NESTING) {
+                success = 0;
+                break;
+            }
+            if (nr_levels == levels_size) {
+                levels_size *= 2;
+                levels =
+                    counted_realloc(levels, levels_size * sizeof(parse_level));
+            }
+            level = &levels[nr_levels++];
+            level->concat = new_node(a, an_concat, -1, 0);
+            level->alternative = 0;
+            level->group =
+                (capture && nr_groups < REGEX_MAX_GROUPS) ? nr_groups++ : -1;
+            pos++;
+        }
+
+        /* alternative: needs a left operand and binds it to the next element
+         */
+        else if (input[pos] == '|') {
+            if (a->nodes[level->concat].child == -1 || level->alternative) {
+                success = 0;
+                break;
+            }
+            level->alternative = 1;
+            pos++;
+        }
+
+        /* invalid symbol */
+        else {
+            success = 0;
+            break;
+        }
+
+        if (success && current != -1) {
+            add_element(a, &levels[nr_levels - 1], current);
+        }
+    }
+
+    if (success && (nr_levels > 1 || levels[0].alternative)) {
+        success = 0;
+    }
+
+    /* every pattern ends with an optional end of line */
+    if (success) {
+        int line_end = new_symbol(a, LINE_END, LINE_END);
+        int optional = new_node(a, an_optional, line_end, 2);
+        append_operand(a, levels[0].concat, optional);
+        a->root = levels[0].concat;
+        a->nr_groups = nr_groups;
+        /* (a{1000}){1000} and the like can't be built */
+        success = a->nodes[a->root].nr_states <= INT_MAX;
+        a->too_large = !success;
+    }
+
+    counted_free(levels);
+    return success;
+}
+
+
+regex* ast_to_regex(const ast* a) {
+    regex* r = new_empty_regex();
+    r->nr_states = a->nodes[a->root].nr_states;
+    r->states = counted_malloc(r->nr_states * sizeof(state*));
+    r->nr_groups = a->nr_groups;
+    emit(a, a->root, r, 0);
+    return r;
+}
+
+
+void free_ast(ast* a) {
+    counted_free(a->nodes);
+    counted_free(a->ranges);
+    a->nodes = NULL;
+    a->ranges = NULL;
+    a->nr_nodes = 0;
+    a->nr_ranges = 0;
+}
+
+
+// SYNTAX TREE
+
+
+/* returns the index of a new node with the single operand child, or without
+ * operands if child is -1 */
+static int new_node(ast* a, ast_type type, int child, long long nr_states) {
+    /* the array doubles whenever its size reaches a power of two */
+    if (!(a->nr_nodes & (a->nr_nodes - 1))) {
+        int size = a->nr_nodes ? 2 * a->nr_nodes : 1;
+        a->nodes = counted_realloc(a->nodes, size * sizeof(ast_node));
+    }
+
+    ast_node* n = &a->nodes[a->nr_nodes];
+    memset(n, 0, sizeof(ast_node));
+    n->type = type;
+    n->child = child;
+    n->last = child;
+    n->next = -1;
+    n->nr_states = nr_states;
+    n->behaviour = sb_none;
+    return a->nr_nodes++;
+}
+
+
+static void append_operand(ast* a, int parent, int child) {
+    ast_node* p = &a->nodes[parent];
+    if (p->child == -1) {
+        p->child = child;
+    } else {
+        a->nodes[p->last].next = child;
+    }
+    p->last = child;
+    p->nr_states += a->nodes[child].nr_states;
+}
+
+
+/* adds element to the block, as right operand of a pending | */
+static void add_element(ast* a, parse_level* level, int element) {
+    if (!level->alternative) {
+        append_operand(a, level->concat, element);
+        return;
+    }
+
+    /* the left operand is the last element, which is turned into the
+     * alternative in place; another | extends an existing alternative; every
+     * operand but the first brings a start state */
+    int left = a->nodes[level->concat].last;
+    a->nodes[level->concat].nr_states += a->nodes[element].nr_states + 1;
+    if (a->nodes[left].type != an_alternative) {
+        int moved = new_node(a, an_symbol, -1, 0);
+        a->nodes[moved] = a->nodes[left];
+        a->nodes[moved].next = -1;
+
+        ast_node* alternative = &a->nodes[left];
+        alternative->type = an_alternative;
+        alternative->child = moved;
+        alternative->last = moved;
+        alternative->behaviour = sb_none;
+    }
+    a->nodes[left].nr_states++;
+    append_operand(a, left, element);
+    level->alternative = 0;
+}
+
+
+static void add_range(ast* a, int lo, int hi) {
+    if (!(a->nr_ranges & (a->nr_ranges - 1))) {
+        int size = a->nr_ranges ? 2 * a->nr_ranges : 1;
+        a->ranges = counted_realloc(a->ranges, 2 * size * sizeof(int));
+    }
+    a->ranges[2 * a->nr_ranges] = lo;
+    a->ranges[2 * a->nr_ranges + 1] = hi;
+    a->nr_ranges++;
+}
+
+
+static int new_symbol(ast* a, int lo, int hi) {
+    int node = new_node(a, an_symbol, -1, 2);
+    a->nodes[node].first_range = a->nr_ranges;
+    a->nodes[node].nr_ranges = 1;
+    add_range(a, lo, hi);
+    return node;
+}
+
+
+/* a single symbol out of the bytes marked in member, with one range of
+ * consecutive bytes each */
+static int new_class(ast* a, const char* member) {
+    int node = new_node(a, an_symbol, -1, 2);
+    a->nodes[node].first_range = a->nr_ranges;
+
+    for (int lo = 0; lo < 256; lo++) {
+        if (!member[lo]) {
+            continue;
+        }
+        int hi = lo;
+        while (hi < 255 && member[hi + 1]) {
+            hi++;
+        }
+        add_range(a, lo, hi);
+        a->nodes[node].nr_ranges++;
+        lo = hi;
+    }
+
+    return node;
+}
+
+
+/* a single symbol, a class of both cases for letters with fold_case */
+static int new_literal(ast* a, unsigned char symbol, int fold_case) {
+    char member[256] = {0};
+    int lower = symbol | 0x20;
+
+    if (!fold_case || lower < 'a' || lower > 'z') {
+        return new_symbol(a, symbol, symbol);
+    }
+    member[symbol] = 1;
+    fold_class(member);
+    return new_class(a, member);
+}
+
+
+/* adds the other case of every ASCII letter in member */
+static void fold_class(char* member) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        int upper = c - 'a' + 'A';
+        member[c] = member[upper] = member[c] || member[upper];
+    }
+}
+
+
+/* parses the class at input[*pos] up to its closing ], returns the node or -1
+ * for an invalid class */
+static int parse_class(ast* a, const char* input, int* pos, int fold_case) {
+    char member[256] = {0};
+    int inverted = 0;
+
+    if (input[*pos + 1] == '^') {
+        inverted = 1;
+        (*pos)++;
+    }
+
+    if (input[++(*pos)] == ']') {
+        return -1;
+    }
+
+    while (input[*pos] != ']') {
+        if (contains(input[*pos], "\n\0", 2)) {
+            return -1;
+        }
+
+        /* escaped symbol */
+        if (input[*pos] == '\\' &&
+            contains(input[*pos + 1], ESCAPED_SYMBOLS,
+                     strlen(ESCAPED_SYMBOLS))) {
+            (*pos)++;
+            member[(unsigned char)input[(*pos)++]] = 1;
+        }
+
+        /* range of byte values */
+        else if (input[*pos + 1] == '-') {
+            unsigned char lo = input[*pos];
+            unsigned char hi = input[*pos + 2];
+            if (contains(input[*pos + 2], "\n\0]", 3) || lo > hi) {
+                return -1;
+            }
+            memset(member + lo, 1, hi - lo + 1);
+            *pos += 3; /* every range consists of 3 characters */
+        }
+
+        /* standard symbol */
+        else {
+            member[(unsigned char)input[(*pos)++]] = 1;
+        }
+    }
+
+    /* folded before inverting, so [^a] excludes A as well */
+    if (fold_case) {
+        fold_class(member);
+    }
+
+    /* inverted class: every byte but the given ones */
+    if (inverted) {
+        for (int i = 0; i < 256; i++) {
+            member[i] = !member[i];
+        }
+    }
+
+    /* a range like \x01-z spans the line break, which no class matches */
+    member['\n'] = 0;
+
+    return new_class(a, member);
+}
+
+
+/* parses the digits at input[*pos] into value until a , or }, returns 0 for
+ * any other character or a value that does not fit into an int */
+static int parse_bound(const char* input, int* pos, int* value) {
+    while (input[*pos] != ',' && input[*pos] != '}') {
+        if (input[*pos] < '0' || input[*pos] > '9' ||
+            *value > (INT_MAX - 9) / 10) {
+            return 0;
+        }
+        *value = *value * 10 + (input[(*pos)++] - '0');
+    }
+    return 1;
+}
+
+
+/* applies the modifier following the element at input[*pos] to *node and
+ * moves *pos behind both, returns 0 for an invalid modifier */
+static int parse_modifier(ast* a, const char* input, int* pos, int* node) {
+    long long nr_states = a->nodes[*node].nr_states;
+    ast_type type;
+
+    switch (input[*pos + 1]) {
+    /* repetition range a{2,5} */
+    case '{': {
+        int min = 0;
+        int max = 0;
+        *pos += 2;
+
+        if (!parse_bound(input, pos, &min)) {
+            return 0;
+        }
+        if (input[*pos] == ',') {
+            if (input[++(*pos)] == '}') {
+                max = min;
+            } else if (!parse_bound(input, pos, &max) || input[*pos] != '}') {
+                return 0;
+            }
+        } else {
+            max = min;
+        }
+        (*pos)++;
+
+        if (max < 1 || min > max) {
+            return 0;
+        }
+        if (max * nr_states > INT_MAX) {
+            a->too_large = 1;
+            return 0;
+        }
+        *node = new_node(a, an_repeat, *node, max * nr_states);
+        a->nodes[*node].min = min;
+        a->nodes[*node].max = max;
+        return 1;
+    }
+
+    /* zero or one repetition a? */
+    case '?':
+        type = an_optional;
+        break;
+
+    /* zero or many repetitions a* */
+    case '*':
+        type = an_star;
+        break;
+
+    /* one or many repetitions a+ */
+    case '+':
+        type = an_plus;
+        nr_states *= 2;
+        if (nr_states > INT_MAX) {
+            a->too_large = 1;
+            return 0;
+        }
+        break;
+
+    /* no modifiers */
+    default:
+        (*pos)++;
+        return 1;
+    }
+
+    *node = new_node(a, type, *node, nr_states);
+    if (input[*pos + 2] == '?') {
+        a->nodes[*node].behaviour = sb_lazy;
+        *pos += 3;
+    } else {
+        a->nodes[*node].behaviour = sb_greedy;
+        *pos += 2;
+    }
+    return 1;
+}
+
+
+// NFA EMISSION
+
+
+/* writes the nfa of node into the states from base on and returns them; every
+ * node is built like the regex_...() functions build it out of the automata
+ * of its operands */
+static fragment emit(const ast* a, int node, regex* r, int base) {
+    const ast_node* n = &a->nodes[node];
+    fragment f;
+
+    switch (n->type) {
+    case an_symbol:
+        r->states[base] = new_state(n->nr_ranges, sb_none, st_start);
+        for (int i = 0; i < n->nr_ranges; i++) {
+            const int* range = a->ranges + 2 * (n->first_range + i);
+            r->states[base]->transitions[i] =
+                new_transition(ts_active, range[0], range[1], base + 1);
+        }
+        r->states[base + 1] = new_state(0, sb_none, st_end);
+        f = (fragment){base, base + 2, base};
+        break;
+
+    case an_concat:
+        f = emit(a, n->child, r, base);
+        for (int child = a->nodes[n->child].next; child != -1;
+             child = a->nodes[child].next) {
+            chain(r, &f, emit(a, child, r, f.end), 0);
+        }
+        break;
+
+    case an_alternative:
+        f = emit_alternative(a, node, r, base);
+        break;
+
+    /* a new start state enters the group, leaving it to a new end state ends
+     * it */
+    case an_group: {
+        f = emit(a, n->child, r, base + 1);
+        r->states[base] = new_state(1, sb_none, st_start);
+        r->states[base]->transitions[0] =
+            new_transition(ts_epsilon, 0, 0, base + 1);
+        r->states[base]->transitions[0]->pre_tags = 1u << (2 * n->group);
+        r->states[f.end] = new_state(0, sb_none, st_start_end);
+        chain(r, &f, (fragment){f.end, f.end + 1, f.end},
+              1u << (2 * n->group + 1));
+        r->states[base + 1]->type = st_middle;
+        f.start = base;
+        break;
+    }
+
+    case an_optional:
+        f = emit(a, n->child, r, base);
+        make_optional(r, &f);
+        break;
+
+    case an_star:
+        f = emit(a, n->child, r, base);
+        make_repeat(r, &f);
+        break;
+
+    /* a+ is a chained with a copy of a* */
+    case an_plus: {
+        f = emit(a, n->child, r, base);
+        fragment g = emit(a, n->child, r, f.end);
+        make_repeat(r, &g);
+        chain(r, &f, g, 0);
+        break;
+    }
+
+    /* a{min,max} is a chained with max - 1 copies, each copy with all that
+     * follows it optional from the min-th copy on */
+    case an_repeat: {
+        f = emit(a, n->child, r, base);
+        int size = f.end - f.start;
+        fragment copy = {0, 0, 0};
+        for (int i = 0; i < n->max - 1; i++) {
+            copy = emit(a, n->child, r, f.end + i * size);
+        }
+        if (n->max > 1) {
+            fragment rest = copy;
+            for (int i = n->max - 2; i >= 0; i--) {
+                if (i < n->max - 2) {
+                    fragment previous = {copy.start - (n->max - 2 - i) * size,
+                                         copy.end - (n->max - 2 - i) * size,
+                                         copy.tail - (n->max - 2 - i) * size};
+                    chain(r, &previous, rest, 0);
+                    rest = previous;
+                }
+                if (i >= n->min - 1) {
+                    make_optional(r, &rest);
+                }
+            }
+            chain(r, &f, rest, 0);
+        }
+        if (n->min == 0) {
+            make_optional(r, &f);
+        }
+        break;
+    }
+    }
+
+    if (n->behaviour != sb_none) {
+        set_behaviour(r, f, n->behaviour);
+    }
+    return f;
+}
+
+
+/* ((a|b)|c) puts the start states of both alternatives first, followed by a,
+ * b and c */
+static fragment emit_alternative(const ast* a, int node, regex* r, int base) {
+    const ast_node* n = &a->nodes[node];
+    int nr_operands = 0;
+    for (int child = n->child; child != -1; child = a->nodes[child].next) {
+        nr_operands++;
+    }
+
+    /* the start state of the innermost alternative comes last */
+    int start = base + nr_operands - 2;
+    fragment f = emit(a, n->child, r, start + 1);
+    int operand_start = f.start;
+    for (int child = a->nodes[n->child].next; child != -1;
+         child = a->nodes[child].next) {
+        fragment g = emit(a, child, r, f.end);
+        state* s = new_state(2, sb_none, st_start);
+        s->transitions[0] = new_transition(ts_epsilon, 0, 0, operand_start);
+        s->transitions[1] = new_transition(ts_epsilon, 0, 0, g.start);
+        r->states[start] = s;
+
+        /* the start states of both operands are no longer start states */
+        state* left = r->states[operand_start];
+        state* right = r->states[g.start];
+        left->type = (left->type == st_start_end) ? st_end : st_middle;
+        right->type = (right->type == st_start_end) ? st_end : st_middle;
+
+        operand_start = start--;
+        f.end = g.end;
+    }
+
+    f.start = base;
+    return f;
+}
+
+
+static void add_epsilon(state* s, int next_state, unsigned int pre_tags) {
+    s->transitions = counted_realloc(
+        s->transitions, ++(s->nr_transitions) * sizeof(transition*));
+    s->transitions[s->nr_transitions - 1] =
+        new_transition(ts_epsilon, 0, 0, next_state);
+    s->transitions[s->nr_transitions - 1]->pre_tags = pre_tags;
+}
+
+
+/* chains g after f: every end state of f leads to the start of g */
+static void chain(regex* r, fragment* f, fragment g, unsigned int pre_tags) {
+    /* g's start state is now in the middle of the automaton */
+    state* start = r->states[g.start];
+    start->type = (start->type == st_start_end) ? st_end : st_middle;
+
+    /* connect f's end states to g's start state */
+    for (int i = f->tail; i < f->end; i++) {
+        state* s = r->states[i];
+        if (s->type == st_end || s->type == st_start_end) {
+            add_epsilon(s, g.start, pre_tags);
+            s->type = (s->type == st_end) ? st_middle : st_start;
+        }
+    }
+
+    f->end = g.end;
+    f->tail = g.tail;
+}
+
+
+static void make_optional(regex* r, fragment* f) {
+    r->states[f->start]->type = st_start_end;
+    f->tail = f->start;
+}
+
+
+/* optional, and every end state leads back to the start */
+static void make_repeat(regex* r, fragment* f) {
+    int tail = f->tail;
+    make_optional(r, f);
+    for (int i = tail; i < f->end; i++) {
+        if (r->states[i]->type == st_end) {
+            add_epsilon(r->states[i], f->start, 0);
+        }
+    }
+}
+
+
+static void set_behaviour(regex* r, fragment f, state_behaviour behaviour) {
+    for (int i = f.tail; i < f.end; i++) {
+        if (r->states[i]->type == st_end || r->states[i]->type == st_start_end) {
+            r->states[i]->behaviour = behaviour;
+        }
+    }
+}
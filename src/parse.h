@@ -0,0 +1,69 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include "budget.h"
+#include "regex.h"
+
+
+/* The compiler builds the nfa in two passes. The parser turns the pattern into
+ * a syntax tree whose nodes all live in one array and are referenced by index;
+ * every node knows how many nfa states it needs. The emitter then allocates
+ * the states of the whole pattern at once and writes every node into its own
+ * range of them, so no state is ever moved or renumbered. */
+
+
+typedef enum {
+    an_symbol,      /* a single symbol out of a set of ranges: a, [a-c], ., ^ */
+    an_concat,      /* all operands one after another */
+    an_alternative, /* one of the operands; a|b|c is ((a|b)|c) */
+    an_group,       /* a capture group around the operand */
+    an_optional,    /* a? */
+    an_star,        /* a* */
+    an_plus,        /* a+ */
+    an_repeat       /* a{min,max} */
+} ast_type;
+
+
+typedef struct {
+    ast_type type;
+    int child;           /* first operand, -1 without operands */
+    int last;            /* last operand */
+    int next;            /* next operand of the same parent, -1 for the last */
+    long long nr_states; /* states of the nfa of this node */
+    int first_range;     /* an_symbol: ranges[first_range...] */
+    int nr_ranges;
+    int min, max;              /* an_repeat */
+    int group;                 /* an_group */
+    state_behaviour behaviour; /* given to the end states, sb_none keeps them */
+} ast_node;
+
+
+typedef struct {
+    ast_node* nodes;
+    int nr_nodes;
+    int* ranges; /* lo and hi of every range of every an_symbol */
+    int nr_ranges;
+    int root;
+    int nr_groups;
+    int too_large; /* valid, but the nfa would need more than INT_MAX states */
+} ast;
+
+
+/* parses input into a, which has to be freed with free_ast() even if parsing
+ * fails; groups are captured with capture, letters match both cases with
+ * fold_case; returns 0 for invalid patterns */
+int parse_regex(ast* a, const char* input, int capture, int fold_case);
+/* emits the nfa of a successfully parsed a */
+regex* ast_to_regex(const ast* a);
+/* builds the epsilon free nfa of the positions of a successfully parsed a,
+ * which matches like ast_to_regex() after epsilon removal; stats, if set,
+ * receives the sizes of the follow sets; returns NULL once budget fails */
+regex* ast_to_glushkov(const ast* a,
+                       compile_budget* budget,
+                       regex_compile_stats* stats);
+/* returns the literal of a successfully parsed a that is a plain string of
+ * bytes other than line breaks, NULL for any other pattern */
+regex_literal* ast_to_literal(const ast* a);
+void free_ast(ast* a);
+
+#endif
@@ -0,0 +1,150 @@
+#include "alloc.h"
+#include "regex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Most patterns are short, and for those the subset construction costs far
+ * more than all matching that follows. Instead, the epsilon free nfa is turned
+ * into a position automaton: every distinct pair of a target state and the
+ * symbol range leading into it becomes a position, so all transitions into a
+ * position share its symbols. A set of positions then needs no state table to
+ * move on: the positions that may follow any of its members are collected
+ * byte by byte from precomputed unions, and the symbol mask keeps those that
+ * can be entered with the current symbol. The positions entering a state
+ * stand for that state, so every set of positions is one of the dfa states,
+ * including its flags. */
+
+
+#define NR_CHUNK_VALUES 256
+
+
+/* marks the symbols on which state leaves to target in member */
+static void target_symbols(const state* s, int target, unsigned char* member) {
+    memset(member, 0, NR_SYMBOLS);
+    for (int j = 0; j < s->nr_transitions; j++) {
+        transition* t = s->transitions[j];
+        if (t->status == ts_active && t->next_state == target) {
+            memset(member + t->lo, 1, t->hi - t->lo + 1);
+        }
+    }
+}
+
+
+position_nfa* new_position_nfa(regex* r) {
+    int target[REGEX_MAX_POSITIONS];
+    unsigned char member[REGEX_MAX_POSITIONS][NR_SYMBOLS];
+    int nr_positions = 1;
+
+    /* position 0 is the start state itself, it is never entered again */
+    target[0] = 0;
+    memset(member[0], 0, NR_SYMBOLS);
+
+    /* the transitions leaving a state, as a set of positions */
+    uint64_t* leaving = counted_calloc(r->nr_states, sizeof(uint64_t));
+
+    /* the epsilon removal splits ranges, so all symbols on which a state
+     * leaves to the same target form a single position */
+    for (int i = 0; i < r->nr_states; i++) {
+        state* s = r->states[i];
+        for (int j = 0; j < s->nr_transitions; j++) {
+            int next_state = s->transitions[j]->next_state;
+            int seen = 0;
+            for (int k = 0; k < j; k++) {
+                seen = seen || (s->transitions[k]->status == ts_active &&
+                                s->transitions[k]->next_state == next_state);
+            }
+            if (s->transitions[j]->status != ts_active || seen) {
+                continue;
+            }
+
+            if (nr_positions == REGEX_MAX_POSITIONS) {
+                counted_free(leaving);
+                return NULL;
+            }
+            target_symbols(s, next_state, member[nr_positions]);
+            int k = 1;
+            while (k < nr_positions &&
+                   (target[k] != next_state ||
+                    memcmp(member[k], member[nr_positions], NR_SYMBOLS))) {
+                k++;
+            }
+            if (k == nr_positions) {
+                target[nr_positions++] = next_state;
+            }
+            leaving[i] |= (uint64_t)1 << k;
+        }
+    }
+
+    position_nfa* p = counted_malloc(sizeof(position_nfa));
+    p->nr_positions = nr_positions;
+    p->nr_chunks = (nr_positions + 7) / 8;
+    p->end_mask = 0;
+    p->greedy_mask = 0;
+    memset(p->symbol_mask, 0, sizeof(p->symbol_mask));
+
+    uint64_t follow[REGEX_MAX_POSITIONS];
+    for (int k = 0; k < nr_positions; k++) {
+        uint64_t bit = (uint64_t)1 << k;
+        state* s = r->states[target[k]];
+        follow[k] = leaving[target[k]];
+        for (int symbol = 0; symbol < NR_SYMBOLS; symbol++) {
+            if (member[k][symbol]) {
+                p->symbol_mask[symbol] |= bit;
+            }
+        }
+        if (s->type == st_end || s->type == st_start_end) {
+            p->end_mask |= bit;
+        }
+        if (s->behaviour == sb_greedy) {
+            p->greedy_mask |= bit;
+        }
+    }
+
+    /* the union of follow over the positions of every value of every byte,
+     * each built from a value with one bit less */
+    p->follow =
+        counted_malloc(p->nr_chunks * NR_CHUNK_VALUES * sizeof(uint64_t));
+    for (int chunk = 0; chunk < p->nr_chunks; chunk++) {
+        uint64_t* unions = p->follow + chunk * NR_CHUNK_VALUES;
+        unions[0] = 0;
+        for (int bit = 0; bit < 8; bit++) {
+            int k = chunk * 8 + bit;
+            for (int value = 1 << bit; value < 2 << bit; value++) {
+                unions[value] = unions[value - (1 << bit)] |
+                                (k < nr_positions ? follow[k] : 0);
+            }
+        }
+    }
+
+    counted_free(leaving);
+
+    return p;
+}
+
+
+int position_nfa_has_loop(const position_nfa* p) {
+    for (int k = 1; k < p->nr_positions; k++) {
+        uint64_t set = (uint64_t)1 << k;
+        uint64_t follow = p->follow[k / 8 * NR_CHUNK_VALUES + (1 << k % 8)];
+        int nr_escapes = 0;
+        for (int c = 0; c < 256 && nr_escapes <= REGEX_MAX_ESCAPES; c++) {
+            nr_escapes += (follow & p->symbol_mask[c]) != set;
+        }
+        if (nr_escapes <= REGEX_MAX_ESCAPES) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+void delete_position_nfa(position_nfa** p) {
+    if ((*p) == NULL) {
+        return;
+    }
+    counted_free((*p)->follow);
+    counted_free(*p);
+    *p = NULL;
+}
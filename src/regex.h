@@ -1,24 +1,67 @@
 #ifndef REGEX_H
 #define REGEX_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // clang-format off
 #define ERROR(fmt, ...) fprintf(stderr, "[ERROR] " fmt, ##__VA_ARGS__)
 // clang-format on
 
 
-// avoid conflicts with the literal use of ^ and $
-#define LINE_START 2
-#define LINE_END 3
+// symbols are the 256 byte values plus the line anchors, which lie behind
+// them to avoid conflicts with the literal use of ^ and $
+#define LINE_START 256
+#define LINE_END 257
+#define NR_SYMBOLS 258
+
+
+// compile flags
+/* ^ and $ match at every line break of the input, not only at its ends */
+#define REGEX_MULTILINE 1
+/* for patterns ending in $: also build the reversed automaton. Every match
+ * of such a pattern ends at the line end, so a single backward pass from there
+ * finds the leftmost match start, and the forward automaton runs once instead
+ * of once per start position. Other patterns are compiled without it: the end
+ * of the first match a forward pass finds does not tell where the leftmost
+ * match starts, since an earlier start can end later, as (abcd)|c does on
+ * "abcd", and reading backwards from the line end instead costs the whole
+ * line, without REGEX_MULTILINE the whole input, even for an early match */
+#define REGEX_REVERSE 2
+/* record where every group (...) matched, see regex_match_captures() */
+#define REGEX_CAPTURE 4
+/* always build the dfa, even for patterns the bit-parallel matcher could
+ * handle; takes longer to compile, but a table lookup per byte is cheaper than
+ * a bit-parallel step */
+#define REGEX_DFA 8
+/* letters match in either case; only ASCII letters are folded, other bytes
+ * still match only themselves */
+#define REGEX_ICASE 16
+
+
+/* groups beyond this number are matched, but not captured */
+#define REGEX_MAX_GROUPS 16
 
 
 /* TYPES */
 
 
 typedef enum { ts_dead, ts_active, ts_epsilon } transition_status;
+/* an active transition is taken for every symbol from lo to hi; with
+ * REGEX_CAPTURE, transitions carry tags: bit 2 * k marks the start of group
+ * k + 1, bit 2 * k + 1 its end; pre_tags are set at the position of the
+ * symbol, post_tags behind it */
 typedef struct {
     transition_status status;
-    char symbol;
+    int lo;
+    int hi;
     int next_state;
+    unsigned int pre_tags;
+    unsigned int post_tags;
 } transition;
 
 
@@ -32,12 +75,305 @@ typedef struct {
 } state;
 
 
+/* per state flags of the transition table; sf_loop marks states of the
+ * table that stay where they are on all but at most REGEX_MAX_ESCAPES bytes */
+typedef enum { sf_end = 1, sf_greedy = 2, sf_loop = 4 } state_flag;
+
+#define REGEX_MAX_ESCAPES 3
+
+
+/* dfa over the thread lists of a tagged nfa in which every step continues a
+ * single thread, see new_one_pass_dfa() in capture.c: state i reads symbol
+ * class c into state next[i * nr_classes + c], -1 for none, after committing
+ * the tags pre_tags and post_tags of the same entry; a state with an end
+ * thread commits its end_pre_tags and end_post_tags when the match ends */
+typedef struct {
+    int nr_states;
+    int* next;
+    unsigned int* pre_tags;
+    unsigned int* post_tags;
+    unsigned char* is_end;
+    unsigned int* end_pre_tags;
+    unsigned int* end_post_tags;
+} one_pass_dfa;
+
+
+/* flat copy of the epsilon free nfa, kept with its group tags for capture
+ * extraction and without tags when there is no dfa: the transitions of state
+ * s on symbol c are transitions[offsets[s * nr_classes + symbol_class[c]]] up
+ * to the next offset, in the order of their priority */
+typedef struct {
+    int next_state;
+    unsigned int pre_tags;
+    unsigned int post_tags;
+} tagged_transition;
+
+typedef struct {
+    int nr_states;
+    int nr_classes;
+    unsigned short symbol_class[NR_SYMBOLS];
+    int* offsets;
+    tagged_transition* transitions;
+    unsigned char* state_flags; /* state_flag bits for every state */
+    /* with REGEX_CAPTURE: the one pass dfa of the nfa, NULL if it has none */
+    one_pass_dfa* one_pass;
+} tagged_nfa;
+
+
+/* position automaton of a small epsilon free nfa, simulated with one bit per
+ * position: bit 0 is the start state, every other bit stands for entering a
+ * state on a range of symbols; a set of positions moves on symbol c to
+ * follow(set) & symbol_mask[c], where follow(set) is the union of
+ * follow[k * 256 + byte k of set] over all bytes of the set */
+#define REGEX_MAX_POSITIONS 64
+
+typedef struct {
+    int nr_positions;
+    int nr_chunks; /* bytes of a set that can hold a position */
+    uint64_t symbol_mask[NR_SYMBOLS];
+    uint64_t* follow;
+    uint64_t end_mask;    /* positions entering an end state */
+    uint64_t greedy_mask; /* positions entering a greedy state */
+} position_nfa;
+
+
+/* a pattern that is nothing but a string of bytes, searched for directly with
+ * Boyer-Moore-Horspool: the window is compared from its last byte, and that
+ * byte decides by shift[byte] how far the window moves on after a mismatch */
+typedef struct {
+    int length;
+    unsigned char* bytes;
+    int shift[256];
+} regex_literal;
+
+
+/* the bytes the start state has a transition on: an attempt at any other
+ * byte fails at once, so before every restart the matcher searches for the
+ * next of these bytes; few bytes are searched for directly, more with a
+ * lookup per byte, or with SSSE3 two nibble lookups per 16 bytes: byte b is
+ * a member if bit (b >> 4) & 7 of nibble_masks[b >> 7][b & 15] is set */
 typedef struct {
-    int line_start;
-    int line_end;
+    int nr_bytes;
+    unsigned char bytes[REGEX_MAX_ESCAPES]; /* all of them, if they fit */
+    unsigned char member[256];
+    unsigned char nibble_masks[2][16];
+} regex_start_bytes;
+
+
+/* match-time counters of a regex; they are only updated if the library is
+ * built with -DREGEX_COUNTERS, otherwise the matcher contains no trace of
+ * them */
+typedef struct {
+    size_t match_calls;
+    size_t matches;
+    size_t bytes_scanned; /* symbols read, a restart reads them again */
+    size_t restarts;      /* attempts after the first of a call */
+    size_t prefilter_hits;   /* lines a prefilter handed to the matcher */
+    size_t prefilter_misses; /* lines a prefilter ruled out */
+} regex_counters;
+
+
+/* events reported to a trace callback, again only with -DREGEX_COUNTERS */
+typedef enum {
+    rt_restart,        /* a new attempt starts at position */
+    rt_match,          /* a match was found starting at position */
+    rt_prefilter_skip, /* the line starting at position was ruled out */
+} regex_trace_event;
+
+typedef struct regex regex;
+typedef void (*regex_trace_callback)(const regex* r,
+                                     regex_trace_event event,
+                                     size_t position,
+                                     void* data);
+
+
+/* a compiled regex is read-only: once regex_compile() has returned, no
+ * function in this library writes to it again except for its atomically
+ * updated counters and regex_optimize_layout(), which renumbers the states of
+ * its table and so has to run before the regex is shared; after that, a
+ * single regex can be shared by any number of threads without locking */
+struct regex {
+    int flags;      /* compile flags */
+    int line_start; /* 1 if every match must start at a line start (^) */
+    int line_end;   /* 1 if every match must end at a line end ($) */
     int nr_states;
     state** states;
-} regex;
+
+    /* flat copy of the states for matching, built by regex_compile(): the
+     * next state of state s on symbol c is
+     * table[s * nr_classes + symbol_class[c]], -1 if there is none; symbols
+     * that behave identically share a class, class 0 holds every symbol
+     * without any transition */
+    int nr_classes;
+    unsigned short symbol_class[NR_SYMBOLS];
+    int* table;
+    unsigned char* state_flags; /* state_flag bits for every state */
+    /* for every state of the table REGEX_MAX_ESCAPES + 1 bytes: the number of
+     * bytes that leave an sf_loop state, then these bytes; the matcher skips
+     * to the next of them with a byte search instead of stepping */
+    unsigned char* escapes;
+
+    /* with REGEX_REVERSE: the automaton that reads a line backwards from its
+     * end; state 0 is the empty set, sf_end marks the states in which a match
+     * starts at the current position */
+    regex* reverse;
+
+    /* with REGEX_CAPTURE: the number of captured groups and the nfa the
+     * captures are extracted with */
+    int nr_groups;
+    tagged_nfa* tagged;
+
+    /* if the dfa would have exceeded max_states, table is NULL and the
+     * matcher simulates this nfa instead, following the same sets of nfa
+     * states the dfa states would have stood for */
+    tagged_nfa* nfa;
+
+    /* for patterns of at most REGEX_MAX_POSITIONS positions no dfa is built
+     * unless REGEX_DFA is set: table is NULL and the matcher steps through
+     * the same state sets with this position automaton; patterns with an
+     * sf_loop state get a small dfa anyway, see regex_compile_ex() */
+    position_nfa* positions;
+
+    /* patterns without any operator, class or anchor are searched for as
+     * this string by regex_match_first() and the functions built on it; the
+     * automaton is still there for everything else */
+    regex_literal* literal;
+
+    /* NULL if every byte can start a match */
+    regex_start_bytes* start_bytes;
+
+    regex_counters counters;
+    regex_trace_callback trace;
+    void* trace_data;
+};
+
+
+/* default limit of dfa states, see regex_options */
+#define REGEX_DEFAULT_MAX_STATES 10000
+
+
+/* the phases of regex_compile_ex() */
+typedef enum {
+    rp_parse,     /* pattern to the epsilon free nfa of its positions */
+    rp_reverse,   /* reverse automaton, with REGEX_REVERSE */
+    rp_capture,   /* tagged nfa, with REGEX_CAPTURE */
+    rp_positions, /* position automaton */
+    rp_dfa,       /* subset construction */
+    rp_table,     /* transition table, or the nfa of the fallback */
+    NR_REGEX_PHASES
+} regex_phase;
+
+/* what a phase took and built: states and transitions of the automaton it
+ * started from and of the one it produced; for the position automaton these
+ * are positions and pairs of following positions, for the table its rows and
+ * used entries */
+typedef struct {
+    int ran; /* 0 if the phase was skipped */
+    double seconds;
+    int states_before;
+    int transitions_before;
+    int states_after;
+    int transitions_after;
+} regex_phase_stats;
+
+/* filled in by regex_compile_ex() if options->stats is set */
+typedef struct {
+    regex_phase_stats phases[NR_REGEX_PHASES];
+    int max_follow;        /* size of the largest follow set of a position */
+    long total_follow;     /* sizes of all follow sets together */
+    int dfa_over_budget;   /* 1 if the dfa exceeded max_states */
+    size_t nr_allocations; /* malloc(), calloc() and realloc() calls */
+    size_t peak_memory;    /* most bytes allocated at once while compiling */
+    size_t memory;         /* bytes held by the compiled regex */
+} regex_compile_stats;
+
+
+/* why regex_compile_ex() failed */
+typedef enum {
+    re_none,       /* it did not */
+    re_syntax,     /* the pattern is invalid */
+    re_nfa_states, /* the nfa would exceed max_nfa_states, or INT_MAX states */
+    re_dfa_states, /* the dfa would exceed max_dfa_states */
+    re_memory,     /* compiling took more than max_memory bytes at once, or
+                    * an allocation failed */
+    re_timeout,    /* compiling took longer than timeout */
+} regex_error;
+
+
+/* optional settings for regex_compile_ex() */
+typedef struct {
+    int flags; /* compile flags, REGEX_MULTILINE | REGEX_REVERSE | ... */
+    /* the most dfa states the compiler may build, 0 for
+     * REGEX_DEFAULT_MAX_STATES, -1 for no limit; patterns beyond the limit
+     * are matched by simulating the nfa, which takes O(n * m) time for n
+     * input bytes and m nfa states but no more memory */
+    int max_states;
+    /* hard limits for untrusted patterns, 0 for none: a compile that would
+     * exceed one of them fails with its regex_error instead; the compiler
+     * checks them while it builds, so it gives up soon after the limit is
+     * reached. max_nfa_states bounds the nfa built from the pattern, unrolled
+     * repetitions included, and the tagged nfa of REGEX_CAPTURE;
+     * max_dfa_states bounds the dfa, but unlike max_states, which still
+     * applies below it, fails instead of falling back to the nfa; max_memory
+     * bounds the bytes allocated at once and timeout the seconds spent */
+    int max_nfa_states;
+    int max_dfa_states;
+    size_t max_memory;
+    double timeout;
+    /* if not NULL, receives re_none or why the compile failed */
+    regex_error* error;
+    /* if not NULL, receives the statistics of the compile, also if it
+     * fails */
+    regex_compile_stats* stats;
+    /* called on match events if the library is built with -DREGEX_COUNTERS;
+     * it runs on the matching thread, inside the match */
+    regex_trace_callback trace;
+    void* trace_data;
+} regex_options;
+
+
+/* an attempt of the nfa simulation, which runs the attempts from all start
+ * positions of a line at once: the attempt owns nr_states states from first
+ * on in the current state list, see match_nfa() in match.c */
+typedef struct {
+    size_t start;
+    long checkpoint; /* -1: no checkpoint, >-1: end position */
+    int first;
+    int nr_states;
+    unsigned char flags; /* state_flag bits of its states */
+    unsigned char status;
+    size_t location; /* the match, once it is decided */
+    size_t length;
+} regex_nfa_attempt;
+
+
+/* mutable per-thread match state; everything a matcher has to write while
+ * running over the input lives here instead of in the shared regex, so every
+ * thread matching concurrently needs a scratch of its own */
+typedef struct {
+    const regex* r; /* the regex this scratch was created for */
+
+    /* with REGEX_CAPTURE: two thread lists of the tagged nfa, each holding
+     * up to nr_states states with 2 * nr_groups tag positions per state */
+    int* threads;
+    size_t* thread_tags;
+    size_t* added; /* generation in which a state was added to a list */
+    size_t generation;
+
+    /* without a dfa: the two sets of nfa states the simulation alternates
+     * between, as states 1 and 2; state 0 is the start state */
+    int* sets;
+    int set_sizes[3];
+    unsigned char set_flags[3];
+    /* and for the single pass over a line: the attempts by their start and
+     * the two lists of the states they own */
+    regex_nfa_attempt* attempts;
+    int* lists;
+
+    /* with a position automaton: the two sets of positions, as states 1 and
+     * 2 just like the nfa sets; they need no allocation */
+    uint64_t position_sets[3];
+} regex_scratch;
 
 
 /* PUBLIC FUNCTIONS */
@@ -48,8 +384,165 @@ typedef struct {
  * returns 1 on success, 0 on error */
 int regex_compile(regex** r, char* input);
 
-/* matches the previously compiled regex r against the input string */
-int regex_match_first(regex* r, char* input, int* location, int* length);
+/* like regex_compile(), with options; options may be NULL */
+int regex_compile_ex(regex** r, char* input, const regex_options* options);
+
+/* runs the matcher of r over sample_length bytes of sample and renumbers the
+ * states of its table so that the states matching the sample goes through
+ * most often lie next to each other; the matches stay the same; writes r, so
+ * it must be called before r is shared with other threads; returns 1 if the
+ * states were renumbered, 0 if r has no table: short patterns compiled
+ * without REGEX_DFA are matched by their position automaton and patterns
+ * over max_states by the nfa, and both are left as they are */
+int regex_optimize_layout(regex* r, const char* sample, size_t sample_length);
+
+/* matches the previously compiled regex r against the input string; safe to
+ * call concurrently on the same regex, uses a temporary scratch per call */
+int regex_match_first(const regex* r,
+                      const char* input,
+                      int* location,
+                      int* length);
+
+/* like regex_match_first(), but keeps all match state in the caller's
+ * scratch s, which must have been created for r and must not be used by two
+ * threads at the same time */
+int regex_match_first_scratch(const regex* r,
+                              regex_scratch* s,
+                              const char* input,
+                              int* location,
+                              int* length);
+
+
+/* matches r against the first length bytes of input, which does not need to
+ * be null-terminated; positions are reported as byte offsets into input */
+int regex_match_first_n(const regex* r,
+                        regex_scratch* s,
+                        const char* input,
+                        size_t input_length,
+                        size_t* location,
+                        size_t* length);
+
+
+/* like regex_match_first_n(), but the search starts at byte from of input:
+ * unless from starts a line, the attempt there is made as if the search had
+ * come to from, so ^ does not match there and a line without a longer match
+ * reports its empty match at from; starting again behind the last match, or
+ * one byte further if it was empty, finds the matches of input one after
+ * another */
+int regex_match_from(const regex* r,
+                     regex_scratch* s,
+                     const char* input,
+                     size_t input_length,
+                     size_t from,
+                     size_t* location,
+                     size_t* length);
+
+
+/* limits of regex_match_first_limited(), 0 for none */
+typedef struct {
+    size_t max_steps; /* transitions taken, restarts read bytes again */
+    double timeout;   /* seconds */
+} regex_match_limits;
+
+/* returned by regex_match_first_limited() once a limit is exceeded */
+#define REGEX_MATCH_LIMIT -1
+
+/* like regex_match_first_n(), but gives up once one of the limits is exceeded
+ * and returns REGEX_MATCH_LIMIT; then no match starts before *location, where
+ * the interrupted attempt had read *length bytes, so the search can be resumed
+ * or the input handled otherwise; returns 1 on match, 0 otherwise */
+int regex_match_first_limited(const regex* r,
+                              regex_scratch* s,
+                              const char* input,
+                              size_t input_length,
+                              const regex_match_limits* limits,
+                              size_t* location,
+                              size_t* length);
+
+
+/* called by regex_match_parallel() once for every matching line, in the order
+ * the lines appear in the buffer */
+typedef void (*regex_match_callback)(size_t location,
+                                     size_t length,
+                                     void* data);
+
+/* scans buffer line by line and reports the first match of every line to
+ * callback, exactly like a sequential scan would; the buffer is split into
+ * nr_threads chunks at line boundaries that are matched concurrently, the
+ * callback itself is always called from the calling thread; returns 1 on
+ * success, 0 on error, for example when a chunk ran out of memory for its
+ * matches, in which case the callback is not called at all */
+int regex_match_parallel(const regex* r,
+                         const char* buffer,
+                         size_t length,
+                         int nr_threads,
+                         regex_match_callback callback,
+                         void* data);
+
+
+/* per input result of the batch matching functions */
+typedef struct {
+    int success;
+    size_t location;
+    size_t length;
+} regex_batch_result;
+
+/* matches r against n independent inputs, input i being the lengths[i] bytes
+ * at inputs[i], and stores the result for input i in results[i]; several
+ * inputs are advanced in lockstep, which hides most of the memory latency of
+ * the table lookups; returns the number of matching inputs */
+size_t regex_match_batch(const regex* r,
+                         const char** inputs,
+                         const size_t* lengths,
+                         size_t n,
+                         regex_batch_result* results);
+
+/* like regex_match_batch(), but all inputs are stored back to back in buffer;
+ * input i spans buffer[offsets[i]] up to buffer[offsets[i + 1]], so offsets
+ * must hold n + 1 entries */
+size_t regex_match_batch_buffer(const regex* r,
+                                const char* buffer,
+                                const size_t* offsets,
+                                size_t n,
+                                regex_batch_result* results);
+
+
+/* position of a group in the input; success is 0 if the group took no part
+ * in the match */
+typedef struct {
+    int success;
+    size_t location;
+    size_t length;
+} regex_capture;
+
+/* like regex_match_first_n(), but also reports where the groups matched: the
+ * match itself is stored in captures[0], group k (counted by its opening
+ * parenthesis) in captures[k]; r must be compiled with REGEX_CAPTURE and s must
+ * be created by new_regex_scratch(); for a repeated group the last repetition
+ * is reported; returns 1 on match, 0 otherwise */
+int regex_match_captures(const regex* r,
+                         regex_scratch* s,
+                         const char* input,
+                         size_t input_length,
+                         regex_capture* captures,
+                         int nr_captures);
+
+
+/* copies the counters of r, which may change while matches run; returns 0 if
+ * the library was built without REGEX_COUNTERS */
+int regex_get_counters(const regex* r, regex_counters* counters);
+/* sets all counters of r to 0 */
+void regex_reset_counters(regex* r);
+
+
+/* scratch constructor: one scratch per thread and regex */
+regex_scratch* new_regex_scratch(const regex* r);
+/* free a scratch object, set *s to NULL */
+void delete_regex_scratch(regex_scratch** s);
+/* 1 if the matchers need a scratch from new_regex_scratch() for r, which only
+ * the nfa simulation does; otherwise a scratch on the stack with s.r = r will
+ * do. regex_match_captures() always needs one from new_regex_scratch() */
+int regex_needs_scratch(const regex* r);
 
 
 /* UTILITY FUNCTIONS */
@@ -57,7 +550,7 @@ int regex_match_first(regex* r, char* input, int* location, int* length);
 
 /* regex constructors */
 regex* new_empty_regex();
-regex* new_single_transition_regex(char symbol);
+regex* new_single_transition_regex(int symbol);
 regex* new_single_state_regex();
 regex* copy_regex(regex* r);
 /* free a regex object and all its elements recursively, set *r to NULL */
@@ -71,25 +564,53 @@ new_state(int nr_transitions, state_behaviour behaviour, state_type type);
 void free_state(state* s);
 
 
-/* transition constructor */
+/* transition constructor for the symbols lo to hi */
 transition*
-new_transition(transition_status status, char symbol, int next_state);
+new_transition(transition_status status, int lo, int hi, int next_state);
+
+
+/* builds the tagged nfa of the epsilon free nfa r */
+tagged_nfa* new_tagged_nfa(regex* r);
+/* builds the one pass dfa of the tagged nfa t, returns NULL if t has none or
+ * it would need more than ONE_PASS_MAX_STATES states */
+one_pass_dfa* new_one_pass_dfa(const tagged_nfa* t);
+/* free a tagged nfa, set *t to NULL */
+void delete_tagged_nfa(tagged_nfa** t);
 
 
-/* chain b after a */
-void regex_chain(regex* a, regex** b);
-void regex_alternative(regex* a, regex** b);
-/* 0-n repetitions */
-void regex_repeat(regex* a);
-/* 0-1 repetitions */
-void regex_optional(regex* a);
-/* mark all end states of a as lazy */
-void regex_make_lazy(regex* a);
-/* mark all end states of a as greedy */
-void regex_make_greedy(regex* a);
+/* builds the position automaton of the epsilon free nfa r, returns NULL if r
+ * has more than REGEX_MAX_POSITIONS positions */
+position_nfa* new_position_nfa(regex* r);
+/* 1 if a position of p, on its own, stays where it is on all but at most
+ * REGEX_MAX_ESCAPES bytes, like the one of [^"]*, so its dfa has an sf_loop
+ * state */
+int position_nfa_has_loop(const position_nfa* p);
+/* free a position automaton, set *p to NULL */
+void delete_position_nfa(position_nfa** p);
+
+
+/* builds the search table of the length bytes at bytes */
+regex_literal* new_regex_literal(const unsigned char* bytes, int length);
+/* free a literal, set *l to NULL */
+void delete_regex_literal(regex_literal** l);
+
+
+/* finds the matches of r in input one after another like regex_match_from()
+ * and adds every row s of the table the matcher reads to visits[s], and the
+ * class c it goes on with to counts[s * nr_classes + c]; r must have a table,
+ * see regex_optimize_layout() */
+void regex_profile_table(const regex* r,
+                         const char* input,
+                         size_t input_length,
+                         size_t* visits,
+                         size_t* counts);
 
 
 /* print a compiled regex to the terminal */
 void print_regex(regex* r);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,207 @@
+#ifndef REGEX_HPP
+#define REGEX_HPP
+
+#include "regex.h"
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+
+/* Regex owns a regex compiled by regex_compile_ex() and frees it when it goes
+ * out of scope (C++20 for std::span). It can be moved but not copied; a
+ * moved-from Regex holds no regex, get() returns nullptr and it may only be
+ * assigned to or destroyed; matching it is undefined and fails an assertion
+ * unless NDEBUG is set. Matching reads the caller's std::string_view or
+ * std::span<const std::byte> in place, nothing is copied and nothing needs a
+ * null terminator. Like the regex it owns, a Regex is not modified by
+ * matching and can be shared by any number of threads. There are no
+ * exceptions: compile() returns std::nullopt for a pattern that
+ * regex_compile_ex() rejects. */
+class Regex {
+  public:
+    /* a match of input[location] up to input[location + length - 1] */
+    struct match {
+        std::size_t location;
+        std::size_t length;
+    };
+
+    class match_range;
+
+    /* compiles pattern, options may be nullptr; the pattern is copied once
+     * for its null terminator */
+    static std::optional<Regex>
+    compile(std::string_view pattern, const regex_options* options = nullptr) {
+        std::string terminated(pattern);
+        regex* r = nullptr;
+        if (!regex_compile_ex(&r, terminated.data(), options)) {
+            delete_regex(&r);
+            return std::nullopt;
+        }
+        return Regex(r);
+    }
+
+    Regex(Regex&& other) noexcept : r(std::exchange(other.r, nullptr)) {}
+
+    Regex& operator=(Regex&& other) noexcept {
+        if (this != &other) {
+            delete_regex(&r);
+            r = std::exchange(other.r, nullptr);
+        }
+        return *this;
+    }
+
+    Regex(const Regex&) = delete;
+    Regex& operator=(const Regex&) = delete;
+
+    ~Regex() { delete_regex(&r); }
+
+    /* the compiled regex, for the matching functions of regex.h */
+    const regex* get() const { return r; }
+
+    /* regex_optimize_layout() for the regex, which it writes: call it before
+     * the Regex is shared between threads; false if there is no table */
+    bool optimize_layout(std::string_view sample) {
+        assert(r != nullptr);
+        return regex_optimize_layout(r, sample.data(), sample.size());
+    }
+
+    /* the first match in input, like regex_match_first_n() */
+    std::optional<match> match_first(std::string_view input) const;
+    std::optional<match> match_first(std::span<const std::byte> input) const {
+        return match_first(as_chars(input));
+    }
+
+    /* all matches in input one after another, for range-for loops; the
+     * range holds the one scratch all of its matches are found with */
+    match_range matches(std::string_view input) const;
+    match_range matches(std::span<const std::byte> input) const;
+
+  private:
+    explicit Regex(regex* compiled) : r(compiled) {}
+
+    static std::string_view as_chars(std::span<const std::byte> input) {
+        return {reinterpret_cast<const char*>(input.data()), input.size()};
+    }
+
+    regex* r;
+};
+
+
+/* the matches of a regex in an input, found one at a time while iterating:
+ * every match starts behind the previous one, or one byte further if that
+ * was empty, so an input of n bytes has at most n + 1 of them. The range
+ * refers to the Regex and the input, which have to outlive it, and keeps its
+ * scratch, which it allocates once at most: only the nfa simulation needs
+ * one that does not fit into the range itself. regex_match_captures() is not
+ * wrapped; it needs a scratch from new_regex_scratch() for get(). */
+class Regex::match_range {
+  public:
+    class iterator {
+      public:
+        using value_type = match;
+        using difference_type = std::ptrdiff_t;
+        using iterator_concept = std::input_iterator_tag;
+
+        iterator() = default;
+
+        const match& operator*() const { return current; }
+        const match* operator->() const { return &current; }
+
+        iterator& operator++() {
+            std::size_t from = current.location + current.length;
+            if (current.length == 0) {
+                from++;
+            }
+            find(from);
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        friend bool operator==(const iterator& i, std::default_sentinel_t) {
+            return i.range == nullptr;
+        }
+
+      private:
+        friend class match_range;
+
+        explicit iterator(match_range* owner) : range(owner) { find(0); }
+
+        /* the next match from byte from on; the end once there is none */
+        void find(std::size_t from) {
+            if (from > range->input.size() ||
+                !regex_match_from(range->r, range->scratch(),
+                                  range->input.data(), range->input.size(),
+                                  from, &current.location, &current.length)) {
+                range = nullptr;
+            }
+        }
+
+        match_range* range = nullptr;
+        match current = {0, 0};
+    };
+
+    match_range(const match_range&) = delete;
+    match_range& operator=(const match_range&) = delete;
+
+    match_range(match_range&& other) noexcept
+        : r(other.r), input(other.input), local(other.local),
+          owned(std::exchange(other.owned, nullptr)) {}
+
+    match_range& operator=(match_range&&) = delete;
+
+    ~match_range() { delete_regex_scratch(&owned); }
+
+    /* restarts the search at the start of the input */
+    iterator begin() { return iterator(this); }
+    std::default_sentinel_t end() const { return {}; }
+
+  private:
+    friend class Regex;
+
+    match_range(const regex* compiled, std::string_view text)
+        : r(compiled), input(text), local(), owned(nullptr) {
+        /* matching a moved-from Regex */
+        assert(r != nullptr);
+        local.r = r;
+        if (regex_needs_scratch(r)) {
+            owned = new_regex_scratch(r);
+        }
+    }
+
+    regex_scratch* scratch() { return owned != nullptr ? owned : &local; }
+
+    const regex* r;
+    std::string_view input;
+    regex_scratch local;
+    regex_scratch* owned;
+};
+
+
+inline std::optional<Regex::match>
+Regex::match_first(std::string_view input) const {
+    match_range range(r, input);
+    auto first = range.begin();
+    if (first == range.end()) {
+        return std::nullopt;
+    }
+    return *first;
+}
+
+
+inline Regex::match_range Regex::matches(std::string_view input) const {
+    return match_range(r, input);
+}
+
+
+inline Regex::match_range
+Regex::matches(std::span<const std::byte> input) const {
+    return match_range(r, as_chars(input));
+}
+
+
+#endif
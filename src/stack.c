@@ -1,10 +1,11 @@
+#include "alloc.h"
 #include "stack.h"
 #include <stdlib.h>
 #include <string.h>
 
 
 stack* new_stack(int type_size, void (*free_func)(void*)) {
-    stack* s = (stack*)malloc(sizeof(stack));
+    stack* s = (stack*)counted_malloc(sizeof(stack));
     s->type_size = type_size;
     s->size = 0;
     s->content = NULL;
@@ -14,7 +15,7 @@ stack* new_stack(int type_size, void (*free_func)(void*)) {
 
 
 int stack_push(stack* s, void* element) {
-    s->content = realloc(s->content, ++(s->size) * s->type_size);
+    s->content = counted_realloc(s->content, ++(s->size) * s->type_size);
     memcpy((s->content + (s->size - 1) * s->type_size), element, s->type_size);
     return 1;
 }
@@ -28,7 +29,7 @@ int stack_pop(stack* s, void* element) {
     if (s->free_func != NULL) {
         s->free_func(s->content + (s->size - 1) * s->type_size);
     }
-    s->content = realloc(s->content, --(s->size) * s->type_size);
+    s->content = counted_realloc(s->content, --(s->size) * s->type_size);
     return 1;
 }
 
@@ -39,8 +40,8 @@ int delete_stack(stack** s) {
             (*s)->free_func((*s)->content + ((*s)->size - 1) * (*s)->type_size);
         }
     }
-    free((*s)->content);
-    free(*s);
+    counted_free((*s)->content);
+    counted_free(*s);
     *s = NULL;
     return 1;
 }
\ No newline at end of file
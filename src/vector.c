@@ -1,10 +1,11 @@
+#include "alloc.h"
 #include "vector.h"
 #include <stdlib.h>
 #include <string.h>
 
 
 vector* new_vector(int type_size, void (*free_func)(void*)) {
-    vector* v = (vector*)malloc(sizeof(vector));
+    vector* v = (vector*)counted_malloc(sizeof(vector));
     v->type_size = type_size;
     v->size = 0;
     v->iterator = 0;
@@ -27,12 +28,12 @@ vector* new_vector_from_array(int type_size,
 
 
 static void vector_grow(vector* v) {
-    v->content = realloc(v->content, ++(v->size) * v->type_size);
+    v->content = counted_realloc(v->content, ++(v->size) * v->type_size);
 }
 
 
 static void vector_shrink(vector* v) {
-    v->content = realloc(v->content, --(v->size) * v->type_size);
+    v->content = counted_realloc(v->content, --(v->size) * v->type_size);
 }
 
 
@@ -210,8 +211,8 @@ int delete_vector(vector** v) {
             (*v)->free_func((*v)->content + ((*v)->size - 1) * (*v)->type_size);
         }
     }
-    free((*v)->content);
-    free(*v);
+    counted_free((*v)->content);
+    counted_free(*v);
     *v = NULL;
     return 1;
 }
\ No newline at end of file
@@ -1,9 +1,251 @@
 #include "../../src/regex.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+
+#define OK "\033[1;32m[OK]\033[0m"
+#define FAILED "\033[1;31m[FAILED]\033[0m"
+
+
+typedef struct {
+    char* expression;
+    char* input;
+    int success;
+    int location;
+    int length;
+} match_case;
+
+
+static match_case match_cases[] = {
+    {"test", "a test string", 1, 2, 4},
+    {"a*b", "xxaaab", 1, 2, 4},
+    {"a*?b", "aab", 1, 0, 3},
+    {"a+b", "b ab", 1, 2, 2},
+    {"a?b", "aab", 1, 1, 2},
+    {"a|b", "cab", 1, 1, 1},
+    {"(ab)|c", "xxcab", 1, 2, 1},
+    {"(abcd)|c", "abcd", 1, 0, 4},
+    {"a{2,5}b", "aaaaaab", 1, 1, 6},
+    {"a{2,4}", "aaaa", 1, 0, 2},
+    {"a{1}b", "aab", 1, 1, 2},
+    {"xa{0,1}b", "xaab xb", 1, 5, 2},
+    {"[a-f]b", "xyzfb", 1, 3, 2},
+    {"[^a-z]b", "abCb", 1, 2, 2},
+    {".*b", "<a>b c", 1, 0, 4},
+    {"<.*>", "<div>content</div>", 1, 0, 18},
+    {"<.*?>", "<div>content</div>", 1, 0, 5},
+    {"^ab", "xab", 0, 0, 0},
+    {"^ab", "abab", 1, 0, 2},
+    {"ab$", "abab", 1, 2, 2},
+    {"ab$", "abx", 0, 0, 0},
+    {"^\\^\\$$", "^$", 1, 0, 2},
+    {"a*", "bbb", 1, 0, 0},
+    {"x", "abc", 0, 0, 0},
+    {"caf\xc3\xa9", "un caf\xc3\xa9", 1, 3, 5},
+    {"[\x80-\xff]+!", "abc\xc3\xa9!", 1, 3, 3},
+    {"a.c", "xa;c", 1, 1, 3},
+    {"[^a-z]", "ab;", 1, 2, 1},
+    {"a,b}", "xa,b}", 1, 1, 4},
+    {".*$", "ab\x02" "c", 1, 0, 4},
+    {"a[\x01-z]b", "a\nb", 0, 0, 0},
+    {"[\t-\r]", "a\nb\tc", 1, 3, 1},
+};
+
+
+/* the same, compiled with REGEX_MULTILINE */
+static match_case multiline_cases[] = {
+    {"^ab", "xab\nabc", 1, 4, 2},
+    {"^ab", "xab\nxab\n", 0, 0, 0},
+    {"c$", "abc\nd", 1, 2, 1},
+    {"^a+$", "ab\naa\na", 1, 3, 2},
+    {"b", "a\nab", 1, 3, 1},
+    {"error\\.log$", "error.logs\nan error.log\nerror.log", 1, 14, 9},
+};
+
+
+/* the same, compiled with REGEX_ICASE */
+static match_case icase_cases[] = {
+    {"error", "An ERROR occurred", 1, 3, 5},
+    {"GET /[a-z]+$", "get /Index", 1, 0, 10},
+    {"[^a-z]+$", "abcXYZ12", 1, 6, 2},
+    {"Stra\xc3\x9f" "e", "STRA\xc3\x9f" "E", 1, 0, 7},
+    {"\\.Com$", "x.cOM", 1, 1, 4},
+    {"[A-C]x", "zbX", 1, 1, 2},
+};
+
+
+/* compiled with REGEX_CAPTURE, checks a single group */
+typedef struct {
+    char* expression;
+    char* input;
+    int group;
+    int success;
+    size_t location;
+    size_t length;
+} capture_case;
+
+
+static capture_case capture_cases[] = {
+    {"^([A-Z]+) (/[a-z/0-9]+) status=([0-9]+)$", "GET /item/12 status=404", 1,
+     1, 0, 3},
+    {"^([A-Z]+) (/[a-z/0-9]+) status=([0-9]+)$", "GET /item/12 status=404", 2,
+     1, 4, 8},
+    {"^([A-Z]+) (/[a-z/0-9]+) status=([0-9]+)$", "GET /item/12 status=404", 3,
+     1, 20, 3},
+    {"(a)*b", "xaab", 1, 1, 2, 1},
+    {"x(a?)y", "xy", 1, 1, 1, 0},
+    {"(a)?b", "b", 1, 0, 0, 0},
+    {"((a)|b)*c", "abc", 2, 1, 0, 1},
+    {"((a)|(ab))(c|(bcd))", "abcd", 3, 1, 0, 2},
+    {"((a)|(ab))(c|(bcd))", "abcd", 2, 0, 0, 0},
+    {"<(.*?)>", "<div>x</div>", 1, 1, 1, 3},
+};
+
+
+#define NR_CASES(cases) (sizeof(cases) / sizeof(match_case))
+
+
+static int check_match(match_case* c, int success, int l, int len) {
+    return success == c->success &&
+           (!success || (l == c->location && len == c->length));
+}
+
+
+/* compiles and matches all cases with the given flags, returns the number of
+ * failed cases */
+static int
+run_match_cases(char* label, match_case* cases, int nr_cases, int flags) {
+    int failures = 0;
+    regex_options options = {.flags = flags};
+    regex* r = NULL;
+
+    for (int i = 0; i < nr_cases; i++) {
+        int location = 0, length = 0;
+        regex_compile_ex(&r, cases[i].expression, &options);
+        int success = regex_match_first(r, cases[i].input, &location, &length);
+        success = check_match(&cases[i], success, location, length);
+        printf("[%s] %s  \"%s\" against \"%s\"\n", label,
+               success ? OK : FAILED, cases[i].expression, cases[i].input);
+        failures += !success;
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    return failures;
+}
+
+
+/* THREADS */
+
+
+#define NR_THREADS 4
+#define NR_THREAD_ROUNDS 20000
+#define THREAD_INPUT "GET /api/users?id=42 HTTP"
+
+
+/* every thread has to find the match of a sequential run */
+typedef struct {
+    const regex* r;
+    int location;
+    int length;
+    int errors;
+} thread_job;
+
+
+static void* match_thread(void* arg) {
+    thread_job* job = arg;
+    regex_scratch* s = new_regex_scratch(job->r);
+    for (int i = 0; i < NR_THREAD_ROUNDS; i++) {
+        int location, length;
+        if (!regex_match_first_scratch(job->r, s, THREAD_INPUT, &location,
+                                       &length) ||
+            location != job->location || length != job->length) {
+            job->errors++;
+        }
+    }
+    delete_regex_scratch(&s);
+    return NULL;
+}
+
+
+/* runs nr_threads threads on one shared regex, returns the wall time */
+static double run_threads(const regex* r, int nr_threads, int* errors) {
+    pthread_t threads[NR_THREADS];
+    thread_job jobs[NR_THREADS];
+    struct timespec start, end;
+    int location = -1, length = -1;
+
+    if (!regex_match_first(r, THREAD_INPUT, &location, &length)) {
+        (*errors)++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < nr_threads; i++) {
+        jobs[i].r = r;
+        jobs[i].location = location;
+        jobs[i].length = length;
+        jobs[i].errors = 0;
+        pthread_create(&threads[i], NULL, match_thread, &jobs[i]);
+    }
+    for (int i = 0; i < nr_threads; i++) {
+        pthread_join(threads[i], NULL);
+        *errors += jobs[i].errors;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+
+/* PARALLEL */
+
+
+typedef struct {
+    size_t* results;
+    size_t nr_results;
+} parallel_results;
+
+
+static void collect_match(size_t location, size_t length, void* data) {
+    parallel_results* p = data;
+    p->results = realloc(p->results, (p->nr_results + 2) * sizeof(size_t));
+    p->results[p->nr_results++] = location;
+    p->results[p->nr_results++] = length;
+}
+
+
+/* a buffer of log lines of which only some match */
+static char* make_log_buffer(int nr_lines, size_t* length) {
+    char* buffer = malloc(nr_lines * 64);
+    *length = 0;
+    for (int i = 0; i < nr_lines; i++) {
+        *length += sprintf(buffer + *length, "%s /item/%d status=%d\n",
+                           (i % 3) ? "GET" : "POST", i, (i % 7) ? 200 : 404);
+    }
+    return buffer;
+}
+
+
+/* COUNTERS */
+
+
+static void count_event(const regex* r,
+                        regex_trace_event event,
+                        size_t position,
+                        void* data) {
+    (void)r;
+    (void)position;
+    ((int*)data)[event]++;
+}
+
 
 int main() {
     int success;
+    int failures = 0;
     regex* r = NULL;
     clock_t start, end;
     int nr_compile_cases = 26;
@@ -24,13 +266,739 @@ int main() {
         start = clock();
         success = regex_compile(&r, compile_input[i]);
         end = clock();
-        printf("[COMPILE] %s  input \"%s\"  in %f s\n",
-               success ? "\033[1;32m[OK]\033[0m" : "\033[1;31m[FAILED]\033[0m",
+        printf("[COMPILE] %s  input \"%s\"  in %f s\n", success ? OK : FAILED,
                compile_input[i], (double)(end - start) / CLOCKS_PER_SEC);
+        failures += !success;
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    /* blocks may be nested 1000 deep */
+    {
+        char pattern[2 * 1001 + 2];
+        int accepted[2];
+        for (int depth = 1000; depth <= 1001; depth++) {
+            memset(pattern, '(', depth);
+            pattern[depth] = 'a';
+            memset(pattern + depth + 1, ')', depth);
+            pattern[2 * depth + 1] = 0;
+            accepted[depth - 1000] = regex_compile(&r, pattern);
+            delete_regex(&r);
+        }
+        success = accepted[0] && !accepted[1];
+        printf("[PARSE] %s  1000 nested blocks, but not 1001\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    failures += run_match_cases("MATCH", match_cases, NR_CASES(match_cases), 0);
+    failures += run_match_cases("DFA", match_cases, NR_CASES(match_cases),
+                                REGEX_DFA);
+    failures += run_match_cases("REVERSE", match_cases, NR_CASES(match_cases),
+                                REGEX_REVERSE);
+    failures += run_match_cases("ICASE", icase_cases, NR_CASES(icase_cases),
+                                REGEX_ICASE);
+    failures += run_match_cases("ICASE+DFA", icase_cases,
+                                NR_CASES(icase_cases),
+                                REGEX_ICASE | REGEX_DFA);
+    failures += run_match_cases("MULTILINE", multiline_cases,
+                                NR_CASES(multiline_cases), REGEX_MULTILINE);
+    failures += run_match_cases("MULTILINE+DFA", multiline_cases,
+                                NR_CASES(multiline_cases),
+                                REGEX_MULTILINE | REGEX_DFA);
+    failures += run_match_cases("MULTILINE+REVERSE", multiline_cases,
+                                NR_CASES(multiline_cases),
+                                REGEX_MULTILINE | REGEX_REVERSE);
+
+    /* captures are reported relative to the input */
+    {
+        regex_options options = {.flags = REGEX_CAPTURE};
+        for (size_t i = 0; i < sizeof(capture_cases) / sizeof(capture_case);
+             i++) {
+            capture_case* c = &capture_cases[i];
+            regex_capture captures[4];
+            regex_compile_ex(&r, c->expression, &options);
+            regex_scratch* s = new_regex_scratch(r);
+            success = regex_match_captures(r, s, c->input, strlen(c->input),
+                                           captures, 4) &&
+                      captures[c->group].success == c->success &&
+                      (!c->success ||
+                       (captures[c->group].location == c->location &&
+                        captures[c->group].length == c->length));
+            printf("[CAPTURE] %s  group %d of \"%s\" against \"%s\"\n",
+                   success ? OK : FAILED, c->group, c->expression, c->input);
+            failures += !success;
+            delete_regex_scratch(&s);
+            delete_regex(&r);
+        }
+    }
+
+    /* patterns that never have a choice are extracted by a single thread */
+    {
+        regex_options options = {.flags = REGEX_CAPTURE};
+        regex* ambiguous = NULL;
+        regex_compile_ex(&r, capture_cases[0].expression, &options);
+        regex_compile_ex(&ambiguous, "((a)|(ab))(c|(bcd))", &options);
+        success = r->tagged->one_pass != NULL &&
+                  ambiguous->tagged->one_pass == NULL;
+        printf("[CAPTURE] %s  one pass for \"%s\"\n", success ? OK : FAILED,
+               capture_cases[0].expression);
+        failures += !success;
+        delete_regex(&ambiguous);
+        delete_regex(&r);
+    }
+
+    /* the tags of the epsilon paths take memory linear in the nfa, not
+     * quadratic: (a){2000} used to need about 250 MB */
+    {
+        regex_compile_stats stats;
+        regex_options options = {.flags = REGEX_CAPTURE, .stats = &stats};
+        char* input = malloc(2000);
+        memset(input, 'a', 2000);
+        regex_capture captures[2];
+        success = regex_compile_ex(&r, "(a){2000}", &options) &&
+                  stats.peak_memory < 64 << 20;
+        regex_scratch* s = success ? new_regex_scratch(r) : NULL;
+        success = success &&
+                  regex_match_captures(r, s, input, 2000, captures, 2) &&
+                  captures[0].length == 2000 && captures[1].success &&
+                  captures[1].location == 1999 && captures[1].length == 1;
+        printf("[CAPTURE] %s  \"(a){2000}\" in %zu KB at most\n",
+               success ? OK : FAILED, stats.peak_memory >> 10);
+        failures += !success;
+        delete_regex_scratch(&s);
+        delete_regex(&r);
+        free(input);
+    }
+
+    printf("\n");
+
+    /* . and classes are ranges over all bytes instead of one transition per
+     * symbol */
+    {
+        int nr_transitions = 0;
+        regex_options options = {.flags = REGEX_DFA};
+        regex_compile_ex(&r, "[^a-z].*b", &options);
+        for (int i = 0; i < r->nr_states; i++) {
+            nr_transitions += r->states[i]->nr_transitions;
+        }
+        success = nr_transitions < 32;
+        printf("[RANGES] %s  %d transitions for \"[^a-z].*b\"\n",
+               success ? OK : FAILED, nr_transitions);
+        failures += !success;
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    /* with REGEX_ICASE both cases of a letter share a column of the table */
+    {
+        regex_options options = {.flags = REGEX_ICASE | REGEX_DFA};
+        regex_compile_ex(&r, "[a-c]x", &options);
+        success = r->symbol_class['a'] == r->symbol_class['A'] &&
+                  r->symbol_class['X'] == r->symbol_class['x'] &&
+                  r->symbol_class['a'] != r->symbol_class['x'];
+        printf("[ICASE] %s  %d symbol classes for \"[a-c]x\"\n",
+               success ? OK : FAILED, r->nr_classes);
+        failures += !success;
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    /* short patterns are matched by the position automaton, long ones still
+     * get a dfa */
+    {
+        char long_pattern[3 * REGEX_MAX_POSITIONS + 1] = "";
+        for (int i = 0; i < REGEX_MAX_POSITIONS; i++) {
+            strcat(long_pattern, "ab|");
+        }
+        long_pattern[3 * REGEX_MAX_POSITIONS - 1] = '\0';
+        regex_compile(&r, "^[a-z]+@(ab|c)*\\.com$");
+        success = r->positions != NULL && r->table == NULL;
+        delete_regex(&r);
+        regex_compile(&r, long_pattern);
+        success = success && r->positions == NULL && r->table != NULL;
+        delete_regex(&r);
+        printf("[POSITIONS] %s  bit-parallel matcher for short patterns\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    /* every phase that ran reports its automaton, the allocations are
+     * counted */
+    {
+        regex_compile_stats stats;
+        regex_options options = {.flags = REGEX_DFA, .stats = &stats};
+        regex_compile_ex(&r, "(a|b)*c", &options);
+        regex_phase_stats* dfa = &stats.phases[rp_dfa];
+        /* a start state and the positions ^ a b c $; the start state is
+         * followed by all but $ */
+        success = stats.phases[rp_parse].ran &&
+                  stats.phases[rp_parse].states_after == 6 && dfa->ran &&
+                  stats.phases[rp_table].ran &&
+                  !stats.phases[rp_positions].ran &&
+                  dfa->states_before == stats.phases[rp_parse].states_after &&
+                  dfa->states_after == r->nr_states &&
+                  stats.max_follow == 4 && stats.total_follow == 14 &&
+                  stats.nr_allocations > 0 &&
+                  stats.memory > 0 && stats.peak_memory >= stats.memory;
+        delete_regex(&r);
+
+        options.flags = 0;
+        regex_compile_ex(&r, "(a|b)*c", &options);
+        success = success && stats.phases[rp_positions].ran &&
+                  stats.phases[rp_positions].states_after ==
+                      r->positions->nr_positions &&
+                  !stats.phases[rp_dfa].ran;
+        delete_regex(&r);
+        printf("[STATS] %s  compile statistics of \"(a|b)*c\"\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    /* counters and trace events only exist with -DREGEX_COUNTERS; a[bc]
+     * is not a plain string, so it restarts like any automaton, but only at
+     * an a or the line end: the bytes in between are scanned, not tried */
+    {
+        int events[3] = {0};
+        int location, length;
+        regex_counters counters, reset;
+        regex_options options = {.trace = count_event, .trace_data = events};
+        regex_compile_ex(&r, "a[bc]", &options);
+        regex_match_first(r, "xxab", &location, &length);
+        regex_match_first(r, "xx", &location, &length);
+        if (regex_get_counters(r, &counters)) {
+            success = counters.match_calls == 2 && counters.matches == 1 &&
+                      counters.restarts == 2 && counters.bytes_scanned == 7 &&
+                      events[rt_restart] == 2 && events[rt_match] == 1;
+            regex_reset_counters(r);
+            regex_get_counters(r, &reset);
+            success = success && reset.match_calls == 0;
+        } else {
+            success = counters.match_calls == 0 && events[rt_match] == 0;
+        }
+        printf("[COUNTERS] %s  %zu calls, %zu restarts, %zu bytes scanned\n",
+               success ? OK : FAILED, counters.match_calls, counters.restarts,
+               counters.bytes_scanned);
+        failures += !success;
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    /* a dfa over the state budget falls back to simulating the nfa, which
+     * has to find exactly the same matches */
+    {
+        char* pattern = "(a|b)*a(a|b)(a|b)(a|b)(a|b)c";
+        char* inputs[] = {"abbbac", "babaabbbac", "aaaaa", "xabbbbc",
+                          "ababababc", "aaaac", ""};
+        regex* full = NULL;
+        regex_options unlimited = {.flags = REGEX_DFA, .max_states = -1};
+        regex_options budget = {.flags = REGEX_CAPTURE | REGEX_DFA,
+                                .max_states = 8};
+        regex_compile_ex(&full, pattern, &unlimited);
+        regex_compile_ex(&r, pattern, &budget);
+        success = full->table != NULL && r->table == NULL && r->nfa != NULL &&
+                  !regex_needs_scratch(full) && regex_needs_scratch(r);
+        for (int i = 0; i < 7; i++) {
+            int l1 = -1, len1 = -1, l2 = -1, len2 = -1;
+            int s1 = regex_match_first(full, inputs[i], &l1, &len1);
+            int s2 = regex_match_first(r, inputs[i], &l2, &len2);
+            success = success && s1 == s2 && l1 == l2 && len1 == len2;
+        }
+        regex_scratch* s = new_regex_scratch(r);
+        regex_capture captures[2];
+        success = success &&
+                  regex_match_captures(r, s, "babaabbbac", 10, captures, 2) &&
+                  captures[1].success && captures[1].location == 3;
+
+        /* a single pass: every byte of a large input is read once, where
+         * restarting at every position would take about n * n / 2 steps */
+        size_t n = 1 << 20;
+        char* input = malloc(n);
+        for (size_t i = 0; i < n; i++) {
+            input[i] = "ab"[(i * 7 + i / 3) % 2];
+        }
+        size_t location, length;
+        regex_match_limits limits = {.max_steps = n + 1};
+        success = success &&
+                  regex_match_first_limited(r, s, input, n, &limits, &location,
+                                            &length) == 0;
+        memcpy(input + n - 6, "abbbac", 6);
+        success = success &&
+                  regex_match_first_limited(r, s, input, n, &limits, &location,
+                                            &length) == 1 &&
+                  location == 0 && length == n;
+        free(input);
+        delete_regex_scratch(&s);
+        printf("[BUDGET] %s  nfa fallback for \"%s\" with %d dfa states\n",
+               success ? OK : FAILED, pattern, full->nr_states);
+        failures += !success;
+        delete_regex(&full);
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    /* untrusted patterns fail with the limit they exceed */
+    {
+        regex_error error;
+        regex_options options = {.max_nfa_states = 100, .error = &error};
+        success = !regex_compile_ex(&r, "a{1000}", &options) &&
+                  r == NULL && error == re_nfa_states;
+        options.max_nfa_states = 2000;
+        success = success && regex_compile_ex(&r, "a{1000}", &options) &&
+                  error == re_none;
+        delete_regex(&r);
+        success = success && !regex_compile_ex(&r, "a{1", &options) &&
+                  error == re_syntax &&
+                  !regex_compile_ex(&r, "((a{1000}){1000}){3000}", &options) &&
+                  error == re_nfa_states;
+
+        /* every + doubles the states, 70 nested ones must not wrap around */
+        char nested[3 * 70 + 2];
+        int nr_nested = 70;
+        memset(nested, '(', nr_nested);
+        nested[nr_nested] = 'a';
+        for (int i = 0; i < nr_nested; i++) {
+            memcpy(nested + nr_nested + 1 + 2 * i, ")+", 2);
+        }
+        nested[3 * nr_nested + 1] = '\0';
+        options.max_nfa_states = 100;
+        success = success && !regex_compile_ex(&r, nested, &options) &&
+                  error == re_nfa_states;
+        options.max_nfa_states = 0;
+        success = success && !regex_compile_ex(&r, nested, &options) &&
+                  error == re_nfa_states;
+
+        /* max_states below max_dfa_states still falls back */
+        options = (regex_options){.flags = REGEX_DFA,
+                                  .max_dfa_states = 8,
+                                  .error = &error};
+        char* pattern = "(a|b)*a(a|b)(a|b)(a|b)(a|b)c";
+        success = success && !regex_compile_ex(&r, pattern, &options) &&
+                  error == re_dfa_states;
+        options.max_states = 4;
+        success = success && regex_compile_ex(&r, pattern, &options) &&
+                  r->nfa != NULL && error == re_none;
+        delete_regex(&r);
+
+        options = (regex_options){.flags = REGEX_DFA,
+                                  .max_states = -1,
+                                  .max_memory = 1 << 16,
+                                  .error = &error};
+        success = success &&
+                  !regex_compile_ex(&r, "(a|b)*a(a|b){12}", &options) &&
+                  error == re_memory;
+        options.max_memory = 0;
+        options.timeout = 0.01;
+        success = success &&
+                  !regex_compile_ex(&r, "(a|b)*a(a|b){20}", &options) &&
+                  error == re_timeout;
+        printf("[LIMITS] %s  compile limits for untrusted patterns\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    /* every position of a large alternation follows every other, and the
+     * follow sets and dfa states are collected without quadratic scans */
+    {
+        int nr_alternatives = 3000;
+        char* pattern = malloc(2 * nr_alternatives + 3);
+        pattern[0] = '(';
+        for (int i = 0; i < nr_alternatives; i++) {
+            pattern[2 * i + 1] = 'a';
+            pattern[2 * i + 2] = '|';
+        }
+        strcpy(pattern + 2 * nr_alternatives, ")*");
+        regex_error error;
+        regex_options options = {
+            .flags = REGEX_DFA, .timeout = 20, .error = &error};
+        int location = -1, length = -1;
+        success = regex_compile_ex(&r, pattern, &options) &&
+                  regex_match_first(r, "aaab", &location, &length) &&
+                  location == 0 && length == 3;
+        printf("[LIMITS] %s  (a|a|...)* with %d alternatives\n",
+               success ? OK : FAILED, nr_alternatives);
+        failures += !success;
+        delete_regex(&r);
+        free(pattern);
+    }
+
+    printf("\n");
+
+    /* the restarts on a hostile input stop at the step limit or deadline,
+     * reporting how far they got */
+    {
+        size_t n = 100000;
+        char* input = malloc(n + 1);
+        memset(input, 'a', n);
+        input[n] = 0;
+        size_t location, length;
+        regex_match_limits limits = {.max_steps = 5000};
+        regex_compile(&r, "a*c");
+        regex_scratch* s = new_regex_scratch(r);
+        success =
+            regex_match_first_limited(r, s, input, 1000, &limits, &location,
+                                      &length) == REGEX_MATCH_LIMIT &&
+            location > 0 && location < 1000 && length > 0;
+        limits.max_steps = 1000000;
+        success = success && regex_match_first_limited(r, s, input, 1000,
+                                                       &limits, &location,
+                                                       &length) == 0;
+        limits = (regex_match_limits){.timeout = 0.01};
+        success = success &&
+                  regex_match_first_limited(r, s, input, n, &limits, &location,
+                                            &length) == REGEX_MATCH_LIMIT;
+        delete_regex_scratch(&s);
+
+        regex_options options = {.flags = REGEX_REVERSE};
+        regex_compile_ex(&r, "a*c$", &options);
+        s = new_regex_scratch(r);
+        memcpy(input + 997, "\nac", 3);
+        limits = (regex_match_limits){.max_steps = 10000};
+        success = success && r->reverse != NULL &&
+                  regex_match_first_limited(r, s, input, 1000, &limits,
+                                            &location, &length) == 1 &&
+                  location == 998 && length == 2;
+        delete_regex_scratch(&s);
+        delete_regex(&r);
+        free(input);
+        printf("[LIMITED] %s  match step limit and deadline\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    /* plain strings are searched for directly and find what the automaton
+     * finds */
+    {
+        char* literals[] = {"test", "a\\.b", "(ab)c", "abcab"};
+        char* others[] = {"a|b", "a*", "^ab", "ab$", "[ab]", "a.b", "|ab"};
+        char* inputs[] = {"abcabcab", "xxabcabx", "a.b ab.c", "abab", "",
+                          "testtest", "aabc", "abca", "tes"};
+        success = 1;
+        for (int i = 0; i < 4; i++) {
+            regex_compile(&r, literals[i]);
+            regex_literal* literal = r->literal;
+            success = success && literal != NULL;
+            for (int j = 0; j < 9 && literal != NULL; j++) {
+                int l1 = -1, len1 = -1, l2 = -1, len2 = -1;
+                int s1 = regex_match_first(r, inputs[j], &l1, &len1);
+                r->literal = NULL;
+                int s2 = regex_match_first(r, inputs[j], &l2, &len2);
+                r->literal = literal;
+                success = success && s1 == s2 && l1 == l2 && len1 == len2;
+            }
+            delete_regex(&r);
+        }
+        for (int i = 0; i < 7; i++) {
+            regex_compile(&r, others[i]);
+            success = success && r->literal == NULL;
+            delete_regex(&r);
+        }
+        regex_options options = {.flags = REGEX_ICASE};
+        regex_compile_ex(&r, "ab", &options);
+        success = success && r->literal == NULL;
+        delete_regex(&r);
+        printf("[LITERAL] %s  plain strings skip the automaton\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    /* states that loop on all but a few bytes skip to the next of them and
+     * match like the nfa simulation, which steps through every byte; short
+     * patterns get a dfa for them without REGEX_DFA as well */
+    {
+        char* patterns[] = {"\"[^\"]*\"", "a[^b]*b", "x.*y", "^[^:]*:", "c.*"};
+        char line[400];
+        memset(line, 'a', sizeof(line) - 1);
+        line[sizeof(line) - 1] = 0;
+        memcpy(line + 100, "x\"a:c", 5);
+        memcpy(line + 350, "\"by", 3);
+        regex* nfa = NULL;
+        regex_options options = {.flags = REGEX_DFA, .max_states = 1};
+        success = 1;
+        for (int i = 0; i < 5; i++) {
+            regex_compile(&r, patterns[i]);
+            regex_compile_ex(&nfa, patterns[i], &options);
+            int loops = 0;
+            for (int s = 0; r->table != NULL && s < r->nr_states; s++) {
+                loops += (r->state_flags[s] & sf_loop) != 0;
+            }
+            int l1 = -1, len1 = -1, l2 = -1, len2 = -1;
+            int s1 = regex_match_first(r, line, &l1, &len1);
+            int s2 = regex_match_first(nfa, line, &l2, &len2);
+            success = success && r->positions == NULL && loops > 0 && s1 &&
+                      s1 == s2 && l1 == l2 && len1 == len2;
+        }
+        /* without a loop state the position automaton stays */
+        regex_compile(&r, "[a-z]+[0-9]");
+        success = success && r->positions != NULL && r->table == NULL;
+        delete_regex(&nfa);
+        delete_regex(&r);
+        printf("[LOOP] %s  loop states skip to the bytes leaving them\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    /* anchored patterns are detected at compile time */
+    {
+        char* anchored[] = {"^ab", "^(a|b)c", "^a*b"};
+        char* unanchored[] = {"ab", "(^a)|b", "a^b", "^?ab"};
+        success = 1;
+        for (int i = 0; i < 3; i++) {
+            regex_compile(&r, anchored[i]);
+            success = success && r->line_start;
+            delete_regex(&r);
+        }
+        for (int i = 0; i < 4; i++) {
+            if (regex_compile(&r, unanchored[i])) {
+                success = success && !r->line_start;
+            }
+            delete_regex(&r);
+        }
+        printf("[ANCHORED] %s  anchored patterns detected\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    /* restarts jump to the bytes the start state can read; digits need the
+     * table, a|c the byte scan, and . everything but the line end */
+    {
+        int location, length;
+        char text[] = "version \xe9t\xe9 2 of 10.25, \xff 3.5";
+        regex_compile(&r, "[0-9]\\.[0-9]");
+        success = r->start_bytes && r->start_bytes->nr_bytes == 10 &&
+                  r->start_bytes->member['7'] && !r->start_bytes->member['.'];
+        success = success && regex_match_first(r, text, &location, &length) &&
+                  location == 18 && length == 3;
+        delete_regex(&r);
+        regex_compile(&r, "(a|c)b");
+        success = success && r->start_bytes && r->start_bytes->nr_bytes == 2;
+        success = success &&
+                  regex_match_first(r, "aacab", &location, &length) &&
+                  location == 3 && length == 2;
+        delete_regex(&r);
+        regex_compile(&r, ".a");
+        success = success && r->start_bytes &&
+                  r->start_bytes->nr_bytes == 255 &&
+                  !r->start_bytes->member['\n'];
+        delete_regex(&r);
+        printf("[START] %s  restarts skip to the bytes a match starts with\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    /* searching on from a byte: ^ only where a line starts, the same
+     * matches with and without the reverse automaton and for a literal */
+    {
+        size_t location, length;
+        const char text[] = "abxab\nab";
+        const char* patterns[] = {"^ab", "^ab$", "ab"};
+        int flags[] = {REGEX_MULTILINE, REGEX_MULTILINE | REGEX_REVERSE, 0};
+        success = 1;
+        for (int i = 0; i < 3; i++) {
+            regex_options options = {.flags = flags[i]};
+            regex_compile_ex(&r, (char*)patterns[i], &options);
+            regex_scratch* s = new_regex_scratch(r);
+            size_t expected = i < 2 ? 6 : 3;
+            success = success &&
+                      regex_match_from(r, s, text, 8, 1, &location, &length) &&
+                      location == expected && length == 2;
+            success = success &&
+                      regex_match_from(r, s, text, 8, 6, &location, &length) &&
+                      location == 6 && length == 2;
+            success = success &&
+                      !regex_match_from(r, s, text, 8, 7, &location, &length) &&
+                      !regex_match_from(r, s, text, 8, 9, &location, &length);
+            delete_regex_scratch(&s);
+            delete_regex(&r);
+        }
+        printf("[FROM] %s  matching from the middle of the input\n",
+               success ? OK : FAILED);
+        failures += !success;
+    }
+
+    printf("\n");
+
+    /* one shared regex, one scratch per thread; every thread has to find
+     * what a sequential run finds. With two or more cpus the threads also
+     * have to scale, but the wall clock of a shared machine is noisy: the
+     * best of three runs has to reach half of linear, where make bench asks
+     * for 60% */
+    {
+        int errors = 0;
+        long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int nr_parallel = nr_cpus < NR_THREADS ? (int)nr_cpus : NR_THREADS;
+        double speedup = 0;
+        regex_compile(&r, "/[a-z]+\\?[a-z]+=");
+        for (int i = 0; i < 3; i++) {
+            double single = run_threads(r, 1, &errors) * NR_THREADS;
+            double parallel = run_threads(r, NR_THREADS, &errors);
+            speedup = single / parallel > speedup ? single / parallel : speedup;
+        }
+        success = errors == 0 &&
+                  (nr_parallel < 2 || speedup >= 0.5 * nr_parallel);
+        printf("[THREADS] %s  %d threads sharing one regex on %ld cpus, "
+               "speedup %.2f\n",
+               success ? OK : FAILED, NR_THREADS, nr_cpus, speedup);
+        failures += !success;
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    /* the parallel scan must report exactly what a sequential one does */
+    {
+        size_t length;
+        char* buffer = make_log_buffer(10000, &length);
+        parallel_results sequential = {NULL, 0}, parallel = {NULL, 0};
+        regex_compile(&r, "^POST /item/[0-9]+ status=404$");
+        regex_match_parallel(r, buffer, length, 1, collect_match, &sequential);
+        regex_match_parallel(r, buffer, length, NR_THREADS, collect_match,
+                             &parallel);
+        success = sequential.nr_results == 2 * 477 &&
+                  sequential.nr_results == parallel.nr_results &&
+                  !memcmp(sequential.results, parallel.results,
+                          sequential.nr_results * sizeof(size_t));
+        printf("[PARALLEL] %s  %zu matching lines in %d chunks\n",
+               success ? OK : FAILED, parallel.nr_results / 2, NR_THREADS);
+        failures += !success;
+        free(sequential.results);
+        free(parallel.results);
+        free(buffer);
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    /* batch matching must agree with matching every input on its own */
+    {
+        size_t length, nr_inputs = 0;
+        char* buffer = make_log_buffer(1000, &length);
+        size_t* offsets = malloc(1001 * sizeof(size_t));
+        const char** inputs = malloc(1000 * sizeof(char*));
+        size_t* lengths = malloc(1000 * sizeof(size_t));
+        regex_batch_result* buffer_results =
+            malloc(1000 * sizeof(regex_batch_result));
+        regex_batch_result* pointer_results =
+            malloc(1000 * sizeof(regex_batch_result));
+
+        /* every line including its line break is one input */
+        offsets[0] = 0;
+        for (size_t i = 0; i < length; i++) {
+            if (buffer[i] == '\n') {
+                inputs[nr_inputs] = buffer + offsets[nr_inputs];
+                lengths[nr_inputs] = i + 1 - offsets[nr_inputs];
+                offsets[++nr_inputs] = i + 1;
+            }
+        }
+
+        regex_compile(&r, "^POST /item/[0-9]+ status=404");
+        regex_scratch* s = new_regex_scratch(r);
+        size_t nr_matches = regex_match_batch_buffer(r, buffer, offsets,
+                                                     nr_inputs, buffer_results);
+        success = nr_matches == regex_match_batch(r, inputs, lengths, nr_inputs,
+                                                  pointer_results);
+        for (size_t i = 0; i < nr_inputs; i++) {
+            size_t location = 0, match_length = 0;
+            int matched = regex_match_first_n(r, s, buffer + offsets[i],
+                                              offsets[i + 1] - offsets[i],
+                                              &location, &match_length);
+            success = success && matched == buffer_results[i].success &&
+                      matched == pointer_results[i].success &&
+                      (!matched || (location == buffer_results[i].location &&
+                                    match_length == buffer_results[i].length &&
+                                    location == pointer_results[i].location &&
+                                    match_length == pointer_results[i].length));
+        }
+        printf("[BATCH] %s  %zu of %zu inputs matching\n", success ? OK : FAILED,
+               nr_matches, nr_inputs);
+        failures += !success;
+
+        delete_regex_scratch(&s);
+        free(pointer_results);
+        free(buffer_results);
+        free(lengths);
+        free(inputs);
+        free(offsets);
+        free(buffer);
+        delete_regex(&r);
+    }
+
+    printf("\n");
+
+    /* renumbering the states for a sample must not change any match; every
+     * line starts with LINE_START, and most lines with GET */
+    {
+        size_t length;
+        char* buffer = make_log_buffer(1000, &length);
+        char* pattern = "[GP][A-Z]+ /item/[0-9]+ status=[0-9]+";
+        regex* reordered = NULL;
+        regex_options options = {.flags = REGEX_MULTILINE | REGEX_DFA};
+        regex_compile_ex(&r, pattern, &options);
+        regex_compile_ex(&reordered, pattern, &options);
+        success = regex_optimize_layout(reordered, buffer, length);
+        const int* row = reordered->table;
+        int line_start = row[reordered->symbol_class[LINE_START]];
+        row = reordered->table + line_start * reordered->nr_classes;
+        success = success && line_start == 1 &&
+                  row[reordered->symbol_class['G']] == 2;
+
+        regex_scratch* s = new_regex_scratch(r);
+        regex_scratch* s2 = new_regex_scratch(reordered);
+        size_t from = 0, nr_matches = 0;
+        while (success && from <= length) {
+            size_t l1, n1, l2, n2;
+            int m1 = regex_match_from(r, s, buffer, length, from, &l1, &n1);
+            int m2 = regex_match_from(reordered, s2, buffer, length, from,
+                                      &l2, &n2);
+            success = m1 == m2 && (!m1 || (l1 == l2 && n1 == n2));
+            if (!m1) {
+                break;
+            }
+            nr_matches++;
+            from = l1 + (n1 ? n1 : 1);
+        }
+        success = success && nr_matches == 1000;
+
+        /* the position automaton of a short pattern has no table */
+        regex* positions = NULL;
+        regex_compile(&positions, "[GP][A-Z]+ /item/[0-9]+");
+        success = success && positions->positions != NULL &&
+                  !regex_optimize_layout(positions, buffer, length) &&
+                  positions->positions != NULL;
+        delete_regex(&positions);
+        printf("[LAYOUT] %s  %d states renumbered for a sample\n",
+               success ? OK : FAILED, reordered->nr_states);
+        failures += !success;
+
+        delete_regex_scratch(&s2);
+        delete_regex_scratch(&s);
+        delete_regex(&reordered);
+        free(buffer);
         delete_regex(&r);
     }
 
     printf("\n");
 
-    return 0;
-}
\ No newline at end of file
+    return failures != 0;
+}
@@ -0,0 +1,189 @@
+#include "../../src/ct_regex.hpp"
+#include "../../src/regex.hpp"
+#include <cstdio>
+#include <ranges>
+#include <string>
+#include <vector>
+
+
+#define OK "\033[1;32m[OK]\033[0m"
+#define FAILED "\033[1;31m[FAILED]\033[0m"
+
+
+/* ct_regex matches at compile time */
+static_assert(ct_regex<"GET /api/[a-z]+$">::match_first("GET /api/users")
+                  ->length == 14);
+static_assert(ct_regex<"[0-9]+\\.[0-9]">::match_first("version 10.25")
+                  ->location == 8);
+static_assert(!ct_regex<"^ab">::match_first("xab"));
+static_assert(ct_regex<"^ab", REGEX_MULTILINE>::match_first("xab\nabc")
+                  ->location == 4);
+static_assert(!ct_regex<"a[\x01-z]b", REGEX_MULTILINE>::match_first("a\nb"));
+static_assert(!ct_regex_detail::measure("a(b", 0).valid);
+static_assert(!ct_regex_detail::measure("a{3,2}", 0).valid);
+
+
+static_assert(std::ranges::input_range<Regex::match_range>);
+static_assert(!std::is_copy_constructible_v<Regex>);
+static_assert(std::is_nothrow_move_constructible_v<Regex>);
+
+
+/* every string of up to 5 symbols out of a, b, c, x, . and a line break */
+static std::vector<std::string> make_inputs() {
+    std::vector<std::string> inputs = {""};
+    const char symbols[] = "abcx.\n";
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i].size() == 5) {
+            continue;
+        }
+        for (int j = 0; j < 6; j++) {
+            inputs.push_back(inputs[i] + symbols[j]);
+        }
+    }
+    return inputs;
+}
+
+
+/* matches the ct_regex and the pattern compiled by the library against all
+ * inputs, returns 1 if they ever disagree */
+template <ct_regex_pattern Pattern, int Flags = 0>
+static int check_same(const std::vector<std::string>& inputs) {
+    regex* r = NULL;
+    regex_options options = {};
+    options.flags = Flags;
+    int success = regex_compile_ex(&r, (char*)Pattern.chars, &options);
+    regex_scratch* s = new_regex_scratch(r);
+
+    for (const std::string& input : inputs) {
+        std::size_t location = 0, length = 0;
+        int matched = regex_match_first_n(r, s, input.data(), input.size(),
+                                          &location, &length);
+        auto match = ct_regex<Pattern, Flags>::match_first(input);
+        success = success && matched == match.has_value() &&
+                  (!matched ||
+                   (location == match->location && length == match->length));
+    }
+
+    printf("[CT_REGEX] %s  \"%s\" with flags %d, %d states\n",
+           success ? OK : FAILED, Pattern.chars, Flags,
+           ct_regex<Pattern, Flags>::nr_states);
+    delete_regex_scratch(&s);
+    delete_regex(&r);
+    return !success;
+}
+
+
+/* the matches of pattern in input one after another, as (location, length)
+ * pairs; returns 1 if they differ from expected */
+static int check_matches(const char* pattern,
+                         int flags,
+                         std::string_view input,
+                         const std::vector<std::size_t>& expected) {
+    regex_options options = {};
+    options.flags = flags;
+    std::optional<Regex> re = Regex::compile(pattern, &options);
+    std::vector<std::size_t> found;
+    if (re) {
+        for (Regex::match m : re->matches(input)) {
+            found.push_back(m.location);
+            found.push_back(m.length);
+        }
+    }
+    int success = re && found == expected;
+
+    printf("[REGEX] %s  all matches of \"%s\" with flags %d\n",
+           success ? OK : FAILED, pattern, flags);
+    return !success;
+}
+
+
+/* compiling, moving, byte spans and the nfa fallback of Regex */
+static int check_regex() {
+    regex_options options = {};
+    options.flags = REGEX_DFA;
+    options.max_states = 2;
+    std::optional<Regex> nfa = Regex::compile("(a|b)*a(a|b)", &options);
+    std::optional<Regex> re = Regex::compile("b+c");
+    int success = !Regex::compile("a(b") && nfa && re &&
+                  nfa->get()->table == NULL && nfa->get()->positions == NULL;
+
+    std::string_view text = "xabbc bc";
+    Regex moved = std::move(*re);
+    success = success && re->get() == NULL;
+    auto match = moved.match_first(text.substr(2));
+    success = success && match && match->location == 0 && match->length == 3;
+
+    std::span<const std::byte> bytes = std::as_bytes(std::span(text));
+    std::size_t nr_matches = 0;
+    for (Regex::match m : moved.matches(bytes)) {
+        nr_matches++;
+        success = success && m.location == (nr_matches == 1 ? 2 : 6);
+    }
+    success = success && nr_matches == 2;
+
+    *re = std::move(*nfa);
+    match = re->match_first("bbaab");
+    success = success && match && match->location == 0;
+    success = success && !re->optimize_layout("abab");
+
+    options.max_states = 0;
+    std::optional<Regex> dfa = Regex::compile("b+c", &options);
+    success = success && dfa && dfa->optimize_layout(text);
+    match = dfa->match_first(text);
+    success = success && match && match->location == 2 && match->length == 3;
+    success = success && !moved.match_first("abb") && !moved.match_first("");
+
+    printf("[REGEX] %s  compile, move, bytes, nfa fallback and layout\n",
+           success ? OK : FAILED);
+    return !success;
+}
+
+
+int main() {
+    int failures = 0;
+    std::vector<std::string> inputs = make_inputs();
+
+    printf("\n");
+
+    failures += check_same<"abc">(inputs);
+    failures += check_same<"a*b">(inputs);
+    failures += check_same<"a*?b">(inputs);
+    failures += check_same<"a+?">(inputs);
+    failures += check_same<"(ab|a)*c">(inputs);
+    failures += check_same<"(a|b)*?c">(inputs);
+    failures += check_same<"a{2,4}">(inputs);
+    failures += check_same<"(a?b){1,3}c?">(inputs);
+    failures += check_same<"(c*b)?a">(inputs);
+    failures += check_same<"[^a]b|a.">(inputs);
+    failures += check_same<"[a-c]+x?">(inputs);
+    failures += check_same<"\\.+$">(inputs);
+    failures += check_same<"^a|b$">(inputs);
+    failures += check_same<"^(ab)*$">(inputs);
+    failures += check_same<".*b">(inputs);
+    failures += check_same<".*?b">(inputs);
+    failures += check_same<"x*$">(inputs);
+    failures += check_same<"(a|ab)(c|bcd)?">(inputs);
+    failures += check_same<"((a|b)+c){2,}">(inputs);
+    failures += check_same<"(a*)*b">(inputs);
+    failures += check_same<"|ab">(inputs);
+    failures += check_same<"^a|b$", REGEX_MULTILINE>(inputs);
+    failures += check_same<"(ab|c)*$", REGEX_MULTILINE>(inputs);
+    failures += check_same<"A[B-C]+", REGEX_ICASE>(inputs);
+    failures += check_same<"[^A]x", REGEX_ICASE | REGEX_MULTILINE>(inputs);
+
+    printf("\n");
+
+    failures += check_regex();
+    failures += check_matches("ab", 0, "abxab", {0, 2, 3, 2});
+    failures += check_matches("^ab", REGEX_MULTILINE, "ab\nxab\nab",
+                              {0, 2, 7, 2});
+    failures += check_matches("ab$", REGEX_MULTILINE | REGEX_REVERSE,
+                              "ab\nxab\nab", {0, 2, 4, 2, 7, 2});
+    failures += check_matches("^ab", 0, "ab\nab", {0, 2});
+    failures += check_matches("a*", 0, "bab", {1, 1, 2, 0, 3, 0});
+    failures += check_matches("x", 0, "", {});
+
+    printf("\n");
+
+    return failures != 0;
+}